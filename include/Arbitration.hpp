@@ -7,6 +7,7 @@
 // - try to start the arbitration with "start" method
 // - pass each received value on the bus to the "data" method
 //   which will then tell you what the state of the arbitration is
+// All reading of the clock and writing to the bus goes through the bus port.
 class Arbitration {
  public:
   enum state {
@@ -21,8 +22,9 @@ class Arbitration {
     restart2,     // restart the arbitration
   };
 
-  Arbitration()
-      : _arbitrating(false),
+  explicit Arbitration(BusPort& port)
+      : _port(port),
+        _arbitrating(false),
         _participateSecond(false),
         _arbitrationAddress(0),
         _restartCount(0) {}
@@ -44,9 +46,26 @@ class Arbitration {
   Arbitration::state data(BusState& busstate, uint8_t symbol,
                           uint32_t startBitTime);
 
+  // Histogram of the time from the start bit of the SYN until the write of
+  // our address returned, so it includes the delay of the task that handled
+  // the SYN. Bucket 0 counts everything below LATENCY_FIRST_US, the last
+  // bucket everything from LATENCY_FIRST_US + (LATENCY_BUCKETS - 2) *
+  // LATENCY_BUCKET_US onwards.
+  static constexpr int LATENCY_BUCKETS = 12;
+  static constexpr uint32_t LATENCY_FIRST_US = 4000;
+  static constexpr uint32_t LATENCY_BUCKET_US = 100;
+  const uint32_t* latencyHistogram() const { return _latency; }
+
  private:
+  // Waits for the begin of the window after the SYN, writes the address and
+  // records the latency. Returns the time waited.
+  int writeAddress(uint8_t address, uint32_t startBitTime);
+  void recordLatency(uint32_t latency);
+
+  BusPort& _port;
   bool _arbitrating;
   bool _participateSecond;
   uint8_t _arbitrationAddress;
   int _restartCount;
+  uint32_t _latency[LATENCY_BUCKETS] = {};
 };
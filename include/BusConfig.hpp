@@ -0,0 +1,26 @@
+#pragma once
+
+// Options of the bus side and the debug log. Kept free of ESP dependencies so
+// BusState and Arbitration also build on the host. Each option can be
+// overridden from the build flags.
+#if !defined(EBUS_INTERNAL)
+#ifndef USE_SOFTWARE_SERIAL
+#define USE_SOFTWARE_SERIAL 0
+#endif
+#ifndef USE_ASYNCHRONOUS
+#define USE_ASYNCHRONOUS 0  // requires USE_SOFTWARE_SERIAL
+#endif
+#ifndef USE_BURST_READ
+#define USE_BURST_READ 1  // not with USE_SOFTWARE_SERIAL
+#endif
+#ifndef USE_UART_EVENTS
+#define USE_UART_EVENTS 1  // requires USE_BURST_READ
+#endif
+#ifndef USE_ARBITRATION_PRIORITY
+#define USE_ARBITRATION_PRIORITY 0  // else round robin between clients
+#endif
+#endif
+
+inline int DEBUG_LOG(const char* format, ...) { return 0; }
+int DEBUG_LOG_IMPL(const char* format, ...);
+// #define DEBUG_LOG DEBUG_LOG_IMPL
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Access to the clock and the bus UART as seen by the arbitration process.
+// BusState and Arbitration only talk to the hardware through this interface,
+// so they can be driven by another implementation than the ESP32 UART, e.g.
+// a simulated bus running on the host.
+class BusPort {
+ public:
+  virtual ~BusPort() = default;
+
+  // Free running clock in microseconds, wraps around at 32 bit
+  virtual uint32_t micros() const = 0;
+
+  // Number of received symbols that are not yet processed
+  virtual int available() = 0;
+
+  // Next received symbol that is not yet processed, -1 if there is none
+  virtual int peek() = 0;
+
+  // Put a symbol on the bus
+  virtual size_t write(uint8_t symbol) = 0;
+
+  // Busy wait, used to put a symbol on the bus at the right moment
+  virtual void delayMicroseconds(uint32_t us) = 0;
+};
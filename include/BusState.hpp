@@ -1,8 +1,7 @@
 #pragma once
 
-#include <esp_timer.h>
-
-#include "main.hpp"
+#include "BusConfig.hpp"
+#include "BusPort.hpp"
 
 enum symbols { SYN = 0xAA };
 
@@ -10,7 +9,8 @@ enum symbols { SYN = 0xAA };
 // only start at well defined states of the bus. To asses the
 // state, all data received on the bus needs to be send to this
 // object. The object takes care of startup of the bus and
-// recovery when an unexpected event happens.
+// recovery when an unexpected event happens. Time is taken from
+// the clock of the bus port.
 class BusState {
  public:
   enum eState {
@@ -38,7 +38,8 @@ class BusState {
                             "eBusy"};
     return values[e];
   }
-  BusState() : _state(eStartup), _previousState(eStartup) {}
+  explicit BusState(const BusPort& port)
+      : _state(eStartup), _previousState(eStartup), _port(port) {}
   // Evaluate a symbol received on UART and determine what the new state of the
   // bus is
   inline void data(uint8_t symbol) {
@@ -90,12 +91,12 @@ class BusState {
   }
   inline eState syn(eState newstate) {
     _previousSYNtime = _SYNtime;
-    _SYNtime = (uint32_t)(esp_timer_get_time());
+    _SYNtime = _port.micros();
     return newstate;
   }
   eState error(eState currentstate, eState newstate) {
     _previousSYNtime = _SYNtime;
-    _SYNtime = (uint32_t)(esp_timer_get_time());
+    _SYNtime = _port.micros();
     DEBUG_LOG(
         "unexpected SYN on bus while state is %s, setting state to %s "
         "m=0x%02x, b=0x%02x %lu us\n",
@@ -107,11 +108,11 @@ class BusState {
   void reset() { _state = eStartup; }
 
   uint32_t microsSinceLastSyn() const {
-    return (uint32_t)(esp_timer_get_time()) - _SYNtime;
+    return _port.micros() - _SYNtime;
   }
 
   uint32_t microsSincePreviousSyn() const {
-    return (uint32_t)(esp_timer_get_time()) - _previousSYNtime;
+    return _port.micros() - _previousSYNtime;
   }
 
   eState _state;
@@ -120,4 +121,7 @@ class BusState {
   uint8_t _symbol = 0;
   uint32_t _SYNtime = 0;
   uint32_t _previousSYNtime = 0;
+
+ private:
+  const BusPort& _port;
 };
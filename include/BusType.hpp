@@ -1,10 +1,20 @@
 #pragma once
 
-#include <cstdint>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
-#include <queue>
+#include <cstdint>
 
 #include "Arbitration.hpp"
+#include "BusPort.hpp"
+#include "RingBuffer.hpp"
+#include "main.hpp"
+
+// Maximum number of received data items waiting to be read
+#define QUEUE_SIZE 480
+
+// Maximum number of symbols taken from the UART in one read
+#define BURST_SIZE 32
 
 enum responses {
   RESETTED = 0x0,
@@ -18,13 +28,36 @@ enum responses {
 
 enum errors { ERR_FRAMING = 0x00, ERR_OVERRUN = 0x01 };
 
-void getArbitrationClient(int& clientFd, uint8_t& address);
-void clearArbitrationClient();
-bool setArbitrationClient(int& clientFd, uint8_t& address);
+// Maximum number of clients waiting for arbitration at the same time
+#define ARBITRATION_QUEUE_SIZE MAX_WIFI_CLIENTS
+
+// Arbitration results of a client, wait is the time from the request until
+// the arbitration was won, lost or failed
+struct ArbitrationStatistics {
+  int clientFd = -1;
+  uint32_t requests = 0;
+  uint32_t won = 0;
+  uint32_t lost = 0;
+  uint32_t errors = 0;
+  uint64_t waitTotal = 0;  // us
+  uint32_t waitMax = 0;    // us
+};
 
-void arbitrationDone();
+// Each client can have one pending arbitration request. Requests are served
+// in order of arrival, or by eBUS priority with USE_ARBITRATION_PRIORITY. The
+// next request is started on the SYN after the previous one is done.
+bool setArbitrationClient(int clientFd, uint8_t address);
+void clearArbitrationClient(int clientFd);
+// forget the request and the statistics of a disconnected client
+void removeArbitrationClient(int clientFd);
+
+// result is STARTED, FAILED or ERROR_EBUS
+void arbitrationDone(int clientFd, uint8_t result);
 int arbitrationRequested(uint8_t& address);
 
+size_t getArbitrationStatistics(ArbitrationStatistics* statistics,
+                                size_t size);
+
 #include "atomic"
 #define ATOMIC_INT std::atomic<int>
 
@@ -32,8 +65,9 @@ int arbitrationRequested(uint8_t& address);
 // it flow through the arbitration process. The "read" method
 // will return data with meta information that tells what should
 // be done with the returned data. This object hides if the
-// underlying implementation is synchronous or asynchronous
-class BusType {
+// underlying implementation is synchronous or asynchronous.
+// It is the bus port used by the arbitration process.
+class BusType : public BusPort {
  public:
   // "receive" data should go to all clients that are not in arbitration mode
   // "enhanced" data should go only to the arbitrating client
@@ -54,9 +88,28 @@ class BusType {
 
   // Is there a value available that should be send to a client?
   bool read(data& d);
-  size_t write(uint8_t symbol);
+  // Called by the receiving task after new data was queued, so a consumer
+  // waiting in select can be woken up. Only used when symbols are received in
+  // a separate task.
+  void setDataCallback(void (*callback)());
+#if USE_UART_EVENTS
+  // Handle an event of the UART driver, rxTime is the time the event task
+  // woke up. Called by the event task, or by the simulated bus on the host.
+  void uartEvent(const uart_event_t& event, uint32_t rxTime);
+#endif
+  size_t write(uint8_t symbol) override;
   int availableForWrite();
-  int available();
+  int available() override;
+  int peek() override;
+  void delayMicroseconds(uint32_t us) override;
+  uint32_t micros() const override;
+
+  // Statistics of the queue between receive and read
+  uint32_t queueOverflows() const;
+  size_t queueHighWater() const;
+
+  // Time from the start bit of SYN to writing our address, see Arbitration
+  const uint32_t* latencyHistogram() const;
 
   // std::atomic seems not well supported on esp12e, besides it is also not
   // needed there
@@ -89,8 +142,32 @@ class BusType {
   TaskHandle_t _serialEventTask;
 
   static void readDataFromSoftwareSerial(void* args);
+
+  ATOMIC_INT _queueOverflows{0};
+  ATOMIC_INT _queueHighWater{0};
 #else
-  std::queue<data> _queue;
+  RingBuffer<data, QUEUE_SIZE> _queue;
+#endif
+
+#if USE_BURST_READ
+  // symbols of the current burst, that are handed to receive one by one
+  uint8_t _burstSymbols[BURST_SIZE];
+  uint32_t _burstTimes[BURST_SIZE];
+  size_t _burstCount = 0;
+  size_t _burstIndex = 0;
+
+  // rxTime is the time the last symbol of the burst was received
+  void receiveBurst(uint32_t rxTime);
+#endif
+
+#if USE_UART_EVENTS
+  // task that sleeps until the UART driver reports received symbols and runs
+  // them through the arbitration process
+  TaskHandle_t _uartEventTask = nullptr;
+
+  void (*_dataCallback)() = nullptr;
+
+  static void readDataFromUartEvents(void* args);
 #endif
 };
 
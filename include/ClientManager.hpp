@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "ClientType.hpp"
+#include "SocketWakeup.hpp"
 
 // ClientManager handles all connected clients and routes data between them and
 // the eBus It supports ReadOnly, Regular, and Enhanced clients.
@@ -20,6 +21,8 @@ class ClientManager {
 
   void stop();
 
+  const WakeLatency& getWakeLatency() const;
+
  private:
     struct ServerSocket {
       uint16_t port;
@@ -31,8 +34,10 @@ class ClientManager {
     ServerSocket enhancedServer{3335};
 
   ebus::Queue<uint8_t>* clientByteQueue = nullptr;
+  SocketWakeup wakeup;  // signaled when bus data or a bus grant arrives
   volatile bool stopRunner = false;
   volatile bool busRequestSuccess = false;
+  uint32_t busAvailableTimeout = 50;  // ms, until a warning is logged
 
   ebus::Bus* bus = nullptr;
   ebus::BusHandler* busHandler = nullptr;
@@ -49,6 +54,12 @@ class ClientManager {
   static bool createListenSocket(ServerSocket& server);
   static int acceptClient(ServerSocket& server);
   void acceptClients();
+
+  void waitForActivity(const AbstractClient* activeClient, bool idle);
+
+  // Send bus bytes to all connected clients except the given one
+  void forwardBytes(const AbstractClient* skipClient, const uint8_t* bytes,
+                    size_t size);
 };
 
 extern ClientManager clientManager;
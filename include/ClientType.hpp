@@ -3,24 +3,46 @@
 #if defined(EBUS_INTERNAL)
 #include <Ebus.h>
 
+// Bytes a client can send ahead before they have been processed
+#define CLIENT_RECEIVE_BUFFER_SIZE 64
+
+// Maximum number of bus bytes forwarded to a client with one send
+#define CLIENT_SEND_BATCH_SIZE 32
+
 // Abstract base class for all client types
 class AbstractClient {
  public:
   AbstractClient(int socketFd, ebus::Request* request, bool write);
 
-  virtual bool available() const = 0;
+  virtual bool available() = 0;
   virtual bool readByte(uint8_t& byte) = 0;
   virtual bool writeBytes(const std::vector<uint8_t>& bytes) = 0;
+  // Forward received bus bytes, each byte is sent as received data
+  virtual bool writeBytes(const uint8_t* bytes, size_t size) = 0;
   virtual bool handleBusData(const uint8_t& byte) = 0;
 
   bool isWriteCapable() const;
   bool isConnected() const;
   void stop();
 
+  int getSocketFd() const;
+
  protected:
   int socketFd;
   ebus::Request* request;
   bool write;
+
+  // Received bytes are collected with a single recv and then taken from the
+  // buffer one by one
+  uint8_t receiveBuffer[CLIENT_RECEIVE_BUFFER_SIZE];
+  size_t receiveStart = 0;
+  size_t receiveEnd = 0;
+
+  // Read everything the socket has (as far as it fits) into the buffer,
+  // returns the number of buffered bytes
+  size_t receive();
+  size_t buffered() const;
+  void consume(size_t size);
 };
 
 // ReadOnly client: only sends, never receives
@@ -28,9 +50,10 @@ class ReadOnlyClient : public AbstractClient {
  public:
   ReadOnlyClient(int socketFd, ebus::Request* request);
 
-  bool available() const override;
+  bool available() override;
   bool readByte(uint8_t& byte) override;
   bool writeBytes(const std::vector<uint8_t>& bytes) override;
+  bool writeBytes(const uint8_t* bytes, size_t size) override;
   bool handleBusData(const uint8_t& byte) override;
 };
 
@@ -39,9 +62,10 @@ class RegularClient : public AbstractClient {
  public:
   RegularClient(int socketFd, ebus::Request* request);
 
-  bool available() const override;
+  bool available() override;
   bool readByte(uint8_t& byte) override;
   bool writeBytes(const std::vector<uint8_t>& bytes) override;
+  bool writeBytes(const uint8_t* bytes, size_t size) override;
   bool handleBusData(const uint8_t& byte) override;
 };
 
@@ -50,10 +74,15 @@ class EnhancedClient : public AbstractClient {
  public:
   EnhancedClient(int socketFd, ebus::Request* request);
 
-  bool available() const override;
+  bool available() override;
   bool readByte(uint8_t& byte) override;
   bool writeBytes(const std::vector<uint8_t>& bytes) override;
+  bool writeBytes(const uint8_t* bytes, size_t size) override;
   bool handleBusData(const uint8_t& byte) override;
+
+ private:
+  // encoded batch of received bytes, up to two bytes per received byte
+  uint8_t sendBuffer[2 * CLIENT_SEND_BATCH_SIZE];
 };
 
 #endif
\ No newline at end of file
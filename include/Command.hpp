@@ -4,10 +4,14 @@
 #include <Ebus.h>
 #include <cJSON.h>
 
+#include <cstdint>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "JsonWriter.hpp"
+
 // This class represents a command configuration and its associated data
 
 class Command {
@@ -16,6 +20,10 @@ class Command {
   const uint32_t& getLast() const;
   void setLast(const uint32_t time);
 
+  // Position in the due heap of the store, SIZE_MAX when not in it
+  const size_t& getDueIndex() const;
+  void setDueIndex(const size_t index);
+
   const std::vector<uint8_t>& getData() const;
   void setData(const std::vector<uint8_t>& data);
 
@@ -23,13 +31,32 @@ class Command {
 
   const bool& getNumeric() const;
 
+  // Interval of the next poll in seconds, differs from the configured one in
+  // adaptive mode
+  const uint32_t& getCurrentInterval() const;
+  void adaptInterval(const bool changed);
+
+  // The value is due for publishing when no value was published yet, or
+  // minInterval ms have passed since the last one and, with onChange, the
+  // value moved beyond the deadband
+  bool publishDue(const uint32_t now, const bool onChange,
+                  const uint32_t minInterval) const;
+  // Remembers the current value as published at now
+  void setPublished(const uint32_t now);
+
   // Command field accessors
   const std::string& getKey() const;
   const std::string& getName() const;
+  // "values/" and the lowercase name, the topic below the mqtt root topic
+  const std::string& getValueTopic() const;
   const std::vector<uint8_t>& getReadCmd() const;
   const std::vector<uint8_t>& getWriteCmd() const;
   const bool& getActive() const;
   const uint32_t& getInterval() const;
+  const bool& getAdaptive() const;
+  const uint32_t& getMinInterval() const;
+  const uint32_t& getMaxInterval() const;
+  const bool& getAdaptiveLimits() const;
 
   // Data field accessors
   const bool& getMaster() const;
@@ -40,6 +67,7 @@ class Command {
   const float& getMax() const;
   const uint8_t& getDigits() const;
   const std::string& getUnit() const;
+  const float& getDeadband() const;
 
   // Home Assistant field accessors
   const bool& getHA() const;
@@ -54,32 +82,58 @@ class Command {
   const std::string& getHAStateClass() const;
   const float& getHAStep() const;
 
+  // Decoded value of the data, numeric or text depending on the datatype.
+  // Decoded once when the data is set.
+  const double& getValue() const;
+  const std::string& getText() const;
+
   // Data conversion
+  void writeValue(JsonWriter& json) const;
+  void writeValueJson(JsonWriter& json) const;
   const std::string getValueJson() const;
   const std::vector<uint8_t> getVectorFromJson(const cJSON* doc) const;
 
   // Serialization / Deserialization
+  void writeJson(JsonWriter& json) const;
   const std::string toJson() const;
   static Command fromJson(const cJSON* doc);
 
   static const std::string evaluate(const cJSON* doc);
 
+  // Heap memory owned by the command, without the object itself
+  size_t heapUsage() const;
+
  private:
   // Internal fields
   // last time of the successful command
   uint32_t last = 0;
+  // position in the due heap of the store
+  size_t due_index = SIZE_MAX;
   // received raw data
   std::vector<uint8_t> data = {};
+  // decoded data of numeric datatypes
+  double value = 0;
+  // decoded data of text datatypes
+  std::string text = "";
   // length of datatype
   size_t length = 1;
   // indicates numeric datatype
   bool numeric = false;
+  // interval of the next poll in seconds
+  uint32_t current_interval = 60;
+  // time of the last published value, 0 when none was published
+  uint32_t published = 0;
+  // last published value, text datatypes keep a hash of it
+  double published_value = 0;
+  size_t published_text = 0;
 
   // Command fields
   // unique key of command
   std::string key = "";
   // name of the command used as mqtt topic below "values/"
   std::string name = "";
+  // mqtt topic of the value, derived from the name
+  std::string value_topic = "";
   // read command as vector of "ZZPBSBNNDBx"
   std::vector<uint8_t> read_cmd = {};
   // write command as vector of "ZZPBSBNNDBx" (OPTIONAL)
@@ -88,6 +142,15 @@ class Command {
   bool active = false;
   // minimum interval between two commands in seconds (OPTIONAL)
   uint32_t interval = 60;
+  // adapt the interval to the change rate of the value (OPTIONAL)
+  bool adaptive = false;
+  // shortest interval in adaptive mode in seconds (OPTIONAL)
+  uint32_t min_interval = 10;
+  // longest interval in adaptive mode in seconds (OPTIONAL)
+  uint32_t max_interval = 600;
+  // poll at the shortest interval while the value is near min or max, for
+  // commands whose min and max are real limits (OPTIONAL)
+  bool adaptive_limits = false;
 
   // Data fields
   // value of interest is in master or slave part
@@ -104,32 +167,46 @@ class Command {
   float max = 100;
   // decimal digits of value (OPTIONAL)
   uint8_t digits = 2;
-  // unit (OPTIONAL)
-  std::string unit = "";
+  // unit (OPTIONAL), shared by all commands with the same unit
+  const std::string* unit = nullptr;
+  // smallest change of a numeric value that is published (OPTIONAL)
+  float deadband = 0;
 
   // Home Assistant
   // support for auto discovery (OPTIONAL)
   bool ha = false;
-  // component type (OPTIONAL)
-  std::string ha_component = "";
-  // device class (OPTIONAL)
-  std::string ha_device_class = "";
-  // entity category (OPTIONAL)
-  std::string ha_entity_category = "";
-  // mode (OPTIONAL)
-  std::string ha_mode = "auto";
-  // options as pairs of "key":"value" (OPTIONAL)
-  std::map<int, std::string> ha_key_value_map = {};
-  // options default key (OPTIONAL)
-  int ha_default_key = 0;
-  // payload for ON state (OPTIONAL)
-  uint8_t ha_payload_on = 1;
-  // payload for OFF state (OPTIONAL)
-  uint8_t ha_payload_off = 0;
-  // state class (OPTIONAL)
-  std::string ha_state_class = "";
-  // step value (OPTIONAL)
-  float ha_step = 1;
+
+  // The remaining Home Assistant fields are only needed for discovery. They
+  // are kept apart and only allocated for commands with ha enabled, copies
+  // of a command share them.
+  struct HomeAssistant {
+    // component type (OPTIONAL)
+    std::string component = "";
+    // device class (OPTIONAL)
+    std::string device_class = "";
+    // entity category (OPTIONAL)
+    std::string entity_category = "";
+    // mode (OPTIONAL)
+    std::string mode = "auto";
+    // options as pairs of "key":"value" (OPTIONAL)
+    std::map<int, std::string> key_value_map = {};
+    // options default key (OPTIONAL)
+    int default_key = 0;
+    // payload for ON state (OPTIONAL)
+    uint8_t payload_on = 1;
+    // payload for OFF state (OPTIONAL)
+    uint8_t payload_off = 0;
+    // state class (OPTIONAL)
+    std::string state_class = "";
+    // step value (OPTIONAL)
+    float step = 1;
+  };
+  std::shared_ptr<const HomeAssistant> ha_fields = nullptr;
+
+  const HomeAssistant& haFields() const;
+
+  // Returns the pooled copy of a string that many commands use
+  static const std::string* intern(const std::string& value);
 
   // Field types for evaluation
   enum FieldType {
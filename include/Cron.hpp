@@ -4,14 +4,20 @@
 
 #include <cJSON.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 
 #include <cstdint>
 #include <string>
 #include <unordered_map>
 
+#include "JsonWriter.hpp"
+#include "TaskWakeup.hpp"
+
 class Cron {
  public:
+  Cron();
+
   bool initFileSystem();
 
   void start();
@@ -20,10 +26,13 @@ class Cron {
   int64_t loadRules();
   int64_t replaceRules(const cJSON* doc);
 
+  void writeRulesJson(JsonWriter& json) const;
   const std::string getRulesJson() const;
 
   static const std::string evaluate(const cJSON* doc);
 
+  const WakeLatency& getWakeLatency() const;
+
  private:
   struct Rule {
     std::string id;
@@ -38,8 +47,11 @@ class Cron {
 
   volatile bool stopRunner = false;
   TaskHandle_t taskHandle = nullptr;
+  TaskWakeup wakeup;  // woken by rule changes and stop
 
-  mutable portMUX_TYPE rulesMux = portMUX_INITIALIZER_UNLOCKED;
+  // Guards rules, which are copied and replaced while it is held, so a mutex.
+  // Created by the constructor, before the http server can change rules.
+  SemaphoreHandle_t rulesMutex = nullptr;
 
   static Rule ruleFromJson(const cJSON* doc);
   void setRules(std::unordered_map<std::string, Rule>&& nextRules);
@@ -7,6 +7,8 @@
 #include <string>
 #include <vector>
 
+#include "JsonWriter.hpp"
+
 // Represents a device on the eBUS, identified by its slave address and
 // identification data. Provides methods to update its data and serialize it to
 // JSON. Also provides static methods to generate scan commands for devices.
@@ -21,6 +23,7 @@ class Device {
               const std::vector<uint8_t>& slave);
 
   // Serialization
+  void writeJson(JsonWriter& json) const;
   const std::string toJson() const;
 
   // Scan commands
@@ -4,6 +4,8 @@
 
 #include <Ebus.h>
 #include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 #include <cstdint>
 #include <map>
@@ -19,6 +21,8 @@
 
 class DeviceManager {
  public:
+  DeviceManager();
+
   void setEbusHandler(ebus::Handler* handler);
 
   void collectData(const std::vector<uint8_t>& master,
@@ -26,6 +30,7 @@ class DeviceManager {
 
   void resetAddresses();
 
+  void writeDevicesJson(JsonWriter& json) const;
   const std::string getDevicesJson();
   const std::vector<const Device*> getDevices() const;
 
@@ -55,6 +60,10 @@ class DeviceManager {
   ebus::Handler* ebusHandler = nullptr;
 
   std::map<uint8_t, Device> devices;
+  // Guards devices while the json list is streamed from another task. A
+  // mutex, devices are copied and updated while it is held. Created by the
+  // constructor, before any task can collect data.
+  SemaphoreHandle_t devicesMutex = nullptr;
   std::map<uint8_t, uint32_t> masters;
   std::map<uint8_t, uint32_t> slaves;
 
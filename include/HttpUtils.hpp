@@ -2,8 +2,11 @@
 
 #include <esp_http_server.h>
 
+#include <functional>
 #include <string>
 
+#include "JsonWriter.hpp"
+
 namespace HttpUtils {
 
 void sendResponse(httpd_req_t* req, const char* status, const char* type,
@@ -11,6 +14,13 @@ void sendResponse(httpd_req_t* req, const char* status, const char* type,
 void sendResponse(httpd_req_t* req, const char* status, const char* type,
                   const char* body);
 
+// Sends a 200 json response in chunks while write produces it, so the
+// document is never held in memory as a whole. Returns ESP_FAIL when a chunk
+// could not be sent, the handler returns it so the server closes the socket
+// instead of leaving the response unterminated.
+esp_err_t sendJson(httpd_req_t* req,
+                   const std::function<void(JsonWriter& json)>& write);
+
 std::string readBody(httpd_req_t* req);
 
 bool registerRoute(httpd_handle_t server, const httpd_uri_t& route);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// Walks JSON text without building a document, so large arrays can be taken
+// apart and parsed one element at a time. The structure is only checked as
+// far as needed to find where each value ends.
+class JsonScanner {
+ public:
+  // Receives the text of one value, returns false to stop
+  using Element = std::function<bool(const char* value, size_t length)>;
+
+  JsonScanner(const char* text, size_t length);
+
+  // Finds the value of a member of the top level object. The name is
+  // compared with the raw key, escaped keys are not matched.
+  bool findMember(const char* name, const char*& value, size_t& length) const;
+
+  // Calls element for each element of the array in text, returns false when
+  // it is no valid array or element stopped
+  static bool forEachElement(const char* text, size_t length,
+                             const Element& element);
+
+ private:
+  const char* text;
+  size_t length;
+
+  static size_t skipSpace(const char* text, size_t length, size_t pos);
+  // Returns the position behind the value at pos, 0 when it is invalid
+  static size_t skipValue(const char* text, size_t length, size_t pos);
+  static size_t skipString(const char* text, size_t length, size_t pos);
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// Writes compact JSON directly into a string, without building a cJSON
+// document first. Numbers and strings are formatted the way
+// cJSON_PrintUnformatted does, so the output does not change for clients.
+// The writer only places the separators, the caller keeps the nesting valid.
+class JsonWriter {
+ public:
+  // Receives a chunk of output, returns false when it could not be sent
+  using Sink = std::function<bool(const char* data, size_t length)>;
+
+  explicit JsonWriter(std::string& out);
+
+  // Streams the output: whenever out holds chunkSize bytes they are passed
+  // to sink and out is reused, so memory does not grow with the document
+  JsonWriter(std::string& out, Sink sink, size_t chunkSize);
+
+  // Passes the remaining output to the sink, returns false on a failed send
+  bool flush();
+
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+
+  void key(const char* name);
+
+  void value(double number);
+  void value(int32_t number);
+  void value(uint32_t number);
+  void value(bool flag);
+  void value(const char* text);
+  void value(const std::string& text);
+  void null();
+
+  // Appends an already formatted JSON value
+  void raw(const std::string& json);
+
+  static void appendNumber(std::string& out, double number);
+  static void appendString(std::string& out, const char* text, size_t length);
+
+ private:
+  std::string& out;
+  bool comma = false;
+
+  Sink sink = nullptr;
+  size_t chunkSize = 0;
+  bool failed = false;
+
+  void separate();
+  void spill();
+};
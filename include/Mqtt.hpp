@@ -3,10 +3,15 @@
 #if defined(EBUS_INTERNAL)
 #include <cJSON.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 #include <mqtt_client.h>
 
+#include <atomic>
+#include <deque>
 #include <functional>
+#include <map>
+#include <memory>
 #include <queue>
 #include <string>
 #include <tuple>
@@ -15,16 +20,24 @@
 
 #include "Command.hpp"
 #include "Device.hpp"
+#include "RequestBudget.hpp"
+#include "TaskWakeup.hpp"
 
 enum class IncomingActionType { Insert, Remove };
 
 struct IncomingAction {
   IncomingActionType type;
-  Command command;  // for Insert
-  std::string key;  // for Remove
+  std::unique_ptr<Command> command;  // for Insert
+  std::string key;                   // for Remove
 
-  explicit IncomingAction(const Command& cmd)
-      : type(IncomingActionType::Insert), command(cmd), key("") {}
+  std::string correlation;  // of the request
+  uint32_t received = 0;    // time the request arrived in ms
+  size_t text = 0;          // bytes of request text it was parsed from
+
+  explicit IncomingAction(Command&& cmd)
+      : type(IncomingActionType::Insert),
+        command(std::make_unique<Command>(std::move(cmd))),
+        key("") {}
 
   explicit IncomingAction(const std::string& k)
       : type(IncomingActionType::Remove), command(), key(k) {}
@@ -32,27 +45,29 @@ struct IncomingAction {
 
 enum class OutgoingActionType { Command, Device, Component };
 
+// Commands are referred to by key and looked up when they are published, a
+// command that was removed in the meantime is skipped
 struct OutgoingAction {
   OutgoingActionType type;
-  const Command* command;  // for Command and Component
-  const Device* device;    // for Device
-  bool haRemove;           // for Component
+  std::string key;       // for Command and Component
+  const Device* device;  // for Device
+  bool haRemove;         // for Component
 
   explicit OutgoingAction(const Command* cmd)
       : type(OutgoingActionType::Command),
-        command(cmd),
+        key(cmd->getKey()),
         device(nullptr),
         haRemove(false) {}
 
   explicit OutgoingAction(const Device* part)
       : type(OutgoingActionType::Device),
-        command(nullptr),
+        key(""),
         device(part),
         haRemove(false) {}
 
   explicit OutgoingAction(const Command* cmd, bool remove)
       : type(OutgoingActionType::Component),
-        command(cmd),
+        key(cmd->getKey()),
         device(nullptr),
         haRemove(remove) {}
 };
@@ -95,11 +110,35 @@ class Mqtt {
                           const std::vector<uint8_t>& master,
                           const std::vector<uint8_t>& slave);
 
-  static void publishValue(const std::string& name,
-                           const std::string& valueJson);
+  // Returns false when the value could not be sent
+  static bool publishValue(const Command* command);
 
   void doLoop();
 
+  const WakeLatency& getWakeLatency() const;
+
+  uint32_t getRequestsHandled() const;
+  uint32_t getRequestsDropped() const;
+  uint32_t getRequestTimeMaximum() const;
+
+  // Largest request in KB, also the limit of all queued requests
+  void setMaxRequestSize(const uint32_t kilobytes);
+
+  // Publishes the commands of a batch as one array on the commands topic
+  void setCoalesceCommands(const bool enable);
+
+  size_t getOutgoingQueued() const;
+  uint32_t getOutgoingDropped() const;
+  uint32_t getOutgoingStalls() const;
+  uint32_t getOutboxHighWater() const;
+
+  // Collects the values of a window of seconds into one message on
+  // values/bulk, 0 publishes each value on its own topic
+  void setBulkWindow(const uint32_t seconds);
+
+  uint32_t getValueMessages() const;
+  void resetValueMessages();
+
  private:
   esp_mqtt_client_handle_t client = nullptr;
   esp_mqtt_client_config_t mqtt_cfg = {};
@@ -115,20 +154,93 @@ class Mqtt {
   bool enabled = false;
   bool connected = false;
 
+  // Requests are copied out of the esp-mqtt event task and handled by the
+  // request task, so a large request does not hold up keepalive and inbound
+  // traffic. Requests beyond the limits are rejected.
+  struct Request {
+    std::string payload;
+    uint32_t received;  // ms
+  };
+  static constexpr size_t requestCapacity = 8;
+  size_t maxRequestSize = 32 * 1024;
+
+  // A message larger than the buffer of the client arrives in fragments,
+  // they are collected here by the esp-mqtt event task
+  std::string assembly;
+  bool assemblyDropped = false;
+
+  SemaphoreHandle_t requestMutex = nullptr;  // created by start
+  std::deque<Request> requestQueue;
+  size_t requestBytes = 0;
+  std::atomic<uint32_t> requestsDropped{0};
+  uint32_t requestsHandled = 0;
+  uint32_t requestTimeMax = 0;  // us
+
+  // The request being handled, responses carry its correlation and the time
+  // since it arrived
+  std::string requestCorrelation;
+  uint32_t requestReceived = 0;
+
+  // Inserts and removes of the requests, only used by the request task and
+  // applied at a limited rate with a small burst. The queued actions may hold
+  // the text of RequestBudget::requests requests of the maximum size. Inserted
+  // commands beyond are rejected one by one, removes as a whole.
+  static constexpr uint32_t incomingRate = 40;  // actions per second
+  static constexpr uint32_t incomingBurst = 8;
   std::queue<IncomingAction> incomingQueue;
-  uint32_t lastIncoming = 0;
-  uint32_t incomingInterval = 25;  // ms
-
-  std::queue<OutgoingAction> outgoingQueue;
-  uint32_t lastOutgoing = 0;
-  uint32_t outgoingInterval = 25;  // ms
+  RequestBudget incomingBudget{maxRequestSize};
+  uint32_t incomingTokens = incomingBurst;
+  uint32_t incomingRefill = 0;  // ms
+
+  TaskHandle_t requestTaskHandle = nullptr;
+  TaskWakeup requestWakeup;  // woken by requests
+
+  // Outgoing actions come from several tasks and are published in batches
+  // by the mqtt task. Instead of a fixed rate the batches are paced by the
+  // bytes waiting in the outbox of the client. Actions beyond the capacity
+  // are dropped.
+  static constexpr size_t outgoingCapacity = 1024;
+  static constexpr size_t outgoingBatch = 16;
+  static constexpr int outboxLimit = 16 * 1024;        // bytes
+  static constexpr uint32_t outboxRetryInterval = 10;  // ms
+
+  SemaphoreHandle_t outgoingMutex = nullptr;  // created by start
+  std::deque<OutgoingAction> outgoingQueue;
+  std::vector<OutgoingAction> outgoingBatchActions;
+  bool outgoingStalled = false;
+  bool coalesceCommands = false;
+
+  std::atomic<uint32_t> outgoingDropped{0};
+  uint32_t outgoingStalls = 0;
+  uint32_t outboxHighWater = 0;
+
+  // Values of the current bulk window by topic name, a later value of the
+  // same command replaces the earlier one
+  uint32_t bulkWindow = 0;  // ms
+  uint32_t bulkStarted = 0;
+  SemaphoreHandle_t bulkMutex = nullptr;  // created by start
+  std::map<std::string, std::string, std::less<>> bulkValues;
+  std::atomic<uint32_t> valueMessages{0};
+
+  // Buffers of the value publish path. Only the task that updates the values
+  // uses them, after the first values they publish without heap allocation.
+  std::string valueTopic;
+  std::string valuePayload;
 
   TaskHandle_t taskHandle = nullptr;
+  TaskWakeup wakeup;  // woken by queued actions and connects
   uint32_t lastStatusPublish = 0;
   uint32_t statusPublishIntervalMs = 10 * 1000;
   std::function<std::string()> statusProvider;
 
   static void taskFunc(void* arg);
+  static void requestTaskFunc(void* arg);
+
+  void receiveData(esp_mqtt_event_handle_t event);
+  void enqueueRequest(std::string&& payload);
+  bool takeRequest(Request& request);
+  void handleRequest(const Request& request);
+  void finishRequest(int64_t started);
 
   // Command handlers map
   std::unordered_map<std::string, CommandHandler> commandHandlers = {
@@ -159,6 +271,8 @@ class Mqtt {
   // Command handlers
   static void handleRestart(const cJSON* doc);
   void handleInsert(const cJSON* doc);
+  void insertCommands(const char* array, size_t length);
+  void queueInsert(const cJSON* command, size_t text, size_t index);
   void handleRemove(const cJSON* doc);
   static void handlePublish(const cJSON* doc);
 
@@ -177,13 +291,23 @@ class Mqtt {
   void handleRead(const cJSON* doc);
   void handleWrite(const cJSON* doc);
 
+  void queueActions(std::vector<IncomingAction>&& actions);
   void checkIncomingQueue();
+  bool takeIncomingToken();
+  uint32_t incomingDelay() const;
   void checkOutgoingQueue();
+  void checkBulkValues();
+  // ms until the bulk window ends, UINT32_MAX without values, called with
+  // the bulk lock held
+  uint32_t bulkDelay() const;
 
   void publishResponse(const std::string& id, const std::string& status,
                        const size_t& bytes = 0);
+  void publishError(const std::string& message);
+  void writeRequestFields(JsonWriter& json) const;
 
   void publishCommand(const Command* command);
+  void publishCommands(const std::vector<Command>& commands);
 
   void publishDevice(const Device* device);
 };
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Passive commands indexed by the ZZ PB SB bytes of their read_cmd, so a
+// telegram is only compared against the commands with the same header.
+// Shorter read commands are kept in a list that is always checked. Entries
+// are pointers that the owner keeps valid until they are erased. Free of ESP
+// dependencies, so it is also benchmarked on the host.
+template <typename T>
+class PassiveIndex {
+ public:
+  void insert(T* entry, const std::vector<uint8_t>& readCmd) {
+    if (readCmd.size() >= 3)
+      indexed.emplace(headerKey(readCmd.data()), entry);
+    else
+      unindexed.push_back(entry);
+  }
+
+  // readCmd has to be the one the entry was inserted with
+  void erase(T* entry, const std::vector<uint8_t>& readCmd) {
+    if (readCmd.size() >= 3) {
+      auto range = indexed.equal_range(headerKey(readCmd.data()));
+      for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == entry) {
+          indexed.erase(it);
+          break;
+        }
+      }
+    } else {
+      unindexed.erase(std::remove(unindexed.begin(), unindexed.end(), entry),
+                      unindexed.end());
+    }
+  }
+
+  // Calls candidate for every entry that may match the QQ ZZ PB SB ... master
+  // part of a telegram, the caller compares the whole read_cmd
+  template <typename Candidate>
+  void find(const std::vector<uint8_t>& master, Candidate candidate) const {
+    if (master.size() >= 4) {
+      auto range = indexed.equal_range(headerKey(master.data() + 1));
+      for (auto it = range.first; it != range.second; ++it)
+        candidate(it->second);
+    }
+    for (T* entry : unindexed) candidate(entry);
+  }
+
+  size_t size() const { return indexed.size() + unindexed.size(); }
+
+  // Estimated heap usage, nodes hold the pair, a link and the cached hash
+  size_t heapUsage() const {
+    return indexed.bucket_count() * sizeof(void*) +
+           indexed.size() *
+               (sizeof(std::pair<const uint32_t, T*>) + 2 * sizeof(void*)) +
+           unindexed.capacity() * sizeof(T*);
+  }
+
+ private:
+  std::unordered_multimap<uint32_t, T*> indexed;
+  std::vector<T*> unindexed;
+
+  static uint32_t headerKey(const uint8_t* header) {
+    return (uint32_t)header[0] << 16 | (uint32_t)header[1] << 8 | header[2];
+  }
+};
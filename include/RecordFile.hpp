@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Files of records: a header of a four byte magic and a version, then one
+// frame per record with a 16 bit length, the data and a CRC32 of the data.
+// All numbers are little endian. Free of ESP dependencies, so the framing and
+// the recovery from a torn tail are also tested on the host.
+
+constexpr uint8_t kRecordVersion = 1;
+constexpr size_t kRecordHeaderSize = 4 + 1;  // magic and version
+constexpr size_t kRecordFrameSize = 2 + 4;   // length and checksum
+constexpr size_t kRecordMaxSize = UINT16_MAX;
+
+enum class RecordRead { Record, End, Torn };
+
+inline uint32_t readU32(const uint8_t* data) {
+  return (uint32_t)data[0] | (uint32_t)data[1] << 8 |
+         (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+inline void writeU32(uint8_t* data, uint32_t value) {
+  for (int i = 0; i < 4; ++i) data[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+// CRC32 as esp_crc32_le with an initial value of 0
+uint32_t recordChecksum(const void* data, size_t size);
+
+bool writeRecordHeader(FILE* file, const uint8_t* magic);
+bool readRecordHeader(FILE* file, const uint8_t* magic);
+
+// record must not be longer than kRecordMaxSize
+bool writeRecord(FILE* file, const std::string& record);
+
+// Torn covers a record cut off at the end of the file as well as one with a
+// wrong checksum, nothing after it can be trusted
+RecordRead readRecord(FILE* file, std::vector<uint8_t>& record);
+
+// Checks the header and passes the records to apply one at a time in the
+// same buffer, so the memory needed does not depend on the number of
+// records. Returns End when the file ends after a complete record and Torn
+// when the header is wrong or a record is torn. bytes is the size of the
+// valid part in front of that.
+using RecordApply = std::function<void(const std::vector<uint8_t>& record)>;
+RecordRead readRecords(FILE* file, const uint8_t* magic,
+                       const RecordApply& apply, int64_t& bytes);
+
+// Little endian fields of a record, strings with a 16 bit length and bytes
+// with an 8 bit length, longer ones are cut
+class RecordWriter {
+ public:
+  explicit RecordWriter(std::string& out) : out(out) {}
+
+  void u8(uint8_t value) { out += static_cast<char>(value); }
+
+  void u16(uint16_t value) {
+    u8(static_cast<uint8_t>(value));
+    u8(static_cast<uint8_t>(value >> 8));
+  }
+
+  void u32(uint32_t value) {
+    uint8_t data[4];
+    writeU32(data, value);
+    out.append(reinterpret_cast<const char*>(data), sizeof(data));
+  }
+
+  void f32(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    u32(bits);
+  }
+
+  void string(const std::string& value) {
+    const size_t length = std::min<size_t>(value.size(), UINT16_MAX);
+    u16(static_cast<uint16_t>(length));
+    out.append(value.data(), length);
+  }
+
+  void bytes(const std::vector<uint8_t>& value) {
+    const size_t length = std::min<size_t>(value.size(), UINT8_MAX);
+    u8(static_cast<uint8_t>(length));
+    out.append(reinterpret_cast<const char*>(value.data()), length);
+  }
+
+ private:
+  std::string& out;
+};
+
+class RecordReader {
+ public:
+  RecordReader(const uint8_t* data, size_t size)
+      : position(data), end(data + size) {}
+
+  bool valid() const { return ok; }
+
+  uint8_t u8() { return take(1) ? position[-1] : 0; }
+
+  uint16_t u16() { return take(2) ? position[-2] | position[-1] << 8 : 0; }
+
+  uint32_t u32() { return take(4) ? readU32(position - 4) : 0; }
+
+  float f32() {
+    uint32_t bits = u32();
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  std::string string() {
+    const uint16_t length = u16();
+    if (!take(length)) return "";
+    return std::string(reinterpret_cast<const char*>(position - length),
+                       length);
+  }
+
+  std::vector<uint8_t> bytes() {
+    const uint8_t length = u8();
+    if (!take(length)) return {};
+    return std::vector<uint8_t>(position - length, position);
+  }
+
+ private:
+  const uint8_t* position;
+  const uint8_t* end;
+  bool ok = true;
+
+  bool take(size_t length) {
+    if (!ok || static_cast<size_t>(end - position) < length) {
+      ok = false;
+      return false;
+    }
+    position += length;
+    return true;
+  }
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+
+// Bytes of request text held by the actions of queued requests. An action is
+// charged the text it was parsed from, not the memory of the parsed command,
+// so every request that is small enough to be received fits an empty budget
+// however many commands it holds. Free of ESP dependencies, so it is also
+// tested on the host.
+class RequestBudget {
+ public:
+  // requests of the maximum size the budget holds at once
+  static constexpr size_t requests = 2;
+
+  explicit RequestBudget(size_t maxRequestSize) {
+    setMaxRequestSize(maxRequestSize);
+  }
+
+  void setMaxRequestSize(size_t bytes) { limit = requests * bytes; }
+
+  // false when the action does not fit, nothing is charged then
+  bool take(size_t bytes) {
+    if (used + bytes > limit) return false;
+    used += bytes;
+    return true;
+  }
+
+  void give(size_t bytes) { used -= bytes < used ? bytes : used; }
+
+  size_t bytes() const { return used; }
+
+ private:
+  size_t limit = 0;
+  size_t used = 0;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Size used to keep producer and consumer indexes on separate cache lines
+#define RING_BUFFER_ALIGN 32
+
+// Fixed capacity, lock-free ring buffer for exactly one producer and one
+// consumer. Storage is part of the object, so no heap is used after
+// construction. A push on a full buffer is rejected and counted as overflow,
+// which mirrors xQueueSendToBack with a zero timeout.
+template <typename T, size_t N>
+class RingBuffer {
+ public:
+  RingBuffer() = default;
+
+  RingBuffer(const RingBuffer&) = delete;
+  RingBuffer& operator=(const RingBuffer&) = delete;
+
+  // Producer side
+  bool push(const T& item) {
+    const size_t head = _head.load(std::memory_order_relaxed);
+    const size_t next = increment(head);
+    if (next == _tail.load(std::memory_order_acquire)) {
+      _overflows.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    _buffer[head] = item;
+    _head.store(next, std::memory_order_release);
+
+    const size_t used = count(next, _tail.load(std::memory_order_relaxed));
+    if (used > _highWater.load(std::memory_order_relaxed))
+      _highWater.store(used, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Consumer side
+  bool pop(T& item) {
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) return false;
+    item = _buffer[tail];
+    _tail.store(increment(tail), std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const {
+    return count(_head.load(std::memory_order_acquire),
+                 _tail.load(std::memory_order_acquire));
+  }
+
+  bool empty() const { return size() == 0; }
+
+  static constexpr size_t capacity() { return N; }
+
+  // Number of rejected pushes because the buffer was full
+  uint32_t overflows() const {
+    return _overflows.load(std::memory_order_relaxed);
+  }
+
+  // Maximum number of items that were stored at the same time
+  size_t highWater() const {
+    return _highWater.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // one slot stays empty to tell a full from an empty buffer
+  static constexpr size_t SLOTS = N + 1;
+
+  static size_t increment(size_t index) {
+    return index + 1 == SLOTS ? 0 : index + 1;
+  }
+
+  static size_t count(size_t head, size_t tail) {
+    return head >= tail ? head - tail : SLOTS - tail + head;
+  }
+
+  alignas(RING_BUFFER_ALIGN) std::atomic<size_t> _head{0};
+  alignas(RING_BUFFER_ALIGN) std::atomic<size_t> _tail{0};
+  alignas(RING_BUFFER_ALIGN) std::atomic<uint32_t> _overflows{0};
+  std::atomic<size_t> _highWater{0};
+  T _buffer[SLOTS];
+};
@@ -3,13 +3,18 @@
 #if defined(EBUS_INTERNAL)
 #include <Ebus.h>
 #include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
+#include <atomic>
+#include <deque>
 #include <map>
-#include <queue>
+#include <optional>
 #include <string>
 #include <vector>
 
 #include "Command.hpp"
+#include "TaskWakeup.hpp"
 
 // Active commands are sent on the eBUS at scheduled intervals, and the received
 // data is saved. Passive received messages are compared against defined
@@ -28,6 +33,12 @@ class Schedule {
   void setSendInquiryOfExistence(const bool enable);
   void setFirstCommandAfterStart(const uint8_t delay);
 
+  void setPipelining(const bool enable);
+  // Percent of the bus time, 0 (no limit) to 99. Other values are rejected
+  // and leave the budget unlimited.
+  bool setBusBudget(const int percent);
+  uint8_t getBusBudget() const;
+
   void handleScanFull();
   void handleScan();
   void handleScanAddresses(const std::vector<std::string>& addresses);
@@ -53,6 +64,16 @@ class Schedule {
   void publishTiming();
   const std::string getTimingJson();
 
+  const WakeLatency& getWakeLatency() const;
+
+  size_t getQueuedCommands();
+  uint32_t getQueueLockMaximum() const;  // us
+
+  uint32_t getPipelinedCommands() const;
+  uint32_t getTelegramDuration() const;  // ms
+  uint32_t getTelegramsPerMinute() const;
+  uint32_t getBusLoad() const;  // percent
+
  private:
   ebus::Bus* ebusBus = nullptr;
   ebus::Request* ebusRequest = nullptr;
@@ -65,6 +86,7 @@ class Schedule {
   uint32_t firstCommandAfterStart = 10 * 1000;  // 10 seconds after start
 
   enum class Mode { schedule, internal, scan, fullscan, send, read, write };
+  static constexpr size_t modeCount = 7;
   Mode mode = Mode::schedule;
 
   struct QueuedCommand {
@@ -78,15 +100,27 @@ class Schedule {
         : mode(m), priority(p), command(cmd), scheduleCommand(scheduleCmd) {}
   };
 
-  struct CommandComparator {
-    bool operator()(const QueuedCommand& lhs, const QueuedCommand& rhs) const {
-      return lhs.priority < rhs.priority;
-    }
-  };
+  // Ordered by priority, first in first out within the same priority. The
+  // number of queued commands per mode makes duplicate checks cheap. Guarded
+  // by a mutex, see lockQueue.
+  SemaphoreHandle_t queueMutex = nullptr;
+  std::deque<QueuedCommand> commandQueue;
+  uint8_t queuedModes[modeCount] = {};
+  std::atomic<uint32_t> queueLockMax{0};  // us, longest time the lock was held
+
+  int64_t lockQueue();
+  void unlockQueue(int64_t lockedSince);
 
-  std::priority_queue<QueuedCommand, std::vector<QueuedCommand>,
-                      CommandComparator>
-      commandQueue;
+  // Takes the first command, only when it outranks minPriority
+  std::optional<QueuedCommand> takeCommand(int minPriority = -1);
+
+  // Puts a command back in front of the commands with the same priority,
+  // dropped like a new one when its mode may only be queued once
+  void requeueCommand(QueuedCommand&& cmd);
+
+  // Only one schedule and one full scan command may be queued, call with the
+  // queue locked
+  bool alreadyQueued(Mode mode) const;
 
   struct ActiveCommand {
     QueuedCommand queuedCommand;
@@ -104,6 +138,29 @@ class Schedule {
   ActiveCommand* activeCommand = nullptr;
   uint32_t activeCommandTimeout = 1 * 1000;  // 1 second after schedule
 
+  // Pipelining: while a command is on the bus the next one is staged, taken
+  // from the queue or from the store when it is due before the current
+  // telegram is expected to end. It is started as soon as the telegram
+  // completes, so the bus is requested at the next SYN, and the received
+  // data is processed afterwards.
+  bool pipelining = false;
+  std::optional<QueuedCommand> stagedCommand;
+  uint32_t pipelinedCommands = 0;
+
+  // Own active telegrams, measured from start until completion
+  uint32_t telegramDuration = 0;  // ms, moving average
+  uint32_t telegramWindowStart = 0;
+  uint32_t telegramWindowCount = 0;
+  uint32_t telegramWindowBusTime = 0;  // ms
+  uint32_t telegramsPerMinute = 0;
+  uint32_t busLoad = 0;  // percent of the bus time used by own telegrams
+
+  // Share of the bus time our own telegrams may use, scheduled commands are
+  // held back after each telegram to stay within it. 0 means no limit.
+  uint8_t busBudget = 0;  // percent
+  bool budgetHold = false;
+  uint32_t budgetHoldUntil = 0;  // ms
+
   uint32_t distanceScans = 10 * 1000;  // 10 seconds after start
   uint32_t lastScan = 0;               // in milliseconds
 
@@ -137,6 +194,12 @@ class Schedule {
 
   TaskHandle_t scheduleTaskHandle;
 
+  // woken by bus events and new commands, the intervals are for time based
+  // duties like the schedule and scans
+  TaskWakeup wakeup;
+  uint32_t idleInterval = 100;    // ms
+  uint32_t waitingInterval = 10;  // ms, commands wait for a free handler
+
   static void taskFunc(void* arg);
 
   void handleEventQueue();
@@ -147,6 +210,16 @@ class Schedule {
 
   void enqueueScheduleCommand();
 
+  bool isScheduled(const Command* cmd) const;
+
+  void stageNextCommand();
+  void startNextCommand(uint32_t currentMillis);
+  void measureTelegram(const ActiveCommand* command,
+                       const std::vector<uint8_t>& master,
+                       const std::vector<uint8_t>& slave,
+                       uint32_t currentMillis);
+  bool withinBusBudget(uint32_t currentMillis) const;
+
   void enqueueStartupScanCommands();
 
   void enqueueFullScanCommand();
@@ -154,7 +227,8 @@ class Schedule {
   static void reactiveMasterSlaveCallback(const std::vector<uint8_t>& master,
                                           std::vector<uint8_t>* const slave);
 
-  void processActive(const Mode& mode, const std::vector<uint8_t>& master,
+  void processActive(const Mode& mode, const ActiveCommand* command,
+                     const std::vector<uint8_t>& master,
                      const std::vector<uint8_t>& slave);
 
   void processPassive(const std::vector<uint8_t>& master,
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <atomic>
+
+#include "TaskWakeup.hpp"
+
+// A loopback udp socket that becomes readable when signal is called. A task
+// that waits in select on its sockets adds fd to the read set to also wake up
+// when another task has work for it, e.g. when bus data was received.
+//
+// open, close, fd and clear belong to the waiting task. close can be called
+// while other tasks still signal: a signal that already passed its check
+// sends before the socket is closed, later ones see it closed and return, so
+// no signal sends on a descriptor that was closed and given out again.
+class SocketWakeup {
+ public:
+  SocketWakeup();
+
+  SocketWakeup(const SocketWakeup&) = delete;
+  SocketWakeup& operator=(const SocketWakeup&) = delete;
+
+  bool open();
+  void close();
+
+  int fd() const;
+
+  // Can be called from any task. Signals that arrive before the waiting task
+  // called clear are merged into one.
+  void signal();
+
+  // Consume all pending signals, call when fd is readable
+  void clear();
+
+  const WakeLatency& latency() const;
+
+ private:
+  int _fd = -1;
+  std::atomic<bool> _pending{false};
+  // Serializes the send of signal with close, only taken by the first
+  // signal after clear
+  SemaphoreHandle_t _lock = nullptr;
+  WakeLatency _latency;
+};
@@ -3,6 +3,8 @@
 #if defined(EBUS_INTERNAL)
 #include <Ebus.h>
 #include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 #include <functional>
 #include <string>
@@ -10,20 +12,22 @@
 #include <vector>
 
 #include "Command.hpp"
+#include "PassiveIndex.hpp"
 
 // This Store class stores both active and passive eBUS commands. For permanent
-// storage (SPIFFS JSON file), functions for saving, loading, and deleting
-// commands are
-// available. Permanently stored commands are automatically loaded when the
-// device is restarted.
+// storage (LittleFS record file and journal), functions for saving, loading,
+// and deleting commands are available. Permanently stored commands are
+// automatically loaded when the device is restarted.
 
-using DataUpdatedCallback =
-    std::function<void(const std::string& name, const std::string& valueJson)>;
+// Returns true when the value was sent, only then it counts as published
+using DataUpdatedCallback = std::function<bool(const Command* command)>;
 
 using DataUpdatedLogCallback = std::function<void(const std::string& message)>;
 
 class Store {
  public:
+  Store();
+
   bool initFileSystem();
 
   void setDataUpdatedCallback(DataUpdatedCallback callback);
@@ -32,11 +36,20 @@ class Store {
   void insertCommand(const Command& command);
   void removeCommand(const std::string& key);
   Command* findCommand(const std::string& key);
+  // Copies the command under the lock, for tasks that use it while it might
+  // be changed or removed. Returns false when there is no such command.
+  bool copyCommand(const std::string& key, Command& command) const;
 
   int64_t loadCommands();
-  int64_t saveCommands() const;
-  static int64_t wipeCommands();
+  int64_t saveCommands();
+  int64_t wipeCommands();
+
+  // Appends every insert and remove to a journal, so changes survive a
+  // restart without saving all commands
+  void setAutoPersist(bool enable);
+  int64_t getJournalBytes() const;
 
+  void writeCommandsJson(JsonWriter& json) const;
   const std::string getCommandsJson() const;
 
   const std::vector<Command*> getCommands();
@@ -44,28 +57,120 @@ class Store {
   size_t getActiveCommands() const;
   size_t getPassiveCommands() const;
 
+  // Heap memory used by all commands and their indexes
+  size_t getCommandsHeap() const;
+
   bool active() const;
 
-  Command* nextActiveCommand();
-  std::vector<Command*> findPassiveCommands(const std::vector<uint8_t>& master);
+  // Returns the active command that is due within horizon ms, skip is left
+  // out, e.g. the command that is currently on the bus
+  Command* nextActiveCommand(uint32_t horizon = 0,
+                             const Command* skip = nullptr);
+
+  // Milliseconds until the next active command is due, 0 when one is due now
+  // and UINT32_MAX without active commands
+  uint32_t nextActiveDelay() const;
+
+  // Read an active command again as soon as possible
+  void refreshCommand(Command* command);
 
-  std::vector<Command*> updateData(Command* command,
-                                   const std::vector<uint8_t>& master,
-                                   const std::vector<uint8_t>& slave);
+  // Fills matches with the passive commands whose read_cmd matches the
+  // telegram, those beyond capacity are appended to more. Returns the number
+  // of all matches.
+  size_t findPassiveCommands(const std::vector<uint8_t>& master,
+                             Command** matches, size_t capacity,
+                             std::vector<Command*>& more);
 
+  // Updates the given active command or all matching passive commands,
+  // returns the number of updated commands
+  size_t updateData(Command* command, const std::vector<uint8_t>& master,
+                    const std::vector<uint8_t>& slave);
+
+  // Updated values are passed to the data updated callback only when they
+  // changed beyond their deadband, and not more often than minInterval
+  void setPublishOnChange(const bool enable);
+  void setPublishInterval(const uint32_t seconds);
+
+  uint32_t getValuesUpdated() const;
+  uint32_t getValuesPublished() const;
+  void resetValueCounter();
+
+  static void writeValueFull(JsonWriter& json, const Command* command);
   static const std::string getValueFullJson(const Command* command);
 
+  void writeValuesJson(JsonWriter& json) const;
   const std::string getValuesJson() const;
 
  private:
   // Single unified map for all commands, indexed by key
   std::unordered_map<std::string, Command> commands;
 
+  // All commands sorted by key, kept up to date on insert and remove so the
+  // json lists need no sorting
+  std::vector<Command*> orderedCommands;
+
+  // Guards the containers, the due heap and the received data of the
+  // commands, so the json lists can be streamed and the schedule can pick
+  // commands while other tasks change them. A mutex and not a critical
+  // section, commands are copied and allocate while it is held. Created by
+  // the constructor, before any task can use the store.
+  SemaphoreHandle_t commandsMutex = nullptr;
+
+  // Keys copied under the lock, for writers that block while sending
+  std::vector<std::string> copyKeys() const;
+
+  // Active commands as a min-heap ordered by the time they are due next, so
+  // the schedule does not have to scan all commands. Pointers into the map
+  // stay valid until the command is removed, which takes it out of the heap.
+  // Every command knows its position, so it is moved without a search.
+  struct DueCommand {
+    uint32_t due;  // ms
+    Command* command;
+  };
+  std::vector<DueCommand> dueCommands;
+
+  // Passive commands by the header of their read_cmd, see PassiveIndex
+  static constexpr size_t maxPassiveMatches = 16;
+  PassiveIndex<Command> passiveIndex;
+
+  void indexCommand(Command* command);
+  void unindexCommand(Command* command);
+
+  void rebuildDueCommands();
+  void scheduleCommand(Command* command, uint32_t due);
+  void unscheduleCommand(Command* command);
+  void rescheduleCommand(Command* command, uint32_t due);
+  void siftUp(size_t index);
+  void siftDown(size_t index);
+  void swapDueCommands(size_t a, size_t b);
+
   DataUpdatedCallback dataUpdatedCallback = nullptr;
+  bool publishOnChange = false;
+  uint32_t publishInterval = 0;  // ms
+  uint32_t valuesUpdated = 0;
+  uint32_t valuesPublished = 0;
+
   DataUpdatedLogCallback dataUpdatedLogCallback = nullptr;
 
-  // Flexible serialization/deserialization
-  const std::string serializeCommands() const;
+  bool autoPersist = false;
+  int64_t journalBytes = 0;  // 0 when there is no journal file
+
+  // Insert without scheduling and without journal, for loading many commands
+  // before the due heap is rebuilt once, called with commandsMutex taken.
+  // Erase without journal.
+  Command* addCommand(const Command& command);
+  // Adds a valid command read from a file, takes the lock itself
+  void loadCommand(const cJSON* doc);
+  bool eraseCommand(const std::string& key);
+
+  int64_t loadSnapshot();
+  int64_t writeSnapshot() const;
+  int64_t compactCommands();
+  int64_t replayJournal();
+  void appendJournal(const std::string& record);
+
+  // Commands saved as json by former versions, replaced on the next save
+  int64_t loadLegacyCommands();
   void deserializeCommands(const char* payload);
 };
 
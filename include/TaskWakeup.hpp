@@ -0,0 +1,50 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstdint>
+
+// Time from signaling a waiting task until the task runs again, in
+// microseconds. Signals that arrive while one is pending are merged, the
+// latency is measured from the first one.
+class WakeLatency {
+ public:
+  void signaled();
+  void woken();
+
+  uint32_t count() const;
+  uint32_t average() const;
+  uint32_t maximum() const;
+  void reset();
+
+ private:
+  std::atomic<bool> pending{false};
+  std::atomic<uint32_t> signalTime{0};
+
+  std::atomic<uint32_t> wakeups{0};
+  std::atomic<uint32_t> total{0};
+  std::atomic<uint32_t> longest{0};
+};
+
+// Lets a task sleep until another task has work for it, using the direct to
+// task notification. The timeout of wait is meant for periodic duties only.
+class TaskWakeup {
+ public:
+  // Must be called by the waiting task before its first wait
+  void attach();
+
+  // Can be called from any task, a call from the waiting task is ignored
+  void notify();
+
+  // Returns true when woken by notify, false on timeout
+  bool wait(TickType_t timeout);
+
+  const WakeLatency& latency() const;
+  void resetLatency();
+
+ private:
+  std::atomic<TaskHandle_t> task{nullptr};
+  WakeLatency stats;
+};
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 
+#include <driver/gpio.h>
 #include <driver/uart.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 
 class UartPort {
  public:
@@ -19,17 +23,49 @@ class UartPort {
   int peek();
   size_t write(uint8_t byte);
 
+  // Read all buffered symbols, up to maxSymbols, with a single driver call.
+  // When timestamps is not null, it receives the start bit time of each
+  // symbol. Without recorded start bits it is reconstructed, assuming the
+  // symbols were received back to back and the last buffered one, which may
+  // be left for the next call, was completed at rxTime.
+  size_t readBurst(uint8_t* symbols, uint32_t* timestamps, size_t maxSymbols,
+                   uint32_t rxTime);
+
   void setRxBufferSize(size_t size);
+  // Install the driver with an event queue of the given length, must be called
+  // before begin
+  void setEventQueueSize(int size);
+  QueueHandle_t eventQueue() const;
+  void flushInput();
   void setRxFIFOFull(int fullThreshold);
   void setDebugOutput(bool enable);
 
+  // Record the start bit time of every received symbol with an interrupt on
+  // the falling edges of rxPin. The driver does not timestamp its events, so
+  // this is the only way readBurst knows when a symbol arrived, however late
+  // the task gets to it. Must be called after begin.
+  void recordStartBits(int rxPin);
+
  private:
   void ensureInstalled(int baud, int rxPin, int txPin);
+  static void rxEdge(void* arg);
+  void applyStartBits(uint32_t* timestamps, size_t count, size_t buffered,
+                      uint32_t recorded, uint32_t now);
 
   uart_port_t port_;
   bool installed_ = false;
   size_t rxBufferSize_ = 1024;
   int cachedByte_ = -1;
+  uint32_t symbolPeriod_ = 0;
+  int eventQueueSize_ = 0;
+  QueueHandle_t eventQueue_ = nullptr;
+
+  // start bits written by rxEdge, startBitCount_ is the total recorded
+  static constexpr uint32_t START_BITS = 32;
+  int startBitPin_ = -1;
+  uint32_t startBits_[START_BITS] = {};
+  std::atomic<uint32_t> startBitCount_{0};
+  uint32_t lastStartBit_ = 0;  // only used by rxEdge
 };
 
 extern UartPort BusSer;
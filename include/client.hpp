@@ -1,15 +1,37 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
-bool handleNewClient(int serverFd, int clients[]);
+// Bytes that can wait for a slow client before it gets disconnected
+#define CLIENT_BUFFER_SIZE 512
+
+// A tcp client slot. Data for the client is collected in a ring buffer and
+// sent with a single non-blocking call per pass of the data loop.
+struct WifiClient {
+  int fd = -1;
+  uint8_t buffer[CLIENT_BUFFER_SIZE];
+  size_t head = 0;       // first byte that still needs to be sent
+  size_t length = 0;     // number of bytes waiting to be sent
+  size_t highWater = 0;  // maximum backlog since connect
+};
+
+bool handleNewClient(int serverFd, WifiClient clients[]);
 
 bool startClientRuntime();
 void stopClientRuntime();
 
-void handleClient(int* clientFd);
-int pushClient(int* clientFd, uint8_t byte);
+void handleClient(WifiClient* client);
+int pushClient(WifiClient* client, uint8_t byte);
+
+void handleClientEnhanced(WifiClient* client);
+int pushClientEnhanced(WifiClient* client, uint8_t c, uint8_t d, bool log);
 
-void handleClientEnhanced(int* clientFd);
-int pushClientEnhanced(int* clientFd, uint8_t c, uint8_t d, bool log);
+// Send all waiting data of the client, returns false when the client was
+// disconnected
+bool flushClient(WifiClient* client);
 
+// Largest backlog seen on any client and the number of clients that were
+// disconnected because their buffer was full
+size_t clientBacklogHighWater();
+uint32_t clientOverflows();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "BusConfig.hpp"
 #include "UartPort.hpp"
 
 #include <cstdint>
@@ -9,14 +10,6 @@
 
 #define UART_TX 20
 #define UART_RX 21
-#if !defined(EBUS_INTERNAL)
-#define USE_SOFTWARE_SERIAL 0
-#define USE_ASYNCHRONOUS 0  // requires USE_SOFTWARE_SERIAL
-#endif
-
-inline int DEBUG_LOG(const char* format, ...) { return 0; }
-int DEBUG_LOG_IMPL(const char* format, ...);
-// #define DEBUG_LOG DEBUG_LOG_IMPL
 
 void restart();
 const std::string getStatusJson();
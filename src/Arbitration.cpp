@@ -1,11 +1,5 @@
 #include "Arbitration.hpp"
 
-#include "BusType.hpp"
-
-#include <esp_rom_sys.h>
-#include <esp_timer.h>
-
-
 // arbitration is timing sensitive. avoid communicating with WifiClient during
 // arbitration according
 // https://ebus-wiki.org/lib/exe/fetch.php/ebus/spec_test_1_v1_1_1.pdf
@@ -28,36 +22,19 @@ Arbitration::result Arbitration::start(const BusState& busstate, uint8_t master,
   }
 
   // too late if we don't have enough time to send our symbol
-  uint32_t now = (uint32_t)(esp_timer_get_time());
+  uint32_t now = _port.micros();
   uint32_t microsSinceLastSyn = busstate.microsSinceLastSyn();
   uint32_t timeSinceStartBit = now - startBitTime;
-  if (timeSinceStartBit > 4456 || Bus.available()) {
+  if (timeSinceStartBit > 4456 || _port.available()) {
     // if we are too late, don't try to participate and retry next round
-    DEBUG_LOG("ARB LATE 0x%02x %lu us\n", BusSer.peek(), timeSinceStartBit);
+    DEBUG_LOG("ARB LATE 0x%02x %lu us\n", _port.peek(), timeSinceStartBit);
     return late;
   }
-#if USE_ASYNCHRONOUS
-  // When in async mode, we get immediately interrupted when a symbol is
-  // received on the bus The earliest allowed to send is 4300 measured from the
-  // start bit of the SYN command. We receive the exact flange of the startbit,
-  // use that to calculate the exact time to wait. Then subtract time from the
-  // wait to allow the uart to put the byte on the bus. Testing has shown this
-  // requires about 700 micros on the esp32-c3.
-  int delay = 4300 - timeSinceStartBit - 700;
-  if (delay > 0) {
-    esp_rom_delay_us(delay);
-  }
-#endif
-  Bus.write(master);
+  int delay = writeAddress(master, startBitTime);
   // Do logging of the ARB START message after writing the symbol, so enabled or
   // disabled logging does not affect timing calculations.
-#if USE_ASYNCHRONOUS
   DEBUG_LOG("ARB START %04i 0x%02x %lu us %i  us\n", arb++, master,
             microsSinceLastSyn, delay);
-#else
-  DEBUG_LOG("ARB START %04i 0x%02x %lu us\n", arb++, master,
-            microsSinceLastSyn);
-#endif
   _arbitrationAddress = master;
   _arbitrating = true;
   _participateSecond = false;
@@ -118,26 +95,13 @@ Arbitration::state Arbitration::data(BusState& busstate, uint8_t symbol,
       return arbitrating;
     case BusState::eReceivedSecondSYN:  // did we sign up for second round
                                         // arbitration?
-      if (_participateSecond && Bus.available() == 0) {
+      if (_participateSecond && _port.available() == 0 &&
+          _port.micros() - startBitTime <= 4456) {
         // execute second round of arbitration
         uint32_t microsSinceLastSyn = busstate.microsSinceLastSyn();
-#if USE_ASYNCHRONOUS
-        // When in async mode, we get immediately interrupted when a symbol is
-        // received on the bus The earliest allowed to send is 4300 measured
-        // from the start bit of the SYN command. We receive the exact flange of
-        // the startbit, use that to calculate the exact time to wait. Then
-        // subtract time from the wait to allow the uart to put the byte on the
-        // bus. Testing has shown this requires about 700 micros on the
-        // esp32-c3.
-        uint32_t timeSinceStartBit = (uint32_t)(esp_timer_get_time()) - startBitTime;
-        int delay = 4300 - timeSinceStartBit - 700;
-        if (delay > 0) {
-          esp_rom_delay_us(delay);
-        }
-#endif
         // Do logging of the ARB START message after writing the symbol, so
         // enabled or disabled logging does not affect timing calculations.
-        Bus.write(_arbitrationAddress);
+        writeAddress(_arbitrationAddress, startBitTime);
         DEBUG_LOG("ARB MASTER2    0x%02x %lu us\n", _arbitrationAddress,
                   microsSinceLastSyn);
       } else {
@@ -169,3 +133,36 @@ Arbitration::state Arbitration::data(BusState& busstate, uint8_t symbol,
   }
   return arbitrating;
 }
+
+int Arbitration::writeAddress(uint8_t address, uint32_t startBitTime) {
+  int delay = 0;
+#if USE_ASYNCHRONOUS
+  // When in async mode, we get immediately interrupted when a symbol is
+  // received on the bus The earliest allowed to send is 4300 measured from the
+  // start bit of the SYN command. We receive the exact flange of the startbit,
+  // use that to calculate the exact time to wait. Then subtract time from the
+  // wait to allow the uart to put the byte on the bus. Testing has shown this
+  // requires about 700 micros on the esp32-c3.
+  delay = 4300 - (_port.micros() - startBitTime) - 700;
+#elif USE_UART_EVENTS
+  // The start bit time comes from the interrupt on the RX pin, so the wait is
+  // exact here as well. Without it an event task that is quick after the SYN
+  // writes before the window opens.
+  delay = 4300 - (_port.micros() - startBitTime);
+#endif
+  if (delay > 0) {
+    _port.delayMicroseconds(delay);
+  }
+  _port.write(address);
+  recordLatency(_port.micros() - startBitTime);
+  return delay;
+}
+
+void Arbitration::recordLatency(uint32_t latency) {
+  int bucket = 0;
+  if (latency >= LATENCY_FIRST_US) {
+    bucket = 1 + (latency - LATENCY_FIRST_US) / LATENCY_BUCKET_US;
+    if (bucket > LATENCY_BUCKETS - 1) bucket = LATENCY_BUCKETS - 1;
+  }
+  _latency[bucket]++;
+}
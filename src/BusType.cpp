@@ -4,10 +4,9 @@
 #include <esp_rom_sys.h>
 #include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 
-#include <queue>
-
 // For ESP's based on FreeRTOS we can optimize the arbitration timing.
 // With SoftwareSerial we get notified with an callback that the
 // signal has changed. SoftwareSerial itself can and does know the
@@ -24,16 +23,18 @@ BusType Bus;
 
 // On ESP8266, maximum 512 icw SoftwareSerial, otherwise you run out of heap
 #define RXBUFFERSIZE 512
-#define QUEUE_SIZE 480
 
 #define BAUD_RATE 2400
 #define MAX_FRAMEBITS (1 + 8 + 1)
 #define SERIAL_EVENT_TASK_STACK_SIZE 2048
 #define SERIAL_EVENT_TASK_PRIORITY (configMAX_PRIORITIES - 1)
 #define SERIAL_EVENT_TASK_RUNNING_CORE -1
+#define UART_EVENT_QUEUE_SIZE 16
+#define UART_EVENT_TASK_STACK_SIZE 3072
+#define UART_EVENT_TASK_PRIORITY (configMAX_PRIORITIES - 2)
 
 // Locking
-#if USE_ASYNCHRONOUS
+#if USE_ASYNCHRONOUS || USE_UART_EVENTS
 SemaphoreHandle_t getMutex() {
   static SemaphoreHandle_t _lock = NULL;
   if (_lock == NULL) {
@@ -54,46 +55,132 @@ SemaphoreHandle_t getMutex() {
 #define ENH_MUTEX_UNLOCK()
 #endif
 
-int _arbitration_client = -1;
-int _arbitration_address = -1;
+// Pending arbitration requests, at most one per client, in arrival order
+struct ArbitrationRequest {
+  int clientFd;
+  uint8_t address;
+  uint32_t since;  // us, time of the request
+};
+
+ArbitrationRequest _arbitration_queue[ARBITRATION_QUEUE_SIZE];
+size_t _arbitration_queued = 0;
+ArbitrationStatistics _arbitration_statistics[ARBITRATION_QUEUE_SIZE];
+
+// must be called with the mutex taken
+int findArbitrationRequest(int clientFd) {
+  for (size_t i = 0; i < _arbitration_queued; i++)
+    if (_arbitration_queue[i].clientFd == clientFd) return i;
+  return -1;
+}
+
+void removeArbitrationRequest(size_t index) {
+  for (size_t i = index + 1; i < _arbitration_queued; i++)
+    _arbitration_queue[i - 1] = _arbitration_queue[i];
+  _arbitration_queued--;
+}
 
-void getArbitrationClient(int& clientFd, uint8_t& address) {
+ArbitrationStatistics* findArbitrationStatistics(int clientFd, bool create) {
+  ArbitrationStatistics* unused = nullptr;
+  for (ArbitrationStatistics& statistics : _arbitration_statistics) {
+    if (statistics.clientFd == clientFd) return &statistics;
+    if (statistics.clientFd < 0 && unused == nullptr) unused = &statistics;
+  }
+  if (!create || unused == nullptr) return nullptr;
+  *unused = ArbitrationStatistics();
+  unused->clientFd = clientFd;
+  return unused;
+}
+
+void clearArbitrationClient(int clientFd) {
   ENH_MUTEX_LOCK();
-  clientFd = _arbitration_client;
-  address = _arbitration_address;
+  int index = findArbitrationRequest(clientFd);
+  if (index >= 0) removeArbitrationRequest(index);
   ENH_MUTEX_UNLOCK();
 }
 
-void clearArbitrationClient() {
+void removeArbitrationClient(int clientFd) {
   ENH_MUTEX_LOCK();
-  _arbitration_client = -1;
-  _arbitration_address = -1;
+  int index = findArbitrationRequest(clientFd);
+  if (index >= 0) removeArbitrationRequest(index);
+  ArbitrationStatistics* statistics = findArbitrationStatistics(clientFd, false);
+  if (statistics != nullptr) statistics->clientFd = -1;
   ENH_MUTEX_UNLOCK();
 }
 
-bool setArbitrationClient(int& clientFd, uint8_t& address) {
+bool setArbitrationClient(int clientFd, uint8_t address) {
   bool result = true;
   ENH_MUTEX_LOCK();
-  if (_arbitration_client < 0) {
-    _arbitration_client = clientFd;
-    _arbitration_address = address;
+  int index = findArbitrationRequest(clientFd);
+  if (index >= 0) {
+    // a repeated request keeps its place
+    _arbitration_queue[index].address = address;
+  } else if (_arbitration_queued < ARBITRATION_QUEUE_SIZE) {
+    _arbitration_queue[_arbitration_queued++] = {clientFd, address,
+                                                 Bus.micros()};
+    ArbitrationStatistics* statistics =
+        findArbitrationStatistics(clientFd, true);
+    if (statistics != nullptr) statistics->requests++;
   } else {
     result = false;
-    clientFd = _arbitration_client;
-    address = _arbitration_address;
   }
   ENH_MUTEX_UNLOCK();
   return result;
 }
 
-void arbitrationDone() { clearArbitrationClient(); }
+void arbitrationDone(int clientFd, uint8_t result) {
+  ENH_MUTEX_LOCK();
+  int index = findArbitrationRequest(clientFd);
+  if (index >= 0) {
+    ArbitrationStatistics* statistics =
+        findArbitrationStatistics(clientFd, true);
+    if (statistics != nullptr) {
+      const uint32_t wait = Bus.micros() - _arbitration_queue[index].since;
+      statistics->waitTotal += wait;
+      if (wait > statistics->waitMax) statistics->waitMax = wait;
+      if (result == STARTED)
+        statistics->won++;
+      else if (result == FAILED)
+        statistics->lost++;
+      else
+        statistics->errors++;
+    }
+    removeArbitrationRequest(index);
+  }
+  ENH_MUTEX_UNLOCK();
+}
 
 int arbitrationRequested(uint8_t& address) {
   int clientFd = -1;
-  getArbitrationClient(clientFd, address);
+  ENH_MUTEX_LOCK();
+  if (_arbitration_queued > 0) {
+    size_t next = 0;
+#if USE_ARBITRATION_PRIORITY
+    // the lower nibble of a master address is its priority class, the lower
+    // it is the higher the priority on the bus
+    for (size_t i = 1; i < _arbitration_queued; i++) {
+      if ((_arbitration_queue[i].address & 0x0f) <
+          (_arbitration_queue[next].address & 0x0f))
+        next = i;
+    }
+#endif
+    clientFd = _arbitration_queue[next].clientFd;
+    address = _arbitration_queue[next].address;
+  }
+  ENH_MUTEX_UNLOCK();
   return clientFd;
 }
 
+size_t getArbitrationStatistics(ArbitrationStatistics* statistics,
+                                size_t size) {
+  size_t count = 0;
+  ENH_MUTEX_LOCK();
+  for (const ArbitrationStatistics& entry : _arbitration_statistics) {
+    if (entry.clientFd >= 0 && count < size) statistics[count++] = entry;
+  }
+  ENH_MUTEX_UNLOCK();
+  return count;
+}
+
 BusType::BusType()
     : _nbrRestarts1(0),
       _nbrRestarts2(0),
@@ -104,6 +191,8 @@ BusType::BusType()
       _nbrWon2(0),
       _nbrErrors(0),
       _nbrLate(0),
+      _busState(*this),
+      _arbitration(*this),
       _clientFd(-1) {}
 
 BusType::~BusType() { end(); }
@@ -188,6 +277,40 @@ void BusType::readDataFromSoftwareSerial(void* args) {
 }
 #endif
 
+#if USE_UART_EVENTS
+void BusType::readDataFromUartEvents(void* args) {
+  BusType* self = static_cast<BusType*>(args);
+  QueueHandle_t events = BusSer.eventQueue();
+  uart_event_t event;
+  for (;;) {
+    if (xQueueReceive(events, &event, portMAX_DELAY) != pdTRUE) continue;
+    // take the time before anything else, it is the best estimate of the end
+    // of the last received symbol
+    self->uartEvent(event, self->micros());
+  }
+  vTaskDelete(NULL);
+}
+
+void BusType::uartEvent(const uart_event_t& event, uint32_t rxTime) {
+  switch (event.type) {
+    case UART_DATA:
+      receiveBurst(rxTime);
+      if (_dataCallback != nullptr) _dataCallback();
+      break;
+    case UART_FIFO_OVF:
+    case UART_BUFFER_FULL:
+      // symbols are lost, start over with a clean bus state
+      DEBUG_LOG("UART OVERFLOW %i\n", event.type);
+      BusSer.flushInput();
+      xQueueReset(BusSer.eventQueue());
+      _busState.reset();
+      break;
+    default:
+      break;
+  }
+}
+#endif
+
 void BusType::begin() {
 #if USE_SOFTWARE_SERIAL
   BusSer.begin(2400, SERIAL_8N1, -1, UART_TX);  // used for writing
@@ -198,8 +321,22 @@ void BusType::begin() {
                  RXBUFFERSIZE);  // used for reading
 #else
   BusSer.setRxBufferSize(RXBUFFERSIZE);
+#if USE_UART_EVENTS
+  BusSer.setEventQueueSize(UART_EVENT_QUEUE_SIZE);
+#endif
   BusSer.begin(2400, UART_DATA_8_BITS, UART_RX, UART_TX);  // used for writing
   BusSer.setRxFIFOFull(1);
+#if USE_UART_EVENTS
+  // the events come without a time, arbitration needs the SYN start bit
+  BusSer.recordStartBits(UART_RX);
+#endif
+#endif
+
+#if USE_UART_EVENTS
+  getMutex();  // create before two tasks use it
+  xTaskCreate(BusType::readDataFromUartEvents, "_uartEventQueue",
+              UART_EVENT_TASK_STACK_SIZE, this, UART_EVENT_TASK_PRIORITY,
+              &_uartEventTask);
 #endif
 
 #if USE_ASYNCHRONOUS
@@ -213,6 +350,12 @@ void BusType::begin() {
 }
 
 void BusType::end() {
+#if USE_UART_EVENTS
+  if (_uartEventTask != nullptr) {
+    vTaskDelete(_uartEventTask);
+    _uartEventTask = nullptr;
+  }
+#endif
   BusSer.end();
 #if USE_SOFTWARE_SERIAL
   mySerial.end();
@@ -231,6 +374,10 @@ int BusType::availableForWrite() { return BusSer.availableForWrite(); }
 
 size_t BusType::write(uint8_t symbol) { return BusSer.write(symbol); }
 
+uint32_t BusType::micros() const { return (uint32_t)(esp_timer_get_time()); }
+
+void BusType::delayMicroseconds(uint32_t us) { esp_rom_delay_us(us); }
+
 bool BusType::read(data& d) {
 #if USE_ASYNCHRONOUS
   return xQueueReceive(_queue, &d, 0) == pdTRUE;
@@ -240,32 +387,97 @@ bool BusType::read(data& d) {
     uint8_t symbol = mySerial.read();
     receive(symbol, mySerial.readStartBitTimeStamp());
   }
+#elif USE_UART_EVENTS
+  // symbols are received by the uart event task
+#elif USE_BURST_READ
+  if (_queue.empty()) receiveBurst(micros());
 #else
   if (BusSer.available()) {
     uint8_t symbol = BusSer.read();
-    receive(symbol, (uint32_t)(esp_timer_get_time()));
+    receive(symbol, micros());
   }
 #endif
-  if (_queue.size() > 0) {
-    d = _queue.front();
-    _queue.pop();
-    return true;
-  }
-  return false;
+  return _queue.pop(d);
 #endif
 }
 
+void BusType::setDataCallback(void (*callback)()) {
+#if USE_UART_EVENTS
+  _dataCallback = callback;
+#else
+  (void)callback;
+#endif
+}
+
+#if USE_BURST_READ
+void BusType::receiveBurst(uint32_t rxTime) {
+  // Drain everything the driver has buffered, BURST_SIZE symbols per call.
+  // The start bit times are reconstructed from the symbol period, which is
+  // closer to the truth than the time we got around to read the symbols.
+  while ((_burstCount = BusSer.readBurst(_burstSymbols, _burstTimes, BURST_SIZE,
+                                         rxTime)) > 0) {
+    for (_burstIndex = 0; _burstIndex < _burstCount; _burstIndex++)
+      receive(_burstSymbols[_burstIndex], _burstTimes[_burstIndex]);
+    rxTime = micros();
+  }
+  _burstIndex = 0;
+}
+#endif
+
 int BusType::available() {
 #if USE_SOFTWARE_SERIAL
   return mySerial.available();
+#elif USE_BURST_READ
+  // symbols of the current burst that come after the one being processed
+  // are also waiting
+  size_t pending =
+      _burstIndex + 1 < _burstCount ? _burstCount - _burstIndex - 1 : 0;
+  return BusSer.available() + static_cast<int>(pending);
 #else
   return BusSer.available();
 #endif
 }
 
+int BusType::peek() {
+#if USE_SOFTWARE_SERIAL
+  return mySerial.peek();
+#elif USE_BURST_READ
+  // the symbol after the one being processed may already be in the burst
+  if (_burstIndex + 1 < _burstCount) return _burstSymbols[_burstIndex + 1];
+  return BusSer.peek();
+#else
+  return BusSer.peek();
+#endif
+}
+
+uint32_t BusType::queueOverflows() const {
+#if USE_ASYNCHRONOUS
+  return _queueOverflows;
+#else
+  return _queue.overflows();
+#endif
+}
+
+size_t BusType::queueHighWater() const {
+#if USE_ASYNCHRONOUS
+  return _queueHighWater;
+#else
+  return _queue.highWater();
+#endif
+}
+
+const uint32_t* BusType::latencyHistogram() const {
+  return _arbitration.latencyHistogram();
+}
+
 void BusType::push(const data& d) {
 #if USE_ASYNCHRONOUS
-  xQueueSendToBack(_queue, &d, 0);
+  if (xQueueSendToBack(_queue, &d, 0) != pdTRUE) {
+    _queueOverflows++;
+    return;
+  }
+  int waiting = uxQueueMessagesWaiting(_queue);
+  if (waiting > _queueHighWater) _queueHighWater = waiting;
 #else
   _queue.push(d);
 #endif
@@ -315,7 +527,7 @@ void BusType::receive(uint8_t symbol, uint32_t startBitTime) {
     case Arbitration::won2:
       _nbrWon2++;
     WON:
-      arbitrationDone();
+      arbitrationDone(_clientFd, STARTED);
       DEBUG_LOG("BUS SEND WON   0x%02x %lu us\n", _busState._master,
                 _busState.microsSinceLastSyn());
       // send only to the arbitrating client
@@ -330,7 +542,7 @@ void BusType::receive(uint8_t symbol, uint32_t startBitTime) {
     case Arbitration::lost2:
       _nbrLost2++;
     LOST:
-      arbitrationDone();
+      arbitrationDone(_clientFd, FAILED);
       DEBUG_LOG("BUS SEND LOST  0x%02x 0x%02x %lu us\n", _busState._master,
                 _busState._symbol, _busState.microsSinceLastSyn());
       // send only to the arbitrating client
@@ -341,7 +553,7 @@ void BusType::receive(uint8_t symbol, uint32_t startBitTime) {
       break;
     case Arbitration::error:
       _nbrErrors++;
-      arbitrationDone();
+      arbitrationDone(_clientFd, ERROR_EBUS);
       // send only to the arbitrating client
       push({true, ERROR_EBUS, ERR_FRAMING, _clientFd, _clientFd});
       // send to everybody
@@ -1,6 +1,7 @@
 #if defined(EBUS_INTERNAL)
 #include "ClientManager.hpp"
 
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
@@ -35,20 +36,32 @@ void ClientManager::start(ebus::Bus* bus, ebus::BusHandler* busHandler,
 
   clientByteQueue = new ebus::Queue<uint8_t>();
 
+  if (!wakeup.open()) logger.warn("Failed to create client wakeup socket");
+
   request->setExternalBusRequestedCallback([this]() {
     busRequestSuccess = true;
     logger.info("Bus request success");
+    wakeup.signal();
   });
 
-  busHandler->addByteListener(
-      [this](const uint8_t& byte) { clientByteQueue->try_push(byte); });
+  busHandler->addByteListener([this](const uint8_t& byte) {
+    clientByteQueue->try_push(byte);
+    wakeup.signal();
+  });
 
   // Start the clientManagerRunner task
   xTaskCreate(&ClientManager::taskFunc, "clientManagerRunner", 4096, this, 3,
               &clientManagerTaskHandle);
 }
 
-void ClientManager::stop() { stopRunner = true; }
+void ClientManager::stop() {
+  stopRunner = true;
+  wakeup.signal();
+}
+
+const WakeLatency& ClientManager::getWakeLatency() const {
+  return wakeup.latency();
+}
 
 bool ClientManager::createListenSocket(ServerSocket& server) {
   if (server.listenFd >= 0) return true;
@@ -112,9 +125,13 @@ void ClientManager::taskFunc(void* arg) {
   AbstractClient* activeClient = nullptr;
   BusState busState = BusState::Idle;
   uint8_t receiveByte = 0;
+  uint32_t busWaitSince = 0;  // ms, waiting for the bus to become available
 
   for (;;) {
-    if (self->stopRunner) vTaskDelete(NULL);
+    if (self->stopRunner) {
+      self->wakeup.close();
+      vTaskDelete(NULL);
+    }
 
     // Check for new clients
     self->acceptClients();
@@ -138,6 +155,7 @@ void ClientManager::taskFunc(void* arg) {
           activeClient = client;
           busState = BusState::Request;
           self->busRequestSuccess = false;
+          busWaitSince = (uint32_t)(esp_timer_get_time() / 1000ULL);
           logger.info("Client has data to send (client #" + std::to_string(i) + ")");
           break;
         }
@@ -146,20 +164,14 @@ void ClientManager::taskFunc(void* arg) {
 
     // Request bus access
     if (activeClient && busState == BusState::Request) {
-      if ((self->clientByteQueue->size() == 0)) {
-        int attempt = 0;
-        for (attempt = 0; attempt < 50; ++attempt) {
-          if (self->request->busAvailable()) {
-            break;
-          }
-          vTaskDelay(1);
-        }
-
-        if (attempt >= 50) {
-            logger.warn("Bus available timeout for client");
-            continue;
+      if (!self->request->busAvailable()) {
+        // Received bus bytes wake us up to check again
+        const uint32_t now = (uint32_t)(esp_timer_get_time() / 1000ULL);
+        if (now - busWaitSince >= self->busAvailableTimeout) {
+          logger.warn("Bus available timeout for client");
+          busWaitSince = now;
         }
-
+      } else if ((self->clientByteQueue->size() == 0)) {
         uint8_t firstByte = 0;
         if (activeClient->readByte(firstByte)) {
           self->request->requestBus(firstByte, true);
@@ -184,7 +196,11 @@ void ClientManager::taskFunc(void* arg) {
       }
     }
 
-    // Process received bytes from bus
+    // Process received bytes from bus. The bytes are forwarded in batches,
+    // a batch is sent early when the client to skip changes.
+    uint8_t batch[CLIENT_SEND_BATCH_SIZE];
+    size_t batchSize = 0;
+    const AbstractClient* batchSkipClient = activeClient;
     while (self->clientByteQueue->try_pop(receiveByte)) {
       if (activeClient) {
         if ((busState == BusState::Response ||
@@ -204,16 +220,72 @@ void ClientManager::taskFunc(void* arg) {
       }
 
       // Forward to all other clients
-      for (size_t i = 0; i < self->clients.size(); ++i) {
-        AbstractClient* client = self->clients[i].get();
-        if (client != activeClient && client->isConnected()) {
-          client->writeBytes({receiveByte});
-        }
+      if (batchSize == CLIENT_SEND_BATCH_SIZE ||
+          (batchSize > 0 && batchSkipClient != activeClient)) {
+        self->forwardBytes(batchSkipClient, batch, batchSize);
+        batchSize = 0;
       }
+      batchSkipClient = activeClient;
+      batch[batchSize++] = receiveByte;
     }
+    if (batchSize > 0) self->forwardBytes(batchSkipClient, batch, batchSize);
+
+    self->waitForActivity(activeClient, busState == BusState::Idle);
+  }
+}
+
+void ClientManager::forwardBytes(const AbstractClient* skipClient,
+                                 const uint8_t* bytes, size_t size) {
+  // Disconnected clients fail the send and are removed by acceptClients
+  for (const auto& client : clients) {
+    if (client.get() != skipClient) client->writeBytes(bytes, size);
+  }
+}
+
+void ClientManager::waitForActivity(const AbstractClient* activeClient,
+                                    bool idle) {
+  fd_set readSet;
+  FD_ZERO(&readSet);
+  int maxFd = -1;
+  auto watch = [&readSet, &maxFd](int fd) {
+    if (fd < 0) return;
+    FD_SET(fd, &readSet);
+    if (fd > maxFd) maxFd = fd;
+  };
+
+  watch(wakeup.fd());
+  watch(readonlyServer.listenFd);
+  watch(regularServer.listenFd);
+  watch(enhancedServer.listenFd);
+
+  // While a transaction is running only the active client matters, the
+  // others would wake us up over and over with data we don't take yet. Read
+  // only clients never send anything useful.
+  // Bytes a client sent ahead are already buffered and don't make its
+  // socket readable, so don't sleep on them.
+  bool pending = false;
+  if (idle) {
+    for (const auto& client : clients) {
+      if (!client->isWriteCapable()) continue;
+      watch(client->getSocketFd());
+      if (client->available()) pending = true;
+    }
+  } else if (activeClient) {
+    watch(activeClient->getSocketFd());
+  }
+
+  // A running transaction polls the bus state, so keep the tick cadence
+  timeval timeout;
+  timeout.tv_sec = idle && !pending ? 1 : 0;
+  timeout.tv_usec = idle ? 0 : portTICK_PERIOD_MS * 1000;
 
+  const int ready = select(maxFd + 1, &readSet, nullptr, nullptr, &timeout);
+  if (ready < 0) {
     vTaskDelay(1);
+    return;
   }
+  if (ready > 0 && wakeup.fd() >= 0 && FD_ISSET(wakeup.fd(), &readSet))
+    wakeup.clear();
 }
 
 void ClientManager::acceptClients() {
@@ -2,6 +2,7 @@
 #include "ClientType.hpp"
 
 #include <cerrno>
+#include <cstring>
 
 #include <lwip/sockets.h>
 #include <unistd.h>
@@ -17,42 +18,13 @@ bool isSocketConnected(int socketFd) {
   return errno == EWOULDBLOCK || errno == EAGAIN;
 }
 
-int socketPeekByte(int socketFd) {
-  if (socketFd < 0) return -1;
-  uint8_t byte = 0;
-  const int result = recv(socketFd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
-  if (result <= 0) return -1;
-  return byte;
-}
-
-int socketPeekBytes(int socketFd, size_t maxSize) {
-  if (socketFd < 0 || maxSize == 0) return 0;
-  uint8_t buffer[2];
-  const int result = recv(socketFd, buffer, maxSize, MSG_PEEK | MSG_DONTWAIT);
+int socketReadBytes(int socketFd, uint8_t* data, size_t size) {
+  if (socketFd < 0 || data == nullptr || size == 0) return 0;
+  const int result = recv(socketFd, data, size, MSG_DONTWAIT);
   if (result <= 0) return 0;
   return result;
 }
 
-int socketAvailable(int socketFd) {
-  if (socketFd < 0) return 0;
-  int pending = 0;
-  if (lwip_ioctl(socketFd, FIONREAD, &pending) == 0 && pending > 0) {
-    return pending;
-  }
-  // Fallback: use peek to check if data is available
-  // Need to check for up to 2 bytes for enhanced protocol support
-  const int peekResult = socketPeekBytes(socketFd, 2);
-  return peekResult;
-}
-
-int socketReadByte(int socketFd) {
-  if (socketFd < 0) return -1;
-  uint8_t byte = 0;
-  const int result = recv(socketFd, &byte, 1, MSG_DONTWAIT);
-  if (result <= 0) return -1;
-  return byte;
-}
-
 void closeSocket(int& socketFd) {
   if (socketFd >= 0) {
     shutdown(socketFd, SHUT_RDWR);
@@ -94,10 +66,34 @@ void AbstractClient::stop() {
   closeSocket(socketFd);
 }
 
+int AbstractClient::getSocketFd() const { return socketFd; }
+
+size_t AbstractClient::receive() {
+  // Move the remaining bytes to the front to make room for new ones
+  if (receiveStart > 0) {
+    memmove(receiveBuffer, receiveBuffer + receiveStart, buffered());
+    receiveEnd -= receiveStart;
+    receiveStart = 0;
+  }
+  receiveEnd += socketReadBytes(socketFd, receiveBuffer + receiveEnd,
+                                CLIENT_RECEIVE_BUFFER_SIZE - receiveEnd);
+  return buffered();
+}
+
+size_t AbstractClient::buffered() const { return receiveEnd - receiveStart; }
+
+void AbstractClient::consume(size_t size) {
+  receiveStart += size;
+  if (receiveStart >= receiveEnd) {
+    receiveStart = 0;
+    receiveEnd = 0;
+  }
+}
+
 ReadOnlyClient::ReadOnlyClient(int socketFd, ebus::Request* request)
     : AbstractClient(socketFd, request, false) {}
 
-bool ReadOnlyClient::available() const { return false; }
+bool ReadOnlyClient::available() { return false; }
 
 bool ReadOnlyClient::readByte(uint8_t& byte) { return false; }
 
@@ -108,22 +104,22 @@ bool ReadOnlyClient::writeBytes(const std::vector<uint8_t>& bytes) {
   return true;
 }
 
+bool ReadOnlyClient::writeBytes(const uint8_t* bytes, size_t size) {
+  return socketWrite(socketFd, bytes, size);
+}
+
 bool ReadOnlyClient::handleBusData(const uint8_t& byte) { return false; }
 
 RegularClient::RegularClient(int socketFd, ebus::Request* request)
     : AbstractClient(socketFd, request, true) {}
 
-bool RegularClient::available() const { return socketAvailable(socketFd) > 0; }
+bool RegularClient::available() { return buffered() > 0 || receive() > 0; }
 
 bool RegularClient::readByte(uint8_t& byte) {
-  if (available()) {
-    const int value = socketReadByte(socketFd);
-    if (value >= 0) {
-      byte = static_cast<uint8_t>(value);
-      return true;
-    }
-  }
-  return false;
+  if (!available()) return false;
+  byte = receiveBuffer[receiveStart];
+  consume(1);
+  return true;
 }
 
 bool RegularClient::writeBytes(const std::vector<uint8_t>& bytes) {
@@ -133,6 +129,10 @@ bool RegularClient::writeBytes(const std::vector<uint8_t>& bytes) {
   return true;
 }
 
+bool RegularClient::writeBytes(const uint8_t* bytes, size_t size) {
+  return socketWrite(socketFd, bytes, size);
+}
+
 bool RegularClient::handleBusData(const uint8_t& byte) {
   // Handle bus response according to last command
   switch (request->getResult()) {
@@ -160,32 +160,42 @@ bool RegularClient::handleBusData(const uint8_t& byte) {
 EnhancedClient::EnhancedClient(int socketFd, ebus::Request* request)
     : AbstractClient(socketFd, request, true) {}
 
-bool EnhancedClient::available() const { return socketAvailable(socketFd) > 0; }
+// A message is complete when it is a short form data byte, a full two byte
+// command or a first byte with a wrong signature. The second byte of a
+// command stays in the buffer until it arrives.
+bool EnhancedClient::available() {
+  if (buffered() == 0 || (receiveBuffer[receiveStart] >= 0xc0 &&
+                          buffered() < 2)) {
+    receive();
+  }
+  if (buffered() == 0) return false;
+  const uint8_t b1 = receiveBuffer[receiveStart];
+  return b1 < 0xc0 || buffered() >= 2;
+}
 
 bool EnhancedClient::readByte(uint8_t& byte) {
-  int b1 = socketPeekByte(socketFd);
-  if (b1 < 0) return false;
+  if (!available()) return false;
 
+  const uint8_t b1 = receiveBuffer[receiveStart];
   if (b1 < 0x80) {
     // Short form: just a data byte, no prefix
-    const int value = socketReadByte(socketFd);
-    if (value < 0) return false;
-    byte = static_cast<uint8_t>(value);
+    consume(1);
+    byte = b1;
     return true;
   }
 
-  // Full enhanced protocol: need two bytes
-  if (socketAvailable(socketFd) < 2) return false;
-  b1 = socketReadByte(socketFd);
-  int b2 = socketReadByte(socketFd);
+  // Full enhanced protocol: two bytes
+  const uint8_t b2 = buffered() >= 2 ? receiveBuffer[receiveStart + 1] : 0;
 
   // Check signatures
   if ((b1 & 0xc0) != 0xc0 || (b2 & 0xc0) != 0x80) {
     // Invalid signature, protocol error
     writeBytes({ERROR_HOST, ERR_FRAMING});
     stop();
+    consume(buffered());
     return false;
   }
+  consume(2);
 
   // Decode command and data according to enhanced protocol
   uint8_t cmd = (b1 >> 2) & 0x0f;
@@ -235,6 +245,29 @@ bool EnhancedClient::writeBytes(const std::vector<uint8_t>& bytes) {
   return true;
 }
 
+bool EnhancedClient::writeBytes(const uint8_t* bytes, size_t size) {
+  if (bytes == nullptr) return false;
+
+  while (size > 0) {
+    const size_t count =
+        size < CLIENT_SEND_BATCH_SIZE ? size : CLIENT_SEND_BATCH_SIZE;
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) {
+      const uint8_t data = bytes[i];
+      if (data < 0x80) {
+        sendBuffer[length++] = data;
+      } else {
+        sendBuffer[length++] = 0xc0 | (RECEIVED << 2) | (data >> 6);
+        sendBuffer[length++] = 0x80 | (data & 0x3f);
+      }
+    }
+    if (!socketWrite(socketFd, sendBuffer, length)) return false;
+    bytes += count;
+    size -= count;
+  }
+  return true;
+}
+
 bool EnhancedClient::handleBusData(const uint8_t& byte) {
   // Handle bus response according to last command
   switch (request->getResult()) {
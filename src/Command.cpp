@@ -2,29 +2,77 @@
 #include "Command.hpp"
 
 #include <Ebus.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
+#include <algorithm>
+#include <cctype>
 #include <cerrno>
 #include <cmath>
 #include <cstdlib>
+#include <functional>
 #include <limits>
 #include <regex>
+#include <unordered_set>
 
 const uint32_t& Command::getLast() const { return last; }
 
 void Command::setLast(const uint32_t time) { last = time; }
 
+const size_t& Command::getDueIndex() const { return due_index; }
+
+void Command::setDueIndex(const size_t index) { due_index = index; }
+
 const std::vector<uint8_t>& Command::getData() const { return data; }
 
-void Command::setData(const std::vector<uint8_t>& data) { this->data = data; }
+void Command::setData(const std::vector<uint8_t>& data) {
+  this->data = data;
+  if (numeric)
+    value = getDoubleFromVector();
+  else
+    text = getStringFromVector();
+}
+
+const double& Command::getValue() const { return value; }
+
+const std::string& Command::getText() const { return text; }
 
 const size_t& Command::getLength() const { return length; }
 
 const bool& Command::getNumeric() const { return numeric; }
 
+const uint32_t& Command::getCurrentInterval() const { return current_interval; }
+
+void Command::adaptInterval(const bool changed) {
+  if (!adaptive) {
+    current_interval = interval;
+    return;
+  }
+
+  // Values close to their configured limits are watched as closely as
+  // changing ones
+  bool limit = false;
+  if (adaptive_limits && numeric && max > min) {
+    double margin = (max - min) * 0.1;
+    limit = value <= min + margin || value >= max - margin;
+  }
+
+  if (limit)
+    current_interval = min_interval;
+  else if (changed)
+    current_interval = std::max(min_interval, current_interval / 2);
+  else if (current_interval > max_interval / 2)
+    current_interval = max_interval;
+  else
+    current_interval *= 2;
+}
+
 const std::string& Command::getKey() const { return key; }
 
 const std::string& Command::getName() const { return name; }
 
+const std::string& Command::getValueTopic() const { return value_topic; }
+
 const std::vector<uint8_t>& Command::getReadCmd() const { return read_cmd; }
 
 const std::vector<uint8_t>& Command::getWriteCmd() const { return write_cmd; }
@@ -33,6 +81,29 @@ const bool& Command::getActive() const { return active; }
 
 const uint32_t& Command::getInterval() const { return interval; }
 
+const bool& Command::getAdaptive() const { return adaptive; }
+
+const uint32_t& Command::getMinInterval() const { return min_interval; }
+
+const uint32_t& Command::getMaxInterval() const { return max_interval; }
+
+const bool& Command::getAdaptiveLimits() const { return adaptive_limits; }
+
+bool Command::publishDue(const uint32_t now, const bool onChange,
+                         const uint32_t minInterval) const {
+  if (published == 0) return true;
+  if (now - published < minInterval) return false;
+  if (!onChange) return true;
+  return numeric ? std::fabs(value - published_value) > deadband
+                 : std::hash<std::string>{}(text) != published_text;
+}
+
+void Command::setPublished(const uint32_t now) {
+  published = now;
+  published_value = value;
+  published_text = numeric ? 0 : std::hash<std::string>{}(text);
+}
+
 const bool& Command::getMaster() const { return master; }
 
 const size_t& Command::getPosition() const { return position; }
@@ -47,45 +118,107 @@ const float& Command::getMax() const { return max; }
 
 const uint8_t& Command::getDigits() const { return digits; }
 
-const std::string& Command::getUnit() const { return unit; }
+const std::string& Command::getUnit() const {
+  static const std::string none;
+  return unit != nullptr ? *unit : none;
+}
+
+const float& Command::getDeadband() const { return deadband; }
 
 const bool& Command::getHA() const { return ha; }
 
-const std::string& Command::getHAComponent() const { return ha_component; }
+const std::string& Command::getHAComponent() const {
+  return haFields().component;
+}
 
-const std::string& Command::getHADeviceClass() const { return ha_device_class; }
+const std::string& Command::getHADeviceClass() const {
+  return haFields().device_class;
+}
 
 const std::string& Command::getHAEntityCategory() const {
-  return ha_entity_category;
+  return haFields().entity_category;
 }
 
-const std::string& Command::getHAMode() const { return ha_mode; }
+const std::string& Command::getHAMode() const { return haFields().mode; }
 
 const std::map<int, std::string>& Command::getHAKeyValueMap() const {
-  return ha_key_value_map;
+  return haFields().key_value_map;
 }
 
-const int& Command::getHADefaultKey() const { return ha_default_key; }
+const int& Command::getHADefaultKey() const { return haFields().default_key; }
 
-const uint8_t& Command::getHAPayloadOn() const { return ha_payload_on; }
+const uint8_t& Command::getHAPayloadOn() const {
+  return haFields().payload_on;
+}
 
-const uint8_t& Command::getHAPayloadOff() const { return ha_payload_off; }
+const uint8_t& Command::getHAPayloadOff() const {
+  return haFields().payload_off;
+}
 
-const std::string& Command::getHAStateClass() const { return ha_state_class; }
+const std::string& Command::getHAStateClass() const {
+  return haFields().state_class;
+}
 
-const float& Command::getHAStep() const { return ha_step; }
+const float& Command::getHAStep() const { return haFields().step; }
 
-const std::string Command::getValueJson() const {
-  cJSON* doc = cJSON_CreateObject();
+const Command::HomeAssistant& Command::haFields() const {
+  static const HomeAssistant defaults;
+  return ha_fields ? *ha_fields : defaults;
+}
+
+const std::string* Command::intern(const std::string& value) {
+  // Entries are never removed, the pool only holds distinct short values
+  static std::unordered_set<std::string> pool;
+  static SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  const std::string* pooled = &*pool.insert(value).first;
+  xSemaphoreGive(lock);
+  return pooled;
+}
+
+size_t Command::heapUsage() const {
+  auto stringHeap = [](const std::string& value) {
+    static const size_t inlineCapacity = std::string().capacity();
+    return value.capacity() > inlineCapacity ? value.capacity() + 1 : 0;
+  };
+
+  size_t bytes = stringHeap(key) + stringHeap(name) +
+                 stringHeap(value_topic) + read_cmd.capacity() +
+                 write_cmd.capacity() + data.capacity();
+
+  if (ha_fields) {
+    const HomeAssistant& fields = *ha_fields;
+    bytes += sizeof(HomeAssistant) + stringHeap(fields.component) +
+             stringHeap(fields.device_class) +
+             stringHeap(fields.entity_category) + stringHeap(fields.mode) +
+             stringHeap(fields.state_class);
+    // tree nodes hold the pair plus color and three links
+    for (const auto& kv : fields.key_value_map)
+      bytes += sizeof(kv) + 4 * sizeof(void*) + stringHeap(kv.second);
+  }
+
+  return bytes;
+}
+
+void Command::writeValue(JsonWriter& json) const {
   if (numeric)
-    cJSON_AddNumberToObject(doc, "value", getDoubleFromVector());
+    json.value(value);
   else
-    cJSON_AddStringToObject(doc, "value", getStringFromVector().c_str());
+    json.value(text);
+}
+
+void Command::writeValueJson(JsonWriter& json) const {
+  json.beginObject();
+  json.key("value");
+  writeValue(json);
+  json.endObject();
+}
 
-  char* printed = cJSON_PrintUnformatted(doc);
-  std::string payload = printed != nullptr ? printed : "{}";
-  if (printed != nullptr) cJSON_free(printed);
-  cJSON_Delete(doc);
+const std::string Command::getValueJson() const {
+  std::string payload;
+  JsonWriter json(payload);
+  writeValueJson(json);
   return payload;
 }
 
@@ -107,50 +240,90 @@ const std::vector<uint8_t> Command::getVectorFromJson(const cJSON* doc) const {
   return result;
 }
 
-const std::string Command::toJson() const {
-  cJSON* doc = cJSON_CreateObject();
+void Command::writeJson(JsonWriter& json) const {
+  json.beginObject();
 
   // Command Fields
-  cJSON_AddStringToObject(doc, "key", key.c_str());
-  cJSON_AddStringToObject(doc, "name", name.c_str());
-  cJSON_AddStringToObject(doc, "read_cmd", ebus::to_string(read_cmd).c_str());
-  cJSON_AddStringToObject(doc, "write_cmd", ebus::to_string(write_cmd).c_str());
-  cJSON_AddBoolToObject(doc, "active", active);
-  cJSON_AddNumberToObject(doc, "interval", interval);
+  json.key("key");
+  json.value(key);
+  json.key("name");
+  json.value(name);
+  json.key("read_cmd");
+  json.value(ebus::to_string(read_cmd));
+  json.key("write_cmd");
+  json.value(ebus::to_string(write_cmd));
+  json.key("active");
+  json.value(active);
+  json.key("interval");
+  json.value(interval);
+  json.key("adaptive");
+  json.value(adaptive);
+  json.key("min_interval");
+  json.value(min_interval);
+  json.key("max_interval");
+  json.value(max_interval);
+  json.key("adaptive_limits");
+  json.value(adaptive_limits);
 
   // Data Fields
-  cJSON_AddBoolToObject(doc, "master", master);
-  cJSON_AddNumberToObject(doc, "position", static_cast<double>(position));
-  cJSON_AddStringToObject(doc, "datatype", ebus::datatype_2_string(datatype));
-  cJSON_AddNumberToObject(doc, "divider", divider);
-  cJSON_AddNumberToObject(doc, "min", min);
-  cJSON_AddNumberToObject(doc, "max", max);
-  cJSON_AddNumberToObject(doc, "digits", digits);
-  cJSON_AddStringToObject(doc, "unit", unit.c_str());
+  json.key("master");
+  json.value(master);
+  json.key("position");
+  json.value(static_cast<double>(position));
+  json.key("datatype");
+  json.value(ebus::datatype_2_string(datatype));
+  json.key("divider");
+  json.value(static_cast<double>(divider));
+  json.key("min");
+  json.value(static_cast<double>(min));
+  json.key("max");
+  json.value(static_cast<double>(max));
+  json.key("digits");
+  json.value(static_cast<uint32_t>(digits));
+  json.key("unit");
+  json.value(getUnit());
+  json.key("deadband");
+  json.value(static_cast<double>(deadband));
 
   // Home Assistant
-  cJSON_AddBoolToObject(doc, "ha", ha);
-  cJSON_AddStringToObject(doc, "ha_component", ha_component.c_str());
-  cJSON_AddStringToObject(doc, "ha_device_class", ha_device_class.c_str());
-  cJSON_AddStringToObject(doc, "ha_entity_category",
-                          ha_entity_category.c_str());
-  cJSON_AddStringToObject(doc, "ha_mode", ha_mode.c_str());
-
-  cJSON* haMap = cJSON_AddObjectToObject(doc, "ha_key_value_map");
-  for (const auto& kv : ha_key_value_map)
-    cJSON_AddStringToObject(haMap, std::to_string(kv.first).c_str(),
-                            kv.second.c_str());
-
-  cJSON_AddNumberToObject(doc, "ha_default_key", ha_default_key);
-  cJSON_AddNumberToObject(doc, "ha_payload_on", ha_payload_on);
-  cJSON_AddNumberToObject(doc, "ha_payload_off", ha_payload_off);
-  cJSON_AddStringToObject(doc, "ha_state_class", ha_state_class.c_str());
-  cJSON_AddNumberToObject(doc, "ha_step", ha_step);
-
-  char* printed = cJSON_PrintUnformatted(doc);
-  std::string payload = printed != nullptr ? printed : "{}";
-  if (printed != nullptr) cJSON_free(printed);
-  cJSON_Delete(doc);
+  const HomeAssistant& fields = haFields();
+  json.key("ha");
+  json.value(ha);
+  json.key("ha_component");
+  json.value(fields.component);
+  json.key("ha_device_class");
+  json.value(fields.device_class);
+  json.key("ha_entity_category");
+  json.value(fields.entity_category);
+  json.key("ha_mode");
+  json.value(fields.mode);
+
+  json.key("ha_key_value_map");
+  json.beginObject();
+  for (const auto& kv : fields.key_value_map) {
+    json.key(std::to_string(kv.first).c_str());
+    json.value(kv.second);
+  }
+  json.endObject();
+
+  json.key("ha_default_key");
+  json.value(static_cast<int32_t>(fields.default_key));
+  json.key("ha_payload_on");
+  json.value(static_cast<uint32_t>(fields.payload_on));
+  json.key("ha_payload_off");
+  json.value(static_cast<uint32_t>(fields.payload_off));
+  json.key("ha_state_class");
+  json.value(fields.state_class);
+  json.key("ha_step");
+  json.value(static_cast<double>(fields.step));
+
+  json.endObject();
+}
+
+const std::string Command::toJson() const {
+  std::string payload;
+  JsonWriter json(payload);
+  writeJson(json);
   return payload;
 }
 
@@ -180,6 +353,10 @@ Command Command::fromJson(const cJSON* doc) {
   // Command Fields
   command.key = getString("key");
   command.name = getString("name");
+  command.value_topic = "values/" + command.name;
+  std::transform(command.value_topic.begin(), command.value_topic.end(),
+                 command.value_topic.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
   command.read_cmd = ebus::to_vector(getString("read_cmd"));
 
   std::string writeCmd = getString("write_cmd");
@@ -189,6 +366,30 @@ Command Command::fromJson(const cJSON* doc) {
   cJSON* intervalNode = cJSON_GetObjectItemCaseSensitive(doc, "interval");
   if (cJSON_IsNumber(intervalNode) && intervalNode->valuedouble >= 0)
     command.interval = static_cast<uint32_t>(intervalNode->valuedouble);
+
+  command.adaptive = getBool("adaptive", false);
+  cJSON* minIntervalNode =
+      cJSON_GetObjectItemCaseSensitive(doc, "min_interval");
+  if (cJSON_IsNumber(minIntervalNode) && minIntervalNode->valuedouble >= 0)
+    command.min_interval =
+        static_cast<uint32_t>(minIntervalNode->valuedouble);
+  cJSON* maxIntervalNode =
+      cJSON_GetObjectItemCaseSensitive(doc, "max_interval");
+  if (cJSON_IsNumber(maxIntervalNode) && maxIntervalNode->valuedouble >= 0)
+    command.max_interval =
+        static_cast<uint32_t>(maxIntervalNode->valuedouble);
+  command.adaptive_limits = getBool("adaptive_limits", false);
+  if (command.min_interval == 0) command.min_interval = 1;
+  if (command.max_interval < command.min_interval)
+    command.max_interval = command.min_interval;
+
+  // Adaptive polling starts at the configured interval
+  command.current_interval = command.interval;
+  if (command.adaptive)
+    command.current_interval =
+        std::clamp(command.interval, command.min_interval,
+                   command.max_interval);
+
   command.last = 0;
   command.data = std::vector<uint8_t>();
 
@@ -218,25 +419,30 @@ Command Command::fromJson(const cJSON* doc) {
   if (cJSON_IsNumber(digitsNode) && digitsNode->valuedouble >= 0)
     command.digits = static_cast<uint8_t>(digitsNode->valuedouble);
 
-  command.unit = getString("unit");
+  command.unit = intern(getString("unit"));
+
+  cJSON* deadbandNode = cJSON_GetObjectItemCaseSensitive(doc, "deadband");
+  if (cJSON_IsNumber(deadbandNode) && deadbandNode->valuedouble >= 0)
+    command.deadband = static_cast<float>(deadbandNode->valuedouble);
 
   // Home Assistant
   command.ha = getBool("ha", false);
 
   if (command.ha) {
-    command.ha_component = getString("ha_component", command.ha_component);
-    command.ha_device_class =
-        getString("ha_device_class", command.ha_device_class);
-    command.ha_entity_category =
-        getString("ha_entity_category", command.ha_entity_category);
-    command.ha_mode = getString("ha_mode", command.ha_mode);
+    auto fields = std::make_shared<HomeAssistant>();
+
+    fields->component = getString("ha_component", fields->component);
+    fields->device_class = getString("ha_device_class", fields->device_class);
+    fields->entity_category =
+        getString("ha_entity_category", fields->entity_category);
+    fields->mode = getString("ha_mode", fields->mode);
 
     cJSON* haMap = cJSON_GetObjectItemCaseSensitive(doc, "ha_key_value_map");
     if (cJSON_IsObject(haMap)) {
       for (cJSON* item = haMap->child; item != nullptr; item = item->next) {
         if (item->string != nullptr && cJSON_IsString(item) &&
             item->valuestring != nullptr) {
-          command.ha_key_value_map[std::stoi(item->string)] = item->valuestring;
+          fields->key_value_map[std::stoi(item->string)] = item->valuestring;
         }
       }
     }
@@ -244,25 +450,25 @@ Command Command::fromJson(const cJSON* doc) {
     cJSON* defaultKeyNode =
         cJSON_GetObjectItemCaseSensitive(doc, "ha_default_key");
     if (cJSON_IsNumber(defaultKeyNode))
-      command.ha_default_key = static_cast<int>(defaultKeyNode->valuedouble);
+      fields->default_key = static_cast<int>(defaultKeyNode->valuedouble);
 
     cJSON* payloadOnNode =
         cJSON_GetObjectItemCaseSensitive(doc, "ha_payload_on");
     if (cJSON_IsNumber(payloadOnNode) && payloadOnNode->valuedouble >= 0)
-      command.ha_payload_on = static_cast<uint8_t>(payloadOnNode->valuedouble);
+      fields->payload_on = static_cast<uint8_t>(payloadOnNode->valuedouble);
 
     cJSON* payloadOffNode =
         cJSON_GetObjectItemCaseSensitive(doc, "ha_payload_off");
     if (cJSON_IsNumber(payloadOffNode) && payloadOffNode->valuedouble >= 0)
-      command.ha_payload_off =
-          static_cast<uint8_t>(payloadOffNode->valuedouble);
+      fields->payload_off = static_cast<uint8_t>(payloadOffNode->valuedouble);
 
-    command.ha_state_class =
-        getString("ha_state_class", command.ha_state_class);
+    fields->state_class = getString("ha_state_class", fields->state_class);
 
     cJSON* stepNode = cJSON_GetObjectItemCaseSensitive(doc, "ha_step");
     if (cJSON_IsNumber(stepNode) && stepNode->valuedouble > 0)
-      command.ha_step = static_cast<float>(stepNode->valuedouble);
+      fields->step = static_cast<float>(stepNode->valuedouble);
+
+    command.ha_fields = std::move(fields);
   }
 
   return command;
@@ -276,6 +482,10 @@ const std::string Command::evaluate(const cJSON* doc) {
                                     {"write_cmd", false, FT_HexString},
                                     {"active", true, FT_Bool},
                                     {"interval", false, FT_Uint32T},
+                                    {"adaptive", false, FT_Bool},
+                                    {"min_interval", false, FT_Uint32T},
+                                    {"max_interval", false, FT_Uint32T},
+                                    {"adaptive_limits", false, FT_Bool},
                                     // Data Fields
                                     {"master", true, FT_Bool},
                                     {"position", true, FT_SizeT},
@@ -285,6 +495,7 @@ const std::string Command::evaluate(const cJSON* doc) {
                                     {"max", false, FT_Float},
                                     {"digits", false, FT_Uint8T},
                                     {"unit", false, FT_String},
+                                    {"deadband", false, FT_Float},
                                     // Home Assistant
                                     {"ha", false, FT_Bool},
                                     {"ha_component", false, FT_String},
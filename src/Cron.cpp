@@ -224,6 +224,8 @@ bool getBoolField(const cJSON* doc, const char* name, bool fallback) {
 
 }  // namespace
 
+Cron::Cron() { rulesMutex = xSemaphoreCreateMutex(); }
+
 bool Cron::initFileSystem() { return store.initFileSystem(); }
 
 void Cron::start() {
@@ -233,7 +235,12 @@ void Cron::start() {
   }
 }
 
-void Cron::stop() { stopRunner = true; }
+void Cron::stop() {
+  stopRunner = true;
+  wakeup.notify();
+}
+
+const WakeLatency& Cron::getWakeLatency() const { return wakeup.latency(); }
 
 Cron::Rule Cron::ruleFromJson(const cJSON* doc) {
   Rule rule;
@@ -255,9 +262,10 @@ Cron::Rule Cron::ruleFromJson(const cJSON* doc) {
 }
 
 void Cron::setRules(std::unordered_map<std::string, Rule>&& nextRules) {
-  portENTER_CRITICAL(&rulesMux);
+  xSemaphoreTake(rulesMutex, portMAX_DELAY);
   rules = std::move(nextRules);
-  portEXIT_CRITICAL(&rulesMux);
+  xSemaphoreGive(rulesMutex);
+  wakeup.notify();
 }
 
 int64_t Cron::loadRules() {
@@ -343,35 +351,50 @@ int64_t Cron::saveRules() const {
   return static_cast<int64_t>(size);
 }
 
-const std::string Cron::getRulesJson() const {
-  cJSON* root = cJSON_CreateArray();
-
-  std::vector<Rule> ordered;
-  portENTER_CRITICAL(&rulesMux);
-  for (const auto& kv : rules) ordered.push_back(kv.second);
-  portEXIT_CRITICAL(&rulesMux);
-
-  std::sort(ordered.begin(), ordered.end(),
-            [](const Rule& a, const Rule& b) { return a.id < b.id; });
-
-  for (const Rule& rule : ordered) {
-    cJSON* item = cJSON_CreateObject();
-    cJSON_AddStringToObject(item, "id", rule.id.c_str());
-    cJSON_AddStringToObject(item, "schedule", rule.schedule.c_str());
-    cJSON_AddStringToObject(item, "command_key", rule.commandKey.c_str());
-    cJSON_AddBoolToObject(item, "enabled", rule.enabled);
-
-    cJSON* valueNode = cJSON_Parse(rule.valueJson.c_str());
-    if (valueNode != nullptr)
-      cJSON_AddItemToObject(item, "value", valueNode);
-    else
-      cJSON_AddNullToObject(item, "value");
-
-    cJSON_AddItemToArray(root, item);
+void Cron::writeRulesJson(JsonWriter& json) const {
+  // Only the ids are copied, each rule is fetched when it is written
+  std::vector<std::string> ids;
+  xSemaphoreTake(rulesMutex, portMAX_DELAY);
+  ids.reserve(rules.size());
+  for (const auto& kv : rules) ids.push_back(kv.first);
+  xSemaphoreGive(rulesMutex);
+
+  std::sort(ids.begin(), ids.end());
+
+  json.beginArray();
+  for (const std::string& id : ids) {
+    Rule rule;
+    bool found = false;
+    xSemaphoreTake(rulesMutex, portMAX_DELAY);
+    auto it = rules.find(id);
+    if (it != rules.end()) {
+      rule = it->second;
+      found = true;
+    }
+    xSemaphoreGive(rulesMutex);
+    if (!found) continue;
+
+    json.beginObject();
+    json.key("id");
+    json.value(rule.id);
+    json.key("schedule");
+    json.value(rule.schedule);
+    json.key("command_key");
+    json.value(rule.commandKey);
+    json.key("enabled");
+    json.value(rule.enabled);
+    // stored as printed by cJSON, see ruleFromJson
+    json.key("value");
+    json.raw(rule.valueJson.empty() ? "null" : rule.valueJson);
+    json.endObject();
   }
+  json.endArray();
+}
 
-  std::string payload = printJson(root, "[]");
-  cJSON_Delete(root);
+const std::string Cron::getRulesJson() const {
+  std::string payload;
+  JsonWriter json(payload);
+  writeRulesJson(json);
   return payload;
 }
 
@@ -454,13 +477,18 @@ const std::string Cron::evaluate(const cJSON* doc) {
 
 void Cron::taskFunc(void* arg) {
   Cron* self = static_cast<Cron*>(arg);
+  self->wakeup.attach();
   for (;;) {
     if (self->stopRunner) {
       self->taskHandle = nullptr;
       vTaskDelete(nullptr);
     }
     self->tick();
-    vTaskDelay(pdMS_TO_TICKS(1000));
+
+    // Rules match whole minutes, sleep until the next minute has started.
+    const std::time_t now = std::time(nullptr);
+    const uint32_t seconds = 60 - static_cast<uint32_t>(now % 60);
+    self->wakeup.wait(pdMS_TO_TICKS(seconds * 1000));
   }
 }
 
@@ -481,7 +509,7 @@ void Cron::tick() {
 
   std::vector<PendingRule> pending;
 
-  portENTER_CRITICAL(&rulesMux);
+  xSemaphoreTake(rulesMutex, portMAX_DELAY);
   for (auto& kv : rules) {
     Rule& rule = kv.second;
     if (!rule.enabled) continue;
@@ -491,7 +519,7 @@ void Cron::tick() {
     rule.lastTriggeredMinute = minuteStamp;
     pending.push_back({rule.id, rule.commandKey, rule.valueJson});
   }
-  portEXIT_CRITICAL(&rulesMux);
+  xSemaphoreGive(rulesMutex);
 
   for (const PendingRule& pendingRule : pending) {
     Command* command = store.findCommand(pendingRule.commandKey);
@@ -49,36 +49,41 @@ void Device::update(const std::vector<uint8_t>& master,
     vec_b5090127 = slave;
 }
 
-const std::string Device::toJson() const {
-  cJSON* doc = cJSON_CreateObject();
+void Device::writeJson(JsonWriter& json) const {
+  json.beginObject();
 
   uint8_t master = ebus::masterOf(slave);
-  cJSON_AddStringToObject(
-      doc, "master", (master != slave ? ebus::to_string(master) : "").c_str());
-  cJSON_AddStringToObject(doc, "slave", ebus::to_string(slave).c_str());
+  json.key("master");
+  json.value(master != slave ? ebus::to_string(master) : "");
+  json.key("slave");
+  json.value(ebus::to_string(slave));
 
   if (vec_070400.size() > 1) {
     const std::string manufacturer = (manufacturers.count(vec_070400[1]) > 0)
                                          ? manufacturers.at(vec_070400[1])
                                          : "";
-    cJSON_AddStringToObject(doc, "manufacturer", manufacturer.c_str());
-    cJSON_AddStringToObject(
-        doc, "unitid",
-        ebus::byte_2_char(ebus::range(vec_070400, 2, 5)).c_str());
-    cJSON_AddStringToObject(
-        doc, "software",
-        ebus::to_string(ebus::range(vec_070400, 7, 2)).c_str());
-    cJSON_AddStringToObject(
-        doc, "hardware",
-        ebus::to_string(ebus::range(vec_070400, 9, 2)).c_str());
-
-    cJSON_AddStringToObject(doc, "ebusd", ebusdConfiguration().c_str());
+    json.key("manufacturer");
+    json.value(manufacturer);
+    json.key("unitid");
+    json.value(ebus::byte_2_char(ebus::range(vec_070400, 2, 5)));
+    json.key("software");
+    json.value(ebus::to_string(ebus::range(vec_070400, 7, 2)));
+    json.key("hardware");
+    json.value(ebus::to_string(ebus::range(vec_070400, 9, 2)));
+
+    json.key("ebusd");
+    json.value(ebusdConfiguration());
   } else {
-    cJSON_AddStringToObject(doc, "manufacturer", "");
-    cJSON_AddStringToObject(doc, "unitid", "");
-    cJSON_AddStringToObject(doc, "software", "");
-    cJSON_AddStringToObject(doc, "hardware", "");
-    cJSON_AddStringToObject(doc, "ebusd", "");
+    json.key("manufacturer");
+    json.value("");
+    json.key("unitid");
+    json.value("");
+    json.key("software");
+    json.value("");
+    json.key("hardware");
+    json.value("");
+    json.key("ebusd");
+    json.value("");
   }
 
   if (isVaillant() && isVaillantValid()) {
@@ -87,20 +92,23 @@ const std::string Device::toJson() const {
     serial += ebus::byte_2_char(ebus::range(vec_b5090126, 1, 9));
     serial += ebus::byte_2_char(ebus::range(vec_b5090127, 1, 2));
 
-    // doc["prefix"] = serial.substr(0, 2);
-    // doc["year"] = serial.substr(2, 2);
-    // doc["week"] = serial.substr(4, 2);
-    cJSON_AddStringToObject(doc, "product", serial.substr(6, 10).c_str());
-    // doc["supplier"] = serial.substr(16, 4);
-    // doc["counter"] = serial.substr(20, 6);
-    // doc["suffix"] = serial.substr(26, 2);
+    // prefix   serial.substr(0, 2)
+    // year     serial.substr(2, 2)
+    // week     serial.substr(4, 2)
+    json.key("product");
+    json.value(serial.substr(6, 10));
+    // supplier serial.substr(16, 4)
+    // counter  serial.substr(20, 6)
+    // suffix   serial.substr(26, 2)
   }
 
-  char* printed = cJSON_PrintUnformatted(doc);
-  std::string payload = printed != nullptr ? printed : "{}";
-  if (printed != nullptr) cJSON_free(printed);
-  cJSON_Delete(doc);
+  json.endObject();
+}
 
+const std::string Device::toJson() const {
+  std::string payload;
+  JsonWriter json(payload);
+  writeJson(json);
   return payload;
 }
 
@@ -5,6 +5,8 @@
 
 DeviceManager deviceManager;
 
+DeviceManager::DeviceManager() { devicesMutex = xSemaphoreCreateMutex(); }
+
 void DeviceManager::setEbusHandler(ebus::Handler* handler) {
   ebusHandler = handler;
 }
@@ -17,7 +19,11 @@ void DeviceManager::collectData(const std::vector<uint8_t>& master,
 
   // Devices
   if (master[1] == ebusHandler->getTargetAddress()) return;
-  if (ebus::isSlave(master[1])) devices[master[1]].update(master, slave);
+  if (ebus::isSlave(master[1])) {
+    xSemaphoreTake(devicesMutex, portMAX_DELAY);
+    devices[master[1]].update(master, slave);
+    xSemaphoreGive(devicesMutex);
+  }
 }
 
 void DeviceManager::resetAddresses() {
@@ -25,27 +31,44 @@ void DeviceManager::resetAddresses() {
   slaves.clear();
 }
 
-const std::string DeviceManager::getDevicesJson() {
-  cJSON* doc = cJSON_CreateArray();
-
-  for (const auto& device : devices) {
-    cJSON* item = cJSON_Parse(device.second.toJson().c_str());
-    if (item != nullptr) cJSON_AddItemToArray(doc, item);
+void DeviceManager::writeDevicesJson(JsonWriter& json) const {
+  // Only the addresses are copied, each device is fetched when it is written
+  std::vector<uint8_t> addresses;
+  xSemaphoreTake(devicesMutex, portMAX_DELAY);
+  addresses.reserve(devices.size());
+  for (const auto& device : devices) addresses.push_back(device.first);
+  xSemaphoreGive(devicesMutex);
+
+  json.beginArray();
+  Device device;
+  for (const uint8_t address : addresses) {
+    bool found = false;
+    xSemaphoreTake(devicesMutex, portMAX_DELAY);
+    auto it = devices.find(address);
+    if (it != devices.end()) {
+      device = it->second;
+      found = true;
+    }
+    xSemaphoreGive(devicesMutex);
+    if (found) device.writeJson(json);
   }
+  json.endArray();
+}
 
-  char* printed = cJSON_PrintUnformatted(doc);
-  std::string payload = printed != nullptr ? printed : "[]";
-  if (printed != nullptr) cJSON_free(printed);
-  cJSON_Delete(doc);
-
+const std::string DeviceManager::getDevicesJson() {
+  std::string payload;
+  JsonWriter json(payload);
+  writeDevicesJson(json);
   return payload;
 }
 
 const std::vector<const Device*> DeviceManager::getDevices() const {
   std::vector<const Device*> result;
+  xSemaphoreTake(devicesMutex, portMAX_DELAY);
   for (const auto& device : devices) {
     result.push_back(&(device.second));
   }
+  xSemaphoreGive(devicesMutex);
   return result;
 }
 
@@ -84,11 +107,13 @@ const std::vector<std::vector<uint8_t>> DeviceManager::scanCommands() const {
 const std::vector<std::vector<uint8_t>> DeviceManager::vendorScanCommands()
     const {
   std::vector<std::vector<uint8_t>> result;
+  xSemaphoreTake(devicesMutex, portMAX_DELAY);
   for (const auto& device : devices) {
     const auto commands = device.second.createVendorScanCommands();
     if (!commands.empty())
       result.insert(result.end(), commands.begin(), commands.end());
   }
+  xSemaphoreGive(devicesMutex);
   return result;
 }
 
@@ -12,6 +12,9 @@ namespace HttpUtils {
 
 namespace {
   std::vector<std::pair<std::string, std::string>> customHeaders;
+
+  // Bytes collected before a chunk of a json response is sent
+  constexpr size_t kJsonChunkSize = 1024;
 }
 
 void setCustomHeaders(const std::string& raw) {
@@ -55,6 +58,25 @@ void sendResponse(httpd_req_t* req, const char* status, const char* type,
   sendResponse(req, status, type, body.c_str());
 }
 
+esp_err_t sendJson(httpd_req_t* req,
+                   const std::function<void(JsonWriter& json)>& write) {
+  httpd_resp_set_status(req, "200 OK");
+  httpd_resp_set_type(req, "application/json;charset=utf-8");
+  applyCustomHeaders(req);
+
+  std::string buffer;
+  buffer.reserve(kJsonChunkSize + 256);
+  JsonWriter json(
+      buffer,
+      [req](const char* data, size_t length) {
+        return httpd_resp_send_chunk(req, data, length) == ESP_OK;
+      },
+      kJsonChunkSize);
+  write(json);
+  if (!json.flush()) return ESP_FAIL;
+  return httpd_resp_send_chunk(req, nullptr, 0);
+}
+
 std::string readBody(httpd_req_t* req) {
   std::string out;
   int remaining = req->content_len;
@@ -0,0 +1,113 @@
+#include "JsonScanner.hpp"
+
+#include <cstring>
+
+JsonScanner::JsonScanner(const char* text, size_t length)
+    : text(text), length(length) {}
+
+bool JsonScanner::findMember(const char* name, const char*& value,
+                             size_t& valueLength) const {
+  const size_t nameLength = std::strlen(name);
+
+  size_t pos = skipSpace(text, length, 0);
+  if (pos >= length || text[pos] != '{') return false;
+  pos = skipSpace(text, length, pos + 1);
+
+  while (pos < length && text[pos] == '"') {
+    const size_t keyStart = pos + 1;
+    const size_t keyEnd = skipString(text, length, pos);
+    if (keyEnd == 0) return false;
+
+    pos = skipSpace(text, length, keyEnd);
+    if (pos >= length || text[pos] != ':') return false;
+    const size_t valueStart = skipSpace(text, length, pos + 1);
+    const size_t valueEnd = skipValue(text, length, valueStart);
+    if (valueEnd == 0) return false;
+
+    // the key is the text between its quotes
+    if (keyEnd - 1 - keyStart == nameLength &&
+        std::memcmp(text + keyStart, name, nameLength) == 0) {
+      value = text + valueStart;
+      valueLength = valueEnd - valueStart;
+      return true;
+    }
+
+    pos = skipSpace(text, length, valueEnd);
+    if (pos >= length || text[pos] != ',') return false;
+    pos = skipSpace(text, length, pos + 1);
+  }
+
+  return false;
+}
+
+bool JsonScanner::forEachElement(const char* text, size_t length,
+                                 const Element& element) {
+  size_t pos = skipSpace(text, length, 0);
+  if (pos >= length || text[pos] != '[') return false;
+  pos = skipSpace(text, length, pos + 1);
+  if (pos < length && text[pos] == ']') return true;
+
+  while (pos < length) {
+    const size_t end = skipValue(text, length, pos);
+    if (end == 0 || !element(text + pos, end - pos)) return false;
+
+    pos = skipSpace(text, length, end);
+    if (pos >= length) return false;
+    if (text[pos] == ']') return true;
+    if (text[pos] != ',') return false;
+    pos = skipSpace(text, length, pos + 1);
+  }
+
+  return false;
+}
+
+size_t JsonScanner::skipSpace(const char* text, size_t length, size_t pos) {
+  while (pos < length && (text[pos] == ' ' || text[pos] == '\t' ||
+                          text[pos] == '\n' || text[pos] == '\r'))
+    ++pos;
+  return pos;
+}
+
+size_t JsonScanner::skipValue(const char* text, size_t length, size_t pos) {
+  if (pos >= length) return 0;
+
+  if (text[pos] == '"') return skipString(text, length, pos);
+
+  if (text[pos] == '{' || text[pos] == '[') {
+    // only the nesting is followed, the parser checks the rest
+    size_t depth = 0;
+    while (pos < length) {
+      const char c = text[pos];
+      if (c == '"') {
+        pos = skipString(text, length, pos);
+        if (pos == 0) return 0;
+        continue;
+      }
+      if (c == '{' || c == '[') {
+        ++depth;
+      } else if (c == '}' || c == ']') {
+        if (--depth == 0) return pos + 1;
+      }
+      ++pos;
+    }
+    return 0;
+  }
+
+  // numbers, true, false and null end at the next delimiter
+  const size_t start = pos;
+  while (pos < length && text[pos] != ',' && text[pos] != '}' &&
+         text[pos] != ']' && text[pos] != ' ' && text[pos] != '\t' &&
+         text[pos] != '\n' && text[pos] != '\r')
+    ++pos;
+  return pos > start ? pos : 0;
+}
+
+size_t JsonScanner::skipString(const char* text, size_t length, size_t pos) {
+  for (++pos; pos < length; ++pos) {
+    if (text[pos] == '\\')
+      ++pos;
+    else if (text[pos] == '"')
+      return pos + 1;
+  }
+  return 0;
+}
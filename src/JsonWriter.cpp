@@ -0,0 +1,170 @@
+#include "JsonWriter.hpp"
+
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+JsonWriter::JsonWriter(std::string& out) : out(out) {}
+
+JsonWriter::JsonWriter(std::string& out, Sink sink, size_t chunkSize)
+    : out(out), sink(std::move(sink)), chunkSize(chunkSize) {}
+
+bool JsonWriter::flush() {
+  if (sink && !failed && !out.empty())
+    failed = !sink(out.data(), out.size());
+  out.clear();
+  return !failed;
+}
+
+void JsonWriter::beginObject() {
+  separate();
+  out += '{';
+  comma = false;
+}
+
+void JsonWriter::endObject() {
+  out += '}';
+  comma = true;
+  spill();
+}
+
+void JsonWriter::beginArray() {
+  separate();
+  out += '[';
+  comma = false;
+}
+
+void JsonWriter::endArray() {
+  out += ']';
+  comma = true;
+  spill();
+}
+
+void JsonWriter::key(const char* name) {
+  separate();
+  appendString(out, name, std::strlen(name));
+  out += ':';
+  comma = false;
+}
+
+void JsonWriter::value(double number) {
+  separate();
+  appendNumber(out, number);
+  comma = true;
+  spill();
+}
+
+void JsonWriter::value(int32_t number) { value(static_cast<double>(number)); }
+
+void JsonWriter::value(uint32_t number) { value(static_cast<double>(number)); }
+
+void JsonWriter::value(bool flag) {
+  separate();
+  out += flag ? "true" : "false";
+  comma = true;
+  spill();
+}
+
+void JsonWriter::value(const char* text) {
+  separate();
+  appendString(out, text, std::strlen(text));
+  comma = true;
+  spill();
+}
+
+void JsonWriter::value(const std::string& text) {
+  separate();
+  appendString(out, text.data(), text.size());
+  comma = true;
+  spill();
+}
+
+void JsonWriter::null() {
+  separate();
+  out += "null";
+  comma = true;
+  spill();
+}
+
+void JsonWriter::raw(const std::string& json) {
+  separate();
+  out += json;
+  comma = true;
+  spill();
+}
+
+void JsonWriter::separate() {
+  if (comma) out += ',';
+}
+
+void JsonWriter::spill() {
+  // after a failed send the rest of the document is dropped
+  if (sink && (failed || out.size() >= chunkSize)) flush();
+}
+
+void JsonWriter::appendNumber(std::string& out, double number) {
+  char buffer[26];
+
+  // Same rules as cJSON: integers without fraction, otherwise the shortest
+  // of 15 or 17 significant digits that reads back to the same value
+  if (std::isnan(number) || std::isinf(number)) {
+    out += "null";
+    return;
+  }
+
+  int integer = number >= INT_MAX   ? INT_MAX
+                : number <= INT_MIN ? INT_MIN
+                                    : static_cast<int>(number);
+  if (number == static_cast<double>(integer)) {
+    std::snprintf(buffer, sizeof(buffer), "%d", integer);
+  } else {
+    std::snprintf(buffer, sizeof(buffer), "%1.15g", number);
+    if (std::strtod(buffer, nullptr) != number)
+      std::snprintf(buffer, sizeof(buffer), "%1.17g", number);
+  }
+  out += buffer;
+}
+
+void JsonWriter::appendString(std::string& out, const char* text,
+                              size_t length) {
+  out += '"';
+  for (size_t i = 0; i < length; ++i) {
+    const unsigned char c = static_cast<unsigned char>(text[i]);
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\b':
+        out += "\\b";
+        break;
+      case '\f':
+        out += "\\f";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (c < 32) {
+          char escaped[7];
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          out += escaped;
+        } else {
+          out += static_cast<char>(c);
+        }
+        break;
+    }
+  }
+  out += '"';
+}
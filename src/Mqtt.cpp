@@ -2,10 +2,16 @@
 #include "Mqtt.hpp"
 
 #include <esp_timer.h>
+#include <freertos/semphr.h>
 
+#include <algorithm>
+#include <cstring>
 #include <functional>
+#include <string_view>
 
 #include "DeviceManager.hpp"
+#include "JsonScanner.hpp"
+#include "JsonWriter.hpp"
 #include "Logger.hpp"
 #include "MqttHA.hpp"
 #include "Schedule.hpp"
@@ -42,9 +48,30 @@ std::vector<std::string> getStringArray(cJSON* doc, const char* key) {
   }
   return out;
 }
+
+// Value of a string member of the top level object, empty when missing
+std::string memberString(const JsonScanner& scanner, const char* name) {
+  const char* value = nullptr;
+  size_t length = 0;
+  if (!scanner.findMember(name, value, length)) return "";
+
+  cJSON* node = cJSON_ParseWithLength(value, length);
+  std::string out = (cJSON_IsString(node) && node->valuestring != nullptr)
+                        ? node->valuestring
+                        : "";
+  if (node) cJSON_Delete(node);
+  return out;
+}
+
+constexpr std::string_view kValuesPrefix = "values/";
 }  // namespace
 
 void Mqtt::start() {
+  // the locks exist before the client or any other task can use them
+  if (outgoingMutex == nullptr) outgoingMutex = xSemaphoreCreateMutex();
+  if (bulkMutex == nullptr) bulkMutex = xSemaphoreCreateMutex();
+  if (requestMutex == nullptr) requestMutex = xSemaphoreCreateMutex();
+
   if (enabled) {
     client = esp_mqtt_client_init(&mqtt_cfg);
     esp_mqtt_client_register_event(client,
@@ -62,6 +89,8 @@ void Mqtt::change() {
 void Mqtt::startTask() {
   if (taskHandle != nullptr) return;
   xTaskCreate(&Mqtt::taskFunc, "mqtt_loop", 6144, this, 1, &taskHandle);
+  xTaskCreate(&Mqtt::requestTaskFunc, "mqtt_request", 8192, this, 1,
+              &requestTaskHandle);
 }
 
 void Mqtt::stopTask() {
@@ -69,6 +98,10 @@ void Mqtt::stopTask() {
     vTaskDelete(taskHandle);
     taskHandle = nullptr;
   }
+  if (requestTaskHandle != nullptr) {
+    vTaskDelete(requestTaskHandle);
+    requestTaskHandle = nullptr;
+  }
 }
 
 void Mqtt::setStatusProvider(const std::function<std::string()>& provider) {
@@ -135,13 +168,28 @@ void Mqtt::publish(const char* topic, uint8_t qos, bool retain,
                    const char* payload, bool prefix) {
   if (!enabled) return;
 
-  std::string mqttTopic = prefix ? rootTopic + topic : topic;
+  if (!prefix) {
+    esp_mqtt_client_publish(client, topic, payload, 0, qos, retain);
+    return;
+  }
+
+  std::string mqttTopic = rootTopic + topic;
   esp_mqtt_client_publish(client, mqttTopic.c_str(), payload, 0, qos, retain);
 }
 
 void Mqtt::enqueueOutgoing(const OutgoingAction& action) {
-  if (!mqtt.enabled) return;
-  mqtt.outgoingQueue.push(action);
+  if (!mqtt.enabled || mqtt.outgoingMutex == nullptr) return;
+
+  xSemaphoreTake(mqtt.outgoingMutex, portMAX_DELAY);
+  const bool full = mqtt.outgoingQueue.size() >= outgoingCapacity;
+  if (!full) mqtt.outgoingQueue.push_back(action);
+  xSemaphoreGive(mqtt.outgoingMutex);
+
+  if (full) {
+    mqtt.outgoingDropped++;
+    return;
+  }
+  mqtt.wakeup.notify();
 }
 
 void Mqtt::publishData(const std::string& id,
@@ -160,25 +208,91 @@ void Mqtt::publishData(const std::string& id,
   mqtt.publish("response", 0, false, payload.c_str());
 }
 
-void Mqtt::publishValue(const std::string& name, const std::string& valueJson) {
-  if (!mqtt.enabled) return;
+bool Mqtt::publishValue(const Command* command) {
+  if (!mqtt.enabled || !mqtt.connected) return false;
+
+  // Home Assistant reads the state of its entities from the single topics
+  if (mqtt.bulkWindow > 0 && mqtt.bulkMutex != nullptr &&
+      !(command->getHA() && mqttha.isEnabled())) {
+    std::string_view name = command->getValueTopic();
+    name.remove_prefix(std::min(name.size(), kValuesPrefix.size()));
+
+    xSemaphoreTake(mqtt.bulkMutex, portMAX_DELAY);
+    const bool first = mqtt.bulkValues.empty();
+    if (first) mqtt.bulkStarted = (uint32_t)(esp_timer_get_time() / 1000ULL);
+    auto it = mqtt.bulkValues.find(name);
+    if (it == mqtt.bulkValues.end())
+      it = mqtt.bulkValues.emplace(std::string(name), std::string()).first;
+    it->second.clear();
+    JsonWriter bulk(it->second);
+    command->writeValueJson(bulk);
+    xSemaphoreGive(mqtt.bulkMutex);
+
+    // the task has to know when the window ends
+    if (first) mqtt.wakeup.notify();
+    return true;
+  }
 
-  std::string subTopic = name;
-  std::transform(subTopic.begin(), subTopic.end(), subTopic.begin(),
-                 [](unsigned char c) { return std::tolower(c); });
+  mqtt.valueTopic.assign(mqtt.rootTopic);
+  mqtt.valueTopic.append(command->getValueTopic());
+  mqtt.valuePayload.clear();
+  JsonWriter json(mqtt.valuePayload);
+  command->writeValueJson(json);
 
-  std::string topic = "values/" + subTopic;
-  mqtt.publish(topic.c_str(), 0, false, valueJson.c_str());
+  const int id = esp_mqtt_client_publish(
+      mqtt.client, mqtt.valueTopic.c_str(), mqtt.valuePayload.c_str(),
+      mqtt.valuePayload.size(), 0, false);
+  if (id < 0) return false;
+  mqtt.valueMessages++;
+  return true;
 }
 
 void Mqtt::doLoop() {
-  checkIncomingQueue();
   checkOutgoingQueue();
+  checkBulkValues();
 }
 
+const WakeLatency& Mqtt::getWakeLatency() const { return wakeup.latency(); }
+
+uint32_t Mqtt::getRequestsHandled() const { return requestsHandled; }
+
+uint32_t Mqtt::getRequestsDropped() const { return requestsDropped.load(); }
+
+uint32_t Mqtt::getRequestTimeMaximum() const { return requestTimeMax; }
+
+void Mqtt::setMaxRequestSize(const uint32_t kilobytes) {
+  maxRequestSize = kilobytes * 1024;
+  incomingBudget.setMaxRequestSize(maxRequestSize);
+}
+
+void Mqtt::setCoalesceCommands(const bool enable) { coalesceCommands = enable; }
+
+size_t Mqtt::getOutgoingQueued() const {
+  if (outgoingMutex == nullptr) return 0;
+
+  xSemaphoreTake(outgoingMutex, portMAX_DELAY);
+  size_t queued = outgoingQueue.size();
+  xSemaphoreGive(outgoingMutex);
+  return queued;
+}
+
+uint32_t Mqtt::getOutgoingDropped() const { return outgoingDropped.load(); }
+
+uint32_t Mqtt::getOutgoingStalls() const { return outgoingStalls; }
+
+uint32_t Mqtt::getOutboxHighWater() const { return outboxHighWater; }
+
+void Mqtt::setBulkWindow(const uint32_t seconds) { bulkWindow = seconds * 1000; }
+
+uint32_t Mqtt::getValueMessages() const { return valueMessages.load(); }
+
+void Mqtt::resetValueMessages() { valueMessages = 0; }
+
 void Mqtt::taskFunc(void* arg) {
   Mqtt* self = static_cast<Mqtt*>(arg);
+  self->wakeup.attach();
   for (;;) {
+    uint32_t timeout = self->statusPublishIntervalMs;
     if (self->enabled && self->connected) {
       uint32_t currentMillis = (uint32_t)(esp_timer_get_time() / 1000ULL);
       if (currentMillis > self->lastStatusPublish + self->statusPublishIntervalMs) {
@@ -191,11 +305,170 @@ void Mqtt::taskFunc(void* arg) {
         schedule.publishTiming();
       }
       self->doLoop();
+
+      // Outgoing batches follow each other as long as the outbox has room,
+      // otherwise sleep until the next status is due
+      const bool outgoing = self->getOutgoingQueued() > 0;
+      if (outgoing) {
+        timeout = self->outgoingStalled ? outboxRetryInterval : 0;
+      } else {
+        const uint32_t due =
+            self->lastStatusPublish + self->statusPublishIntervalMs;
+        currentMillis = (uint32_t)(esp_timer_get_time() / 1000ULL);
+        timeout = due > currentMillis ? due - currentMillis : 0;
+        xSemaphoreTake(self->bulkMutex, portMAX_DELAY);
+        timeout = std::min(timeout, self->bulkDelay());
+        xSemaphoreGive(self->bulkMutex);
+      }
+    }
+    // one more tick, the intervals have to be exceeded
+    self->wakeup.wait(pdMS_TO_TICKS(timeout) + 1);
+  }
+}
+
+void Mqtt::requestTaskFunc(void* arg) {
+  Mqtt* self = static_cast<Mqtt*>(arg);
+  self->requestWakeup.attach();
+  Request request;
+  for (;;) {
+    while (self->takeRequest(request)) self->handleRequest(request);
+    self->checkIncomingQueue();
+
+    // sleep until the next request, or the next token for queued actions
+    TickType_t timeout = portMAX_DELAY;
+    if (!self->incomingQueue.empty())
+      timeout = pdMS_TO_TICKS(self->incomingDelay()) + 1;
+    self->requestWakeup.wait(timeout);
+  }
+}
+
+void Mqtt::receiveData(esp_mqtt_event_handle_t event) {
+  const size_t total = event->total_data_len;
+  const size_t offset = event->current_data_offset;
+
+  if (offset == 0) {
+    assembly.clear();
+    assemblyDropped = total > maxRequestSize;
+    if (assemblyDropped) {
+      requestsDropped++;
+      publish("response", 0, false, errorPayload("request too large").c_str());
+      return;
+    }
+    if (static_cast<size_t>(event->data_len) == total) {
+      enqueueRequest(std::string(event->data, event->data_len));
+      return;
     }
-    vTaskDelay(1);
+    // the buffer takes the whole message, the fragments are only appended
+    assembly.reserve(total);
+  }
+
+  if (assemblyDropped) return;
+
+  // a fragment that does not continue the message drops it
+  if (offset != assembly.size()) {
+    assemblyDropped = true;
+    assembly = std::string();
+    requestsDropped++;
+    publish("response", 0, false, errorPayload("request incomplete").c_str());
+    return;
+  }
+
+  assembly.append(event->data, event->data_len);
+  if (assembly.size() >= total) {
+    enqueueRequest(std::move(assembly));
+    assembly = std::string();
   }
 }
 
+void Mqtt::enqueueRequest(std::string&& payload) {
+  const size_t length = payload.size();
+
+  xSemaphoreTake(requestMutex, portMAX_DELAY);
+  const bool full = requestQueue.size() >= requestCapacity ||
+                    requestBytes + length > maxRequestSize;
+  if (!full) {
+    requestQueue.push_back(
+        {std::move(payload), (uint32_t)(esp_timer_get_time() / 1000ULL)});
+    requestBytes += length;
+  }
+  xSemaphoreGive(requestMutex);
+
+  if (full) {
+    requestsDropped++;
+    publish("response", 0, false, errorPayload("request queue full").c_str());
+    return;
+  }
+  requestWakeup.notify();
+}
+
+bool Mqtt::takeRequest(Request& request) {
+  xSemaphoreTake(requestMutex, portMAX_DELAY);
+  const bool taken = !requestQueue.empty();
+  if (taken) {
+    request = std::move(requestQueue.front());
+    requestQueue.pop_front();
+    requestBytes -= request.payload.size();
+  }
+  xSemaphoreGive(requestMutex);
+  return taken;
+}
+
+void Mqtt::handleRequest(const Request& request) {
+  const int64_t started = esp_timer_get_time();
+  requestCorrelation.clear();
+  requestReceived = request.received;
+
+  // Inserts are parsed one command at a time, so a large insert never needs
+  // the document of all commands at once
+  JsonScanner scanner(request.payload.data(), request.payload.size());
+  const char* commands = nullptr;
+  size_t commandsLength = 0;
+  if (memberString(scanner, "id") == "insert" &&
+      scanner.findMember("commands", commands, commandsLength)) {
+    requestCorrelation = memberString(scanner, "correlation");
+    insertCommands(commands, commandsLength);
+    finishRequest(started);
+    return;
+  }
+
+  cJSON* doc = cJSON_Parse(request.payload.c_str());
+  if (!cJSON_IsObject(doc)) {
+    publishError("invalid json payload");
+  } else {
+    cJSON* correlationNode =
+        cJSON_GetObjectItemCaseSensitive(doc, "correlation");
+    if (cJSON_IsString(correlationNode) &&
+        correlationNode->valuestring != nullptr)
+      requestCorrelation = correlationNode->valuestring;
+
+    cJSON* idNode = cJSON_GetObjectItemCaseSensitive(doc, "id");
+    std::string id =
+        (cJSON_IsString(idNode) && idNode->valuestring != nullptr)
+            ? idNode->valuestring
+            : "";
+
+    auto it = commandHandlers.find(id);
+    if (it != commandHandlers.end()) {
+      it->second(doc);
+    } else {
+      // Unknown command error handling
+      publishError("command '" + id + "' not found");
+    }
+  }
+  if (doc) cJSON_Delete(doc);
+
+  finishRequest(started);
+}
+
+void Mqtt::finishRequest(int64_t started) {
+  requestCorrelation.clear();
+  requestReceived = 0;
+
+  requestsHandled++;
+  const uint32_t duration = (uint32_t)(esp_timer_get_time() - started);
+  if (duration > requestTimeMax) requestTimeMax = duration;
+}
+
 void Mqtt::eventHandler(void* handler_args, esp_event_base_t base,
                         int32_t event_id, void* event_data) {
   Mqtt* self = static_cast<Mqtt*>(handler_args);
@@ -213,6 +486,7 @@ void Mqtt::eventHandler(void* handler_args, esp_event_base_t base,
                    false);
 
       if (mqttha.isEnabled()) mqttha.publishDeviceInfo();
+      self->wakeup.notify();
     } break;
     case MQTT_EVENT_DISCONNECTED: {
       logger.debug("MQTT disconnected");
@@ -226,32 +500,7 @@ void Mqtt::eventHandler(void* handler_args, esp_event_base_t base,
       break;
     case MQTT_EVENT_DATA: {
       logger.debug("MQTT data received");
-
-      std::string incoming(event->data, event->data + event->data_len);
-      cJSON* doc = cJSON_Parse(incoming.c_str());
-      if (!cJSON_IsObject(doc)) {
-        mqtt.publish("response", 0, false,
-                     errorPayload("invalid json payload").c_str());
-        if (doc) cJSON_Delete(doc);
-        return;
-      }
-
-      cJSON* idNode = cJSON_GetObjectItemCaseSensitive(doc, "id");
-      std::string id =
-          (cJSON_IsString(idNode) && idNode->valuestring != nullptr)
-              ? idNode->valuestring
-              : "";
-
-      auto it = mqtt.commandHandlers.find(id);
-      if (it != mqtt.commandHandlers.end()) {
-        it->second(doc);
-      } else {
-        // Unknown command error handling
-        mqtt.publish("response", 0, false,
-                     errorPayload("command '" + id + "' not found").c_str());
-      }
-
-      cJSON_Delete(doc);
+      self->receiveData(event);
     } break;
     case MQTT_EVENT_DELETED: {
     } break;
@@ -272,27 +521,69 @@ void Mqtt::handleInsert(const cJSON* doc) {
       cJSON_GetObjectItemCaseSensitive(const_cast<cJSON*>(doc), "commands");
   if (!cJSON_IsArray(commands)) return;
 
+  size_t index = 0;
   cJSON* command = nullptr;
   cJSON_ArrayForEach(command, commands) {
-    std::string evalError = Command::evaluate(command);
-    if (evalError.empty()) {
-      incomingQueue.push(IncomingAction(Command::fromJson(command)));
-    } else {
-      mqtt.publish("response", 0, false, errorPayload(evalError).c_str());
-    }
+    char* text = cJSON_PrintUnformatted(command);
+    const size_t length = text != nullptr ? strlen(text) : 0;
+    cJSON_free(text);
+    queueInsert(command, length, index++);
+  }
+}
+
+void Mqtt::insertCommands(const char* array, size_t length) {
+  // Each command is queued as soon as it is parsed and answered on its own,
+  // the commands in front of a broken element stay queued
+  size_t index = 0;
+  bool valid = JsonScanner::forEachElement(
+      array, length, [&](const char* value, size_t valueLength) {
+        cJSON* command = cJSON_ParseWithLength(value, valueLength);
+        if (command == nullptr) return false;
+        queueInsert(command, valueLength, index++);
+        cJSON_Delete(command);
+        return true;
+      });
+  if (!valid)
+    publishError("commands array invalid at command " + std::to_string(index));
+}
+
+void Mqtt::queueInsert(const cJSON* command, size_t text, size_t index) {
+  std::string evalError = Command::evaluate(command);
+  if (!evalError.empty()) {
+    publishError("command " + std::to_string(index) + ": " + evalError);
+    return;
+  }
+
+  IncomingAction action(Command::fromJson(command));
+  action.correlation = requestCorrelation;
+  action.received = requestReceived;
+  action.text = text;
+  const std::string key = action.command->getKey();
+  if (!incomingBudget.take(text)) {
+    publishError("queue full, key '" + key + "' not inserted");
+    return;
   }
+  incomingQueue.push(std::move(action));
 }
 
 void Mqtt::handleRemove(const cJSON* doc) {
   std::vector<std::string> keys =
       getStringArray(const_cast<cJSON*>(doc), "keys");
 
-  if (!keys.empty()) {
-    for (const std::string& key : keys) incomingQueue.push(IncomingAction(key));
-  } else {
+  if (keys.empty()) {
     for (const Command* command : store.getCommands())
-      incomingQueue.push(IncomingAction(command->getKey()));
+      keys.push_back(command->getKey());
+  }
+
+  std::vector<IncomingAction> actions;
+  actions.reserve(keys.size());
+  for (const std::string& key : keys) {
+    actions.emplace_back(key);
+    actions.back().correlation = requestCorrelation;
+    actions.back().received = requestReceived;
+    actions.back().text = key.size() + 3;  // quoted and separated
   }
+  queueActions(std::move(actions));
 }
 
 void Mqtt::handlePublish(const cJSON* doc) {
@@ -394,7 +685,14 @@ void Mqtt::handleRead(const cJSON* doc) {
 
   const Command* command = store.findCommand(key);
   if (command != nullptr) {
-    std::string s = "{\"id\":\"read\",";
+    // the fields of the value follow the fields of the response
+    std::string s;
+    JsonWriter json(s);
+    json.beginObject();
+    json.key("id");
+    json.value("read");
+    writeRequestFields(json);
+    s += ",";
     s += store.getValueFullJson(command).substr(1);
     publish("response", 0, false, s.c_str());
   } else {
@@ -418,7 +716,7 @@ void Mqtt::handleWrite(const cJSON* doc) {
       schedule.handleWrite(writeCmd);
       mqtt.publishResponse("write", "scheduled for key '" + key + "' name '" +
                                         command->getName() + "'");
-      command->setLast(0);
+      store.refreshCommand(command);
     } else {
       mqtt.publishResponse("write", "invalid value for key '" + key + "'");
     }
@@ -427,24 +725,38 @@ void Mqtt::handleWrite(const cJSON* doc) {
   }
 }
 
+void Mqtt::queueActions(std::vector<IncomingAction>&& actions) {
+  // all actions of a request are queued or none
+  size_t bytes = 0;
+  for (const IncomingAction& action : actions) bytes += action.text;
+  if (!incomingBudget.take(bytes)) {
+    publishError("queue full");
+    return;
+  }
+
+  for (IncomingAction& action : actions) incomingQueue.push(std::move(action));
+}
+
 void Mqtt::checkIncomingQueue() {
-  if (!incomingQueue.empty() && (uint32_t)(esp_timer_get_time() / 1000ULL) >
-                                    lastIncoming + incomingInterval) {
-    lastIncoming = (uint32_t)(esp_timer_get_time() / 1000ULL);
-    IncomingAction action = incomingQueue.front();
+  Command removed;
+  while (!incomingQueue.empty() && takeIncomingToken()) {
+    IncomingAction action = std::move(incomingQueue.front());
     incomingQueue.pop();
+    incomingBudget.give(action.text);
+    requestCorrelation = action.correlation;
+    requestReceived = action.received;
 
     switch (action.type) {
       case IncomingActionType::Insert:
-        store.insertCommand(action.command);
-        if (mqttha.isEnabled()) mqttha.publishComponent(&action.command, false);
+        store.insertCommand(*action.command);
+        if (mqttha.isEnabled())
+          mqttha.publishComponent(action.command.get(), false);
         publishResponse("insert",
-                        "key '" + action.command.getKey() + "' inserted");
+                        "key '" + action.command->getKey() + "' inserted");
         break;
       case IncomingActionType::Remove:
-        const Command* cmd = store.findCommand(action.key);
-        if (cmd) {
-          if (mqttha.isEnabled()) mqttha.publishComponent(cmd, true);
+        if (store.copyCommand(action.key, removed)) {
+          if (mqttha.isEnabled()) mqttha.publishComponent(&removed, true);
           store.removeCommand(action.key);
           publishResponse("remove", "key '" + action.key + "' removed");
         } else {
@@ -453,48 +765,171 @@ void Mqtt::checkIncomingQueue() {
         break;
     }
   }
+  requestCorrelation.clear();
+  requestReceived = 0;
+}
+
+bool Mqtt::takeIncomingToken() {
+  // refill whole tokens for the time passed, the rest carries over
+  const uint32_t now = (uint32_t)(esp_timer_get_time() / 1000ULL);
+  const uint64_t tokens =
+      static_cast<uint64_t>(now - incomingRefill) * incomingRate / 1000;
+  if (incomingTokens + tokens >= incomingBurst) {
+    incomingTokens = incomingBurst;
+    incomingRefill = now;
+  } else if (tokens > 0) {
+    incomingTokens += tokens;
+    incomingRefill += tokens * 1000 / incomingRate;
+  }
+
+  if (incomingTokens == 0) return false;
+  incomingTokens--;
+  return true;
+}
+
+uint32_t Mqtt::incomingDelay() const {
+  if (incomingTokens > 0) return 0;
+  const uint32_t elapsed =
+      (uint32_t)(esp_timer_get_time() / 1000ULL) - incomingRefill;
+  const uint32_t interval = 1000 / incomingRate;
+  return elapsed < interval ? interval - elapsed : 0;
 }
 
 void Mqtt::checkOutgoingQueue() {
-  if (!outgoingQueue.empty() && (uint32_t)(esp_timer_get_time() / 1000ULL) >
-                                    lastOutgoing + outgoingInterval) {
-    lastOutgoing = (uint32_t)(esp_timer_get_time() / 1000ULL);
-    OutgoingAction action = outgoingQueue.front();
-    outgoingQueue.pop();
+  // Messages the client could not send yet wait in its outbox, hold back
+  // until it has room again
+  const int outbox = esp_mqtt_client_get_outbox_size(client);
+  if (outbox > 0 && static_cast<uint32_t>(outbox) > outboxHighWater)
+    outboxHighWater = outbox;
+  if (outbox > outboxLimit) {
+    if (!outgoingStalled) outgoingStalls++;
+    outgoingStalled = true;
+    return;
+  }
+  outgoingStalled = false;
+
+  // take the batch under the lock, publishing happens without it
+  outgoingBatchActions.clear();
+  xSemaphoreTake(outgoingMutex, portMAX_DELAY);
+  while (!outgoingQueue.empty() &&
+         outgoingBatchActions.size() < outgoingBatch) {
+    outgoingBatchActions.push_back(outgoingQueue.front());
+    outgoingQueue.pop_front();
+  }
+  xSemaphoreGive(outgoingMutex);
 
+  // the commands are copied, so a remove while publishing does no harm
+  Command command;
+  std::vector<Command> commands;
+  for (const OutgoingAction& action : outgoingBatchActions) {
     switch (action.type) {
       case OutgoingActionType::Command:
-        publishCommand(action.command);
+        if (!store.copyCommand(action.key, command)) break;
+        if (coalesceCommands)
+          commands.push_back(std::move(command));
+        else
+          publishCommand(&command);
         break;
       case OutgoingActionType::Device:
         publishDevice(action.device);
         break;
       case OutgoingActionType::Component:
-        mqttha.publishComponent(action.command, action.haRemove);
+        if (store.copyCommand(action.key, command))
+          mqttha.publishComponent(&command, action.haRemove);
         break;
     }
   }
+  if (!commands.empty()) publishCommands(commands);
+}
+
+void Mqtt::checkBulkValues() {
+  std::map<std::string, std::string, std::less<>> values;
+
+  xSemaphoreTake(bulkMutex, portMAX_DELAY);
+  if (!bulkValues.empty() && bulkDelay() == 0) values.swap(bulkValues);
+  xSemaphoreGive(bulkMutex);
+
+  if (values.empty()) return;
+
+  std::string payload;
+  JsonWriter json(payload);
+  json.beginObject();
+  for (const auto& value : values) {
+    json.key(value.first.c_str());
+    json.raw(value.second);
+  }
+  json.endObject();
+
+  publish("values/bulk", 0, false, payload.c_str());
+  valueMessages++;
+}
+
+uint32_t Mqtt::bulkDelay() const {
+  if (bulkValues.empty()) return UINT32_MAX;
+
+  // a window that was turned off ends at once
+  const uint32_t elapsed =
+      (uint32_t)(esp_timer_get_time() / 1000ULL) - bulkStarted;
+  return elapsed < bulkWindow ? bulkWindow - elapsed : 0;
 }
 
 void Mqtt::publishResponse(const std::string& id, const std::string& status,
                            const size_t& bytes) {
-  cJSON* doc = cJSON_CreateObject();
-  cJSON_AddStringToObject(doc, "id", id.c_str());
-  cJSON_AddStringToObject(doc, "status", status.c_str());
-  if (bytes > 0) cJSON_AddNumberToObject(doc, "bytes", bytes);
+  std::string payload;
+  JsonWriter json(payload);
+  json.beginObject();
+  json.key("id");
+  json.value(id);
+  json.key("status");
+  json.value(status);
+  if (bytes > 0) {
+    json.key("bytes");
+    json.value(static_cast<double>(bytes));
+  }
+  writeRequestFields(json);
+  json.endObject();
 
-  std::string payload = printJson(doc);
-  cJSON_Delete(doc);
+  publish("response", 0, false, payload.c_str());
+}
+
+void Mqtt::publishError(const std::string& message) {
+  std::string payload;
+  JsonWriter json(payload);
+  json.beginObject();
+  json.key("error");
+  json.value(message);
+  writeRequestFields(json);
+  json.endObject();
 
   publish("response", 0, false, payload.c_str());
 }
 
+void Mqtt::writeRequestFields(JsonWriter& json) const {
+  if (!requestCorrelation.empty()) {
+    json.key("correlation");
+    json.value(requestCorrelation);
+  }
+  if (requestReceived != 0) {
+    json.key("elapsed_ms");
+    json.value((uint32_t)(esp_timer_get_time() / 1000ULL) - requestReceived);
+  }
+}
+
 void Mqtt::publishCommand(const Command* command) {
   std::string topic = "commands/" + command->getKey();
   std::string payload = command->toJson();
   publish(topic.c_str(), 0, false, payload.c_str());
 }
 
+void Mqtt::publishCommands(const std::vector<Command>& commands) {
+  std::string payload;
+  JsonWriter json(payload);
+  json.beginArray();
+  for (const Command& command : commands) command.writeJson(json);
+  json.endArray();
+  publish("commands", 0, false, payload.c_str());
+}
+
 void Mqtt::publishDevice(const Device* device) {
   std::string topic = "devices/" + ebus::to_string(device->getSlave());
   std::string payload = device->toJson();
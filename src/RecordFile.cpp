@@ -0,0 +1,80 @@
+#include "RecordFile.hpp"
+
+#include <cstring>
+
+#if defined(ESP_PLATFORM)
+#include <esp_crc.h>
+#endif
+
+uint32_t recordChecksum(const void* data, size_t size) {
+#if defined(ESP_PLATFORM)
+  return esp_crc32_le(0, static_cast<const uint8_t*>(data), size);
+#else
+  // reflected polynomial 0x04C11DB7, inverted before and after
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint32_t crc = UINT32_MAX;
+  for (size_t i = 0; i < size; ++i) {
+    crc ^= bytes[i];
+    for (int bit = 0; bit < 8; ++bit)
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+  }
+  return ~crc;
+#endif
+}
+
+bool writeRecordHeader(FILE* file, const uint8_t* magic) {
+  uint8_t header[kRecordHeaderSize];
+  std::memcpy(header, magic, kRecordHeaderSize - 1);
+  header[kRecordHeaderSize - 1] = kRecordVersion;
+  return std::fwrite(header, 1, sizeof(header), file) == sizeof(header);
+}
+
+bool readRecordHeader(FILE* file, const uint8_t* magic) {
+  uint8_t header[kRecordHeaderSize];
+  return std::fread(header, 1, sizeof(header), file) == sizeof(header) &&
+         std::memcmp(header, magic, kRecordHeaderSize - 1) == 0 &&
+         header[kRecordHeaderSize - 1] == kRecordVersion;
+}
+
+bool writeRecord(FILE* file, const std::string& record) {
+  uint8_t length[2] = {static_cast<uint8_t>(record.size()),
+                       static_cast<uint8_t>(record.size() >> 8)};
+  uint8_t checksum[4];
+  writeU32(checksum, recordChecksum(record.data(), record.size()));
+
+  return std::fwrite(length, 1, sizeof(length), file) == sizeof(length) &&
+         std::fwrite(record.data(), 1, record.size(), file) ==
+             record.size() &&
+         std::fwrite(checksum, 1, sizeof(checksum), file) == sizeof(checksum);
+}
+
+RecordRead readRecord(FILE* file, std::vector<uint8_t>& record) {
+  uint8_t length[2];
+  size_t bytesRead = std::fread(length, 1, sizeof(length), file);
+  if (bytesRead == 0) return RecordRead::End;
+  if (bytesRead != sizeof(length)) return RecordRead::Torn;
+
+  uint8_t checksum[4];
+  record.resize(length[0] | length[1] << 8);
+  if (std::fread(record.data(), 1, record.size(), file) != record.size() ||
+      std::fread(checksum, 1, sizeof(checksum), file) != sizeof(checksum) ||
+      readU32(checksum) != recordChecksum(record.data(), record.size()))
+    return RecordRead::Torn;
+
+  return RecordRead::Record;
+}
+
+RecordRead readRecords(FILE* file, const uint8_t* magic,
+                       const RecordApply& apply, int64_t& bytes) {
+  bytes = 0;
+  if (!readRecordHeader(file, magic)) return RecordRead::Torn;
+  bytes = kRecordHeaderSize;
+
+  std::vector<uint8_t> record;
+  RecordRead result;
+  while ((result = readRecord(file, record)) == RecordRead::Record) {
+    bytes += kRecordFrameSize + record.size();
+    apply(record);
+  }
+  return result;
+}
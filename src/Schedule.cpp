@@ -4,6 +4,7 @@
 #include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 
 #include <algorithm>
 
@@ -27,12 +28,14 @@ static constexpr uint8_t PRIO_SCHEDULE = 3;  // schedule commands
 static constexpr uint8_t PRIO_SCAN = 2;      // manual scan
 static constexpr uint8_t PRIO_FULLSCAN = 1;  // manual full scan
 
-portMUX_TYPE commandMux = portMUX_INITIALIZER_UNLOCKED;
-
 Schedule schedule;
 
 void Schedule::start(ebus::Bus* bus, ebus::Request* request,
                      ebus::Handler* handler) {
+  // The command queue is filled from the http, mqtt and schedule tasks,
+  // create its lock before any of them can queue a command
+  if (queueMutex == nullptr) queueMutex = xSemaphoreCreateMutex();
+
   ebusBus = bus;
   ebusRequest = request;
   ebusHandler = handler;
@@ -42,12 +45,14 @@ void Schedule::start(ebus::Bus* bus, ebus::Request* request,
       CallbackEvent* event = new CallbackEvent();
       event->type = CallbackType::won;
       eventQueue.try_push(event);
+      wakeup.notify();
     });
 
     ebusHandler->setBusRequestLostCallback([this]() {
       CallbackEvent* event = new CallbackEvent();
       event->type = CallbackType::lost;
       eventQueue.try_push(event);
+      wakeup.notify();
     });
 
     ebusHandler->setReactiveMasterSlaveCallback(reactiveMasterSlaveCallback);
@@ -65,6 +70,7 @@ void Schedule::start(ebus::Bus* bus, ebus::Request* request,
           event->data.master = master;
           event->data.slave = slave;
           eventQueue.try_push(event);
+          wakeup.notify();
         });
 
     ebusHandler->setErrorCallback([this](const std::string& error,
@@ -76,6 +82,7 @@ void Schedule::start(ebus::Bus* bus, ebus::Request* request,
       event->data.master = master;
       event->data.slave = slave;
       eventQueue.try_push(event);
+      wakeup.notify();
     });
 
     // Start the scheduleRunner task
@@ -88,7 +95,10 @@ void Schedule::start(ebus::Bus* bus, ebus::Request* request,
   }
 }
 
-void Schedule::stop() { stopRunner = true; }
+void Schedule::stop() {
+  stopRunner = true;
+  wakeup.notify();
+}
 
 void Schedule::setSendInquiryOfExistence(const bool enable) {
   sendInquiryOfExistence = enable;
@@ -98,6 +108,17 @@ void Schedule::setFirstCommandAfterStart(const uint8_t delay) {
   firstCommandAfterStart = delay * 1000;
 }
 
+void Schedule::setPipelining(const bool enable) { pipelining = enable; }
+
+bool Schedule::setBusBudget(const int percent) {
+  const bool valid = percent >= 0 && percent < 100;
+  busBudget = valid ? static_cast<uint8_t>(percent) : 0;
+  budgetHold = false;
+  return valid;
+}
+
+uint8_t Schedule::getBusBudget() const { return busBudget; }
+
 void Schedule::handleScanFull() {
   deviceManager.setFullScan(true);
   deviceManager.resetFullScan();
@@ -150,6 +171,9 @@ void Schedule::resetCounter() {
   busRequestFailed = 0;
   sendingFailed = 0;
 
+  store.resetValueCounter();
+  mqtt.resetValueMessages();
+
   if (ebusRequest) ebusRequest->resetCounter();
   if (ebusHandler) ebusHandler->resetCounter();
 }
@@ -203,6 +227,13 @@ const std::string Schedule::getCounterJson() {
   cJSON_AddNumberToObject(messages, "Active_Broadcast",
                           handlerCounter.messagesActiveBroadcast);
 
+  // Values, updated ones and the ones left by the publish policy, and the
+  // mqtt messages they were sent in
+  cJSON* values = cJSON_AddObjectToObject(doc, "Values");
+  cJSON_AddNumberToObject(values, "Updated", store.getValuesUpdated());
+  cJSON_AddNumberToObject(values, "Published", store.getValuesPublished());
+  cJSON_AddNumberToObject(values, "Messages", mqtt.getValueMessages());
+
   // Bus
   cJSON* bus = cJSON_AddObjectToObject(doc, "Bus");
   cJSON_AddNumberToObject(bus, "StartBit", busCounter.busStartBit);
@@ -439,13 +470,52 @@ const std::string Schedule::getTimingJson() {
   return payload;
 }
 
+const WakeLatency& Schedule::getWakeLatency() const {
+  return wakeup.latency();
+}
+
+size_t Schedule::getQueuedCommands() {
+  if (queueMutex == nullptr) return 0;
+
+  int64_t lockedSince = lockQueue();
+  size_t queued = commandQueue.size();
+  unlockQueue(lockedSince);
+  return queued;
+}
+
+uint32_t Schedule::getQueueLockMaximum() const { return queueLockMax.load(); }
+
+uint32_t Schedule::getPipelinedCommands() const { return pipelinedCommands; }
+
+uint32_t Schedule::getTelegramDuration() const { return telegramDuration; }
+
+uint32_t Schedule::getTelegramsPerMinute() const { return telegramsPerMinute; }
+
+uint32_t Schedule::getBusLoad() const { return busLoad; }
+
 void Schedule::taskFunc(void* arg) {
   Schedule* self = static_cast<Schedule*>(arg);
+  self->wakeup.attach();
   for (;;) {
     if (self->stopRunner) vTaskDelete(NULL);
     self->handleEventQueue();
     self->handleCommandQueue();
-    vTaskDelay(1);  // short delay to yield CPU
+
+    // Queued commands that could not be started yet need another look soon,
+    // otherwise sleep until the next active command is due. A due command
+    // is already queued or running and its completion wakes the task.
+    const bool waiting =
+        !self->activeCommand &&
+        (self->stagedCommand || self->getQueuedCommands() > 0);
+    uint32_t timeout = self->idleInterval;
+    if (waiting) {
+      timeout = self->waitingInterval;
+    } else {
+      const uint32_t delay = store.nextActiveDelay();
+      if (delay > 0) timeout = std::min(timeout, delay);
+    }
+    const TickType_t ticks = pdMS_TO_TICKS(timeout);
+    self->wakeup.wait(ticks > 0 ? ticks : 1);
   }
 }
 
@@ -473,6 +543,23 @@ void Schedule::handleEventQueue() {
           }
         } break;
         case CallbackType::telegram: {
+          // Our own telegram completed, start the next command before the
+          // received data is processed
+          ActiveCommand* finished = nullptr;
+          if (event->data.messageType == ebus::MessageType::active) {
+            finished = activeCommand;
+            activeCommand = nullptr;
+            uint32_t currentMillis =
+                (uint32_t)(esp_timer_get_time() / 1000ULL);
+            if (finished)
+              measureTelegram(finished, event->data.master, event->data.slave,
+                              currentMillis);
+            if (pipelining && stagedCommand) {
+              startNextCommand(currentMillis);
+              if (activeCommand) pipelinedCommands++;
+            }
+          }
+
           std::string payload = ebus::to_string(event->data.master);
           if (event->data.slave.size() > 0)
             payload += " / " + ebus::to_string(event->data.slave);
@@ -483,7 +570,7 @@ void Schedule::handleEventQueue() {
 
           switch (event->data.messageType) {
             case ebus::MessageType::active:
-              schedule.processActive(event->mode,
+              schedule.processActive(event->mode, finished,
                                      std::vector<uint8_t>(event->data.master),
                                      std::vector<uint8_t>(event->data.slave));
               [[fallthrough]];
@@ -498,6 +585,8 @@ void Schedule::handleEventQueue() {
             default:
               break;
           }
+
+          delete finished;
         } break;
         case CallbackType::error: {
           std::string payload = event->data.message + " : master '" +
@@ -550,73 +639,200 @@ void Schedule::handleCommandQueue() {
   // Enqueue next full scan command if needed
   if (deviceManager.getFullScan()) enqueueFullScanCommand();
 
+  // Stage the next command while the current one is on the bus
+  if (pipelining && activeCommand && !stagedCommand) stageNextCommand();
+
   // Process queue
-  if (!ebusHandler->isActiveMessagePending() && !commandQueue.empty() &&
-      currentMillis > firstCommandAfterStart && !activeCommand) {
-    portENTER_CRITICAL(&commandMux);
-    QueuedCommand nextCmd = commandQueue.top();
-    commandQueue.pop();
-    portEXIT_CRITICAL(&commandMux);
-
-    mode = nextCmd.mode;
-
-    // Track all commands as active
-    activeCommand = new ActiveCommand(nextCmd, 1, 1, currentMillis);
-
-    // Send command
-    if (!nextCmd.command.empty()) {
-      bool res = ebusHandler->sendActiveMessage(nextCmd.command);
-      std::string msg = "Start " +
-                        std::string(res ? "success: " : " failed: ") +
-                        ebus::to_string(nextCmd.command);
-      logger.debug(msg.c_str());
-    }
-  }
+  startNextCommand(currentMillis);
 }
 
 void Schedule::enqueueCommand(const QueuedCommand& cmd) {
-  portENTER_CRITICAL(&commandMux);
-
-  // Ensure only one schedule command is allowed
-  if (cmd.mode == Mode::schedule) {
-    auto tmpQueue = commandQueue;  // Create a copy to check
-    while (!tmpQueue.empty()) {
-      if (tmpQueue.top().mode == Mode::schedule) {
-        portEXIT_CRITICAL(&commandMux);
-        return;  // A schedule command already exists
-      }
-      tmpQueue.pop();
-    }
+  // nothing is sent before the schedule was started
+  if (queueMutex == nullptr) return;
+
+  // Copy the command before locking, the lock only covers the queue itself
+  QueuedCommand entry = cmd;
+  size_t modeSlot = static_cast<size_t>(entry.mode);
+
+  int64_t lockedSince = lockQueue();
+  if (alreadyQueued(entry.mode)) {
+    unlockQueue(lockedSince);
+    return;
   }
 
-  // Ensure only one full scan command is allowed
-  if (cmd.mode == Mode::fullscan) {
-    auto tmpQueue = commandQueue;  // Create a copy to check
-    while (!tmpQueue.empty()) {
-      if (tmpQueue.top().mode == Mode::fullscan) {
-        portEXIT_CRITICAL(&commandMux);
-        return;  // A full scan command already exists
-      }
-      tmpQueue.pop();
-    }
+  // Insert behind all commands with the same or a higher priority
+  auto pos = std::find_if(commandQueue.begin(), commandQueue.end(),
+                          [&entry](const QueuedCommand& queued) {
+                            return queued.priority < entry.priority;
+                          });
+  commandQueue.insert(pos, std::move(entry));
+  queuedModes[modeSlot]++;
+
+  unlockQueue(lockedSince);
+  wakeup.notify();
+}
+
+std::optional<Schedule::QueuedCommand> Schedule::takeCommand(int minPriority) {
+  std::optional<QueuedCommand> next;
+
+  int64_t lockedSince = lockQueue();
+  if (!commandQueue.empty() && commandQueue.front().priority > minPriority) {
+    next.emplace(std::move(commandQueue.front()));
+    commandQueue.pop_front();
+    queuedModes[static_cast<size_t>(next->mode)]--;
   }
+  unlockQueue(lockedSince);
 
-  commandQueue.push(cmd);  // Add the command to the priority queue
-  portEXIT_CRITICAL(&commandMux);
+  return next;
+}
+
+void Schedule::requeueCommand(QueuedCommand&& cmd) {
+  size_t modeSlot = static_cast<size_t>(cmd.mode);
+
+  // A schedule command queued while this one was staged replaces it, the
+  // dropped command stays due in the store and is picked again
+  int64_t lockedSince = lockQueue();
+  if (alreadyQueued(cmd.mode)) {
+    unlockQueue(lockedSince);
+    return;
+  }
+
+  auto pos = std::find_if(commandQueue.begin(), commandQueue.end(),
+                          [&cmd](const QueuedCommand& queued) {
+                            return queued.priority <= cmd.priority;
+                          });
+  commandQueue.insert(pos, std::move(cmd));
+  queuedModes[modeSlot]++;
+  unlockQueue(lockedSince);
+}
+
+bool Schedule::alreadyQueued(Mode mode) const {
+  return (mode == Mode::schedule || mode == Mode::fullscan) &&
+         queuedModes[static_cast<size_t>(mode)] > 0;
+}
+
+int64_t Schedule::lockQueue() {
+  while (xSemaphoreTake(queueMutex, portMAX_DELAY) != pdPASS) {
+  }
+  return esp_timer_get_time();
+}
+
+void Schedule::unlockQueue(int64_t lockedSince) {
+  uint32_t held = (uint32_t)(esp_timer_get_time() - lockedSince);
+  xSemaphoreGive(queueMutex);
+  if (held > queueLockMax.load(std::memory_order_relaxed))
+    queueLockMax.store(held, std::memory_order_relaxed);
 }
 
 void Schedule::enqueueScheduleCommand() {
+  if (!withinBusBudget((uint32_t)(esp_timer_get_time() / 1000ULL))) return;
+
   Command* cmd = store.nextActiveCommand();
   if (!cmd || cmd->getReadCmd().empty()) return;
 
   // Check if this command is already being processed
+  if (isScheduled(cmd)) return;
+
+  // enqueueCommand will check for duplicates in the queue
+  enqueueCommand({Mode::schedule, PRIO_SCHEDULE, cmd->getReadCmd(), cmd});
+}
+
+bool Schedule::isScheduled(const Command* cmd) const {
   if (activeCommand && activeCommand->queuedCommand.mode == Mode::schedule &&
-      activeCommand->queuedCommand.scheduleCommand == cmd) {
+      activeCommand->queuedCommand.scheduleCommand == cmd)
+    return true;
+  return stagedCommand && stagedCommand->mode == Mode::schedule &&
+         stagedCommand->scheduleCommand == cmd;
+}
+
+void Schedule::stageNextCommand() {
+  stagedCommand = takeCommand();
+  if (stagedCommand || !store.active() ||
+      !withinBusBudget((uint32_t)(esp_timer_get_time() / 1000ULL)))
+    return;
+
+  // Nothing queued, take the schedule command that becomes due before the
+  // current telegram is expected to end
+  const Command* current =
+      activeCommand->queuedCommand.mode == Mode::schedule
+          ? activeCommand->queuedCommand.scheduleCommand
+          : nullptr;
+  Command* cmd = store.nextActiveCommand(telegramDuration, current);
+  if (cmd && !cmd->getReadCmd().empty())
+    stagedCommand.emplace(Mode::schedule, PRIO_SCHEDULE, cmd->getReadCmd(),
+                          cmd);
+}
+
+void Schedule::startNextCommand(uint32_t currentMillis) {
+  if (ebusHandler->isActiveMessagePending() ||
+      currentMillis <= firstCommandAfterStart || activeCommand)
     return;
+
+  // A staged command gives way to commands queued with a higher priority
+  // in the meantime, e.g. retries
+  std::optional<QueuedCommand> nextCmd;
+  if (stagedCommand) {
+    nextCmd = takeCommand(stagedCommand->priority);
+    if (nextCmd)
+      requeueCommand(std::move(*stagedCommand));
+    else
+      nextCmd = std::move(stagedCommand);
+    stagedCommand.reset();
+  } else {
+    nextCmd = takeCommand();
   }
+  if (!nextCmd) return;
 
-  // enqueueCommand will check for duplicates in the queue
-  enqueueCommand({Mode::schedule, PRIO_SCHEDULE, cmd->getReadCmd(), cmd});
+  mode = nextCmd->mode;
+
+  // Track all commands as active
+  activeCommand = new ActiveCommand(*nextCmd, 1, 1, currentMillis);
+
+  // Send command
+  if (!nextCmd->command.empty()) {
+    bool res = ebusHandler->sendActiveMessage(nextCmd->command);
+    std::string msg = "Start " +
+                      std::string(res ? "success: " : " failed: ") +
+                      ebus::to_string(nextCmd->command);
+    logger.debug(msg.c_str());
+  }
+}
+
+void Schedule::measureTelegram(const ActiveCommand* command,
+                               const std::vector<uint8_t>& master,
+                               const std::vector<uint8_t>& slave,
+                               uint32_t currentMillis) {
+  uint32_t duration = currentMillis - command->setTime;
+  telegramDuration = telegramDuration == 0
+                         ? duration
+                         : (telegramDuration * 7 + duration) / 8;
+
+  // Bus time of the telegram with CRC and ACK bytes and the closing SYN, a
+  // byte takes 10 bits at 2400 baud
+  size_t bytes = master.size() + 2 + 1;
+  if (!slave.empty()) bytes += slave.size() + 2;
+  uint32_t busTime = (uint32_t)(bytes * 10 * 1000 / 2400);
+
+  if (busBudget > 0) {
+    budgetHold = true;
+    budgetHoldUntil = currentMillis + busTime * (100 - busBudget) / busBudget;
+  }
+
+  telegramWindowCount++;
+  telegramWindowBusTime += busTime;
+  uint32_t elapsed = currentMillis - telegramWindowStart;
+  if (elapsed >= 60 * 1000) {
+    telegramsPerMinute =
+        (uint32_t)((uint64_t)telegramWindowCount * 60 * 1000 / elapsed);
+    busLoad = (uint32_t)((uint64_t)telegramWindowBusTime * 100 / elapsed);
+    telegramWindowStart = currentMillis;
+    telegramWindowCount = 0;
+    telegramWindowBusTime = 0;
+  }
+}
+
+bool Schedule::withinBusBudget(uint32_t currentMillis) const {
+  return !budgetHold || (int32_t)(currentMillis - budgetHoldUntil) >= 0;
 }
 
 void Schedule::enqueueStartupScanCommands() {
@@ -652,15 +868,14 @@ void Schedule::reactiveMasterSlaveCallback(const std::vector<uint8_t>& master,
   Device::getIdentification(master, slave);
 }
 
-void Schedule::processActive(const Mode& mode,
+void Schedule::processActive(const Mode& mode, const ActiveCommand* command,
                              const std::vector<uint8_t>& master,
                              const std::vector<uint8_t>& slave) {
   switch (mode) {
     case Mode::schedule:
-      if (activeCommand &&
-          activeCommand->queuedCommand.mode == Mode::schedule &&
-          activeCommand->queuedCommand.scheduleCommand != nullptr) {
-        store.updateData(activeCommand->queuedCommand.scheduleCommand, master,
+      if (command && command->queuedCommand.mode == Mode::schedule &&
+          command->queuedCommand.scheduleCommand != nullptr) {
+        store.updateData(command->queuedCommand.scheduleCommand, master,
                          slave);
       }
       break;
@@ -681,10 +896,6 @@ void Schedule::processActive(const Mode& mode,
     default:
       break;
   }
-  if (activeCommand) {
-    delete activeCommand;
-    activeCommand = nullptr;
-  }
 }
 
 void Schedule::processPassive(const std::vector<uint8_t>& master,
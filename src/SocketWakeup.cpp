@@ -0,0 +1,79 @@
+#include "SocketWakeup.hpp"
+
+#include <fcntl.h>
+#include <lwip/sockets.h>
+
+#include <cstdint>
+
+SocketWakeup::SocketWakeup() { _lock = xSemaphoreCreateMutex(); }
+
+bool SocketWakeup::open() {
+  if (_fd >= 0) return true;
+
+  const int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (fd < 0) return false;
+
+  // Bind to a free loopback port and connect to ourselves, so send and recv
+  // work without an address
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = 0;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addrLen = sizeof(addr);
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &addrLen) != 0 ||
+      connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    return false;
+  }
+
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags >= 0) {
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  }
+
+  // signals may already arrive, they see the socket once it is complete
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  _fd = fd;
+  _pending = false;
+  xSemaphoreGive(_lock);
+  return true;
+}
+
+void SocketWakeup::close() {
+  // a pending signal makes signal return before it takes the lock, one that
+  // holds it finishes its send first
+  _pending = true;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+  xSemaphoreGive(_lock);
+}
+
+int SocketWakeup::fd() const { return _fd; }
+
+void SocketWakeup::signal() {
+  // signals before open stay pending until open resets the flag
+  if (_pending.exchange(true)) return;
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  if (_fd >= 0) {
+    _latency.signaled();
+    const uint8_t byte = 0;
+    send(_fd, &byte, 1, MSG_DONTWAIT);
+  }
+  xSemaphoreGive(_lock);
+}
+
+void SocketWakeup::clear() {
+  if (_fd < 0) return;
+  // clear the flag first, a signal after this point sends a new datagram
+  _pending = false;
+  uint8_t buffer[16];
+  while (recv(_fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+  }
+  _latency.woken();
+}
+
+const WakeLatency& SocketWakeup::latency() const { return _latency; }
@@ -4,18 +4,94 @@
 #include <esp_littlefs.h>
 #include <esp_timer.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <sys/stat.h>
 
+#include "RecordFile.hpp"
+
 Store store;
 
 namespace {
 constexpr const char* kLittlefsBasePath = "/littlefs";
 constexpr const char* kLittlefsPartitionLabel = "littlefs";
-constexpr const char* kCommandsFilePath = "/littlefs/commands.json";
+constexpr const char* kCommandsFilePath = "/littlefs/commands.bin";
+constexpr const char* kCommandsTempPath = "/littlefs/commands.tmp";
+constexpr const char* kJournalFilePath = "/littlefs/commands.log";
+constexpr const char* kLegacyCommandsFilePath = "/littlefs/commands.json";
+
+// Commands file: a record file (see RecordFile.hpp) with one record per
+// command. The fields are stored in the order of kRecordFields, a record
+// starts with their number so fields appended in a later version can be left
+// out by older firmware.
+constexpr uint8_t kRecordMagic[4] = {'E', 'B', 'C', 'R'};
+
+// Journal file: a record file as well, each record starts with the
+// operation. Insert is followed by the command fields, Remove by the key.
+// It is compacted into the commands file when it grows beyond
+// kJournalMaxSize.
+constexpr uint8_t kJournalMagic[4] = {'E', 'B', 'C', 'J'};
+constexpr int64_t kJournalMaxSize = 16 * 1024;
+
+enum class JournalOp : uint8_t { Insert = 1, Remove = 2 };
+
+enum class RecordType : uint8_t {
+  Bool,
+  Uint8,
+  Uint32,
+  Int32,
+  Float,
+  String,  // 16 bit length and text
+  Bytes,   // 8 bit length and bytes, shown as hex string in json
+  Map      // 16 bit count of 32 bit keys and strings
+};
+
+struct RecordField {
+  const char* name;
+  RecordType type;
+};
+
+constexpr RecordField kRecordFields[] = {
+    // Command Fields
+    {"key", RecordType::String},
+    {"name", RecordType::String},
+    {"read_cmd", RecordType::Bytes},
+    {"write_cmd", RecordType::Bytes},
+    {"active", RecordType::Bool},
+    {"interval", RecordType::Uint32},
+    {"adaptive", RecordType::Bool},
+    {"min_interval", RecordType::Uint32},
+    {"max_interval", RecordType::Uint32},
+    // Data Fields
+    {"master", RecordType::Bool},
+    {"position", RecordType::Uint32},
+    {"datatype", RecordType::String},
+    {"divider", RecordType::Float},
+    {"min", RecordType::Float},
+    {"max", RecordType::Float},
+    {"digits", RecordType::Uint8},
+    {"unit", RecordType::String},
+    // Home Assistant
+    {"ha", RecordType::Bool},
+    {"ha_component", RecordType::String},
+    {"ha_device_class", RecordType::String},
+    {"ha_entity_category", RecordType::String},
+    {"ha_mode", RecordType::String},
+    {"ha_key_value_map", RecordType::Map},
+    {"ha_default_key", RecordType::Int32},
+    {"ha_payload_on", RecordType::Uint8},
+    {"ha_payload_off", RecordType::Uint8},
+    {"ha_state_class", RecordType::String},
+    {"ha_step", RecordType::Float},
+    // Added later, older records end before them
+    {"deadband", RecordType::Float},
+    {"adaptive_limits", RecordType::Bool}};
+
+constexpr size_t kRecordFieldCount =
+    sizeof(kRecordFields) / sizeof(kRecordFields[0]);
 
 bool ensureLittlefsMounted() {
   static bool mounted = false;
@@ -39,13 +115,6 @@ bool ensureLittlefsMounted() {
   return false;
 }
 
-std::string printJson(cJSON* node, const char* fallback) {
-  char* printed = cJSON_PrintUnformatted(node);
-  std::string out = printed != nullptr ? printed : fallback;
-  if (printed != nullptr) cJSON_free(printed);
-  return out;
-}
-
 std::string formatDouble(double value, int precision) {
   char buffer[64];
   std::snprintf(buffer, sizeof(buffer), "%.*f", precision, value);
@@ -55,17 +124,156 @@ std::string formatDouble(double value, int precision) {
   return s.empty() ? "0" : s;
 }
 
-std::string jsonValueToString(cJSON* value) {
-  if (cJSON_IsString(value) && value->valuestring != nullptr)
-    return value->valuestring;
-  if (cJSON_IsBool(value)) return cJSON_IsTrue(value) ? "true" : "false";
-  if (cJSON_IsNumber(value)) {
-    return formatDouble(value->valuedouble, 6);
+std::string valueToString(const Command* command) {
+  if (command->getNumeric()) return formatDouble(command->getValue(), 6);
+  return command->getText();
+}
+
+uint32_t nowMillis() { return (uint32_t)(esp_timer_get_time() / 1000ULL); }
+
+bool keyBefore(const Command* command, const std::string& key) {
+  return command->getKey() < key;
+}
+
+// Compare due times across the wraparound of the millisecond counter
+bool dueBefore(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+
+// Commands that were never read are due immediately
+uint32_t dueTime(const Command* command, uint32_t now) {
+  if (command->getLast() == 0) return now;
+  // keep the distance below the half range of the wraparound comparison
+  uint64_t interval =
+      static_cast<uint64_t>(command->getCurrentInterval()) * 1000;
+  return command->getLast() +
+         static_cast<uint32_t>(std::min<uint64_t>(interval, INT32_MAX));
+}
+
+// Writes the fields in the order of kRecordFields
+void encodeRecord(const Command& command, std::string& out) {
+  RecordWriter record(out);
+  record.u8(kRecordFieldCount);
+
+  // Command Fields
+  record.string(command.getKey());
+  record.string(command.getName());
+  record.bytes(command.getReadCmd());
+  record.bytes(command.getWriteCmd());
+  record.u8(command.getActive());
+  record.u32(command.getInterval());
+  record.u8(command.getAdaptive());
+  record.u32(command.getMinInterval());
+  record.u32(command.getMaxInterval());
+
+  // Data Fields
+  record.u8(command.getMaster());
+  record.u32(static_cast<uint32_t>(command.getPosition()));
+  record.string(ebus::datatype_2_string(command.getDatatype()));
+  record.f32(command.getDivider());
+  record.f32(command.getMin());
+  record.f32(command.getMax());
+  record.u8(command.getDigits());
+  record.string(command.getUnit());
+
+  // Home Assistant
+  record.u8(command.getHA());
+  record.string(command.getHAComponent());
+  record.string(command.getHADeviceClass());
+  record.string(command.getHAEntityCategory());
+  record.string(command.getHAMode());
+  const std::map<int, std::string>& map = command.getHAKeyValueMap();
+  const size_t entries = std::min<size_t>(map.size(), UINT16_MAX);
+  record.u16(static_cast<uint16_t>(entries));
+  auto entry = map.begin();
+  for (size_t i = 0; i < entries; ++i, ++entry) {
+    record.u32(static_cast<uint32_t>(entry->first));
+    record.string(entry->second);
+  }
+  record.u32(static_cast<uint32_t>(command.getHADefaultKey()));
+  record.u8(command.getHAPayloadOn());
+  record.u8(command.getHAPayloadOff());
+  record.string(command.getHAStateClass());
+  record.f32(command.getHAStep());
+
+  record.f32(command.getDeadband());
+  record.u8(command.getAdaptiveLimits());
+}
+
+// Returns the record as json document for Command::evaluate and fromJson, so
+// stored commands are checked the same way as new ones
+cJSON* decodeRecord(const uint8_t* data, size_t size) {
+  RecordReader record(data, size);
+  const size_t count = std::min<size_t>(record.u8(), kRecordFieldCount);
+
+  cJSON* doc = cJSON_CreateObject();
+  for (size_t i = 0; i < count && record.valid(); ++i) {
+    const RecordField& field = kRecordFields[i];
+    cJSON* item = nullptr;
+    switch (field.type) {
+      case RecordType::Bool:
+        item = cJSON_CreateBool(record.u8() != 0);
+        break;
+      case RecordType::Uint8:
+        item = cJSON_CreateNumber(record.u8());
+        break;
+      case RecordType::Uint32:
+        item = cJSON_CreateNumber(record.u32());
+        break;
+      case RecordType::Int32:
+        item = cJSON_CreateNumber(static_cast<int32_t>(record.u32()));
+        break;
+      case RecordType::Float:
+        item = cJSON_CreateNumber(record.f32());
+        break;
+      case RecordType::String:
+        item = cJSON_CreateString(record.string().c_str());
+        break;
+      case RecordType::Bytes:
+        item = cJSON_CreateString(ebus::to_string(record.bytes()).c_str());
+        break;
+      case RecordType::Map: {
+        item = cJSON_CreateObject();
+        const uint16_t entries = record.u16();
+        for (uint16_t j = 0; j < entries && record.valid(); ++j) {
+          const int32_t key = static_cast<int32_t>(record.u32());
+          cJSON_AddStringToObject(item, std::to_string(key).c_str(),
+                                  record.string().c_str());
+        }
+        break;
+      }
+    }
+    cJSON_AddItemToObject(doc, field.name, item);
+  }
+
+  if (!record.valid()) {
+    cJSON_Delete(doc);
+    return nullptr;
   }
-  return printJson(value, "null");
+  return doc;
+}
+
+// Returns the size of the removed file, 0 when there was none
+int64_t removeFile(const char* path) {
+  struct stat fileStat {};
+  if (stat(path, &fileStat) != 0) {
+    if (errno == ENOENT) return 0;
+    return -1;
+  }
+
+  if (std::remove(path) != 0) {
+    if (errno == ENOENT) return 0;
+    return -1;
+  }
+
+  if (fileStat.st_size <= 0) {
+    return 0;
+  }
+
+  return static_cast<int64_t>(fileStat.st_size);
 }
 }  // namespace
 
+Store::Store() { commandsMutex = xSemaphoreCreateMutex(); }
+
 bool Store::initFileSystem() { return ensureLittlefsMounted(); }
 
 void Store::setDataUpdatedCallback(DataUpdatedCallback callback) {
@@ -77,333 +285,668 @@ void Store::setDataUpdatedLogCallback(DataUpdatedLogCallback callback) {
 }
 
 void Store::insertCommand(const Command& command) {
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  Command* inserted = addCommand(command);
+  if (inserted->getActive())
+    scheduleCommand(inserted, dueTime(inserted, nowMillis()));
+  xSemaphoreGive(commandsMutex);
+
+  if (autoPersist) {
+    std::string record(1, static_cast<char>(JournalOp::Insert));
+    encodeRecord(command, record);
+    appendJournal(record);
+  }
+}
+
+Command* Store::addCommand(const Command& command) {
   // Insert or update in commands map
   auto it = commands.find(command.getKey());
-  if (it != commands.end())
+  if (it != commands.end()) {
+    unscheduleCommand(&it->second);
+    unindexCommand(&it->second);
     it->second = command;
-  else
-    commands.insert(std::make_pair(command.getKey(), command));
+    it->second.setDueIndex(SIZE_MAX);
+  } else {
+    it = commands.insert(std::make_pair(command.getKey(), command)).first;
+    orderedCommands.insert(
+        std::lower_bound(orderedCommands.begin(), orderedCommands.end(),
+                         it->first, keyBefore),
+        &it->second);
+  }
+  indexCommand(&it->second);
+  return &it->second;
 }
 
 void Store::removeCommand(const std::string& key) {
+  if (!eraseCommand(key)) return;
+
+  if (autoPersist) {
+    std::string record(1, static_cast<char>(JournalOp::Remove));
+    RecordWriter(record).string(key);
+    appendJournal(record);
+  }
+}
+
+void Store::loadCommand(const cJSON* doc) {
+  if (!Command::evaluate(doc).empty()) return;
+
+  const Command command = Command::fromJson(doc);
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  addCommand(command);
+  xSemaphoreGive(commandsMutex);
+}
+
+bool Store::eraseCommand(const std::string& key) {
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
   auto it = commands.find(key);
-  if (it != commands.end()) commands.erase(it);
+  if (it == commands.end()) {
+    xSemaphoreGive(commandsMutex);
+    return false;
+  }
+
+  unscheduleCommand(&it->second);
+  unindexCommand(&it->second);
+  auto ordered = std::lower_bound(orderedCommands.begin(),
+                                  orderedCommands.end(), it->first, keyBefore);
+  if (ordered != orderedCommands.end() && *ordered == &it->second)
+    orderedCommands.erase(ordered);
+  commands.erase(it);
+  xSemaphoreGive(commandsMutex);
+  return true;
 }
 
 Command* Store::findCommand(const std::string& key) {
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
   auto it = commands.find(key);
-  if (it != commands.end())
-    return &(it->second);
-  else
-    return nullptr;
+  Command* command = it != commands.end() ? &it->second : nullptr;
+  xSemaphoreGive(commandsMutex);
+  return command;
 }
 
 int64_t Store::loadCommands() {
   if (!ensureLittlefsMounted()) return -1;
 
+  int64_t snapshot = loadSnapshot();
+  int64_t journal = replayJournal();
+  rebuildDueCommands();
+
+  if (snapshot < 0 || journal < 0) return -1;
+  return snapshot + journal;
+}
+
+int64_t Store::saveCommands() {
+  if (!ensureLittlefsMounted()) return -1;
+
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  const bool empty = commands.empty();
+  xSemaphoreGive(commandsMutex);
+  if (empty && journalBytes == 0) return 0;
+
+  return compactCommands();
+}
+
+int64_t Store::wipeCommands() {
+  if (!ensureLittlefsMounted()) return -1;
+
+  int64_t records = removeFile(kCommandsFilePath);
+  int64_t journal = removeFile(kJournalFilePath);
+  int64_t legacy = removeFile(kLegacyCommandsFilePath);
+  if (journal >= 0) journalBytes = 0;
+  if (records < 0 || journal < 0 || legacy < 0) return -1;
+
+  return records + journal + legacy;
+}
+
+void Store::setAutoPersist(bool enable) { autoPersist = enable; }
+
+int64_t Store::getJournalBytes() const { return journalBytes; }
+
+int64_t Store::loadSnapshot() {
   FILE* file = std::fopen(kCommandsFilePath, "rb");
   if (file == nullptr) {
-    if (errno == ENOENT) return 0;
+    // nothing saved in the record format yet, try the former json file
+    if (errno == ENOENT) return loadLegacyCommands();
     return -1;
   }
 
-  if (std::fseek(file, 0, SEEK_END) != 0) {
-    std::fclose(file);
-    return -1;
-  }
+  int64_t bytes = 0;
+  RecordRead result = readRecords(
+      file, kRecordMagic,
+      [this](const std::vector<uint8_t>& record) {
+        cJSON* doc = decodeRecord(record.data(), record.size());
+        if (doc == nullptr) return;
+        loadCommand(doc);
+        cJSON_Delete(doc);
+      },
+      bytes);
 
-  long size = std::ftell(file);
-  if (size <= 2) {
-    std::fclose(file);
-    return 0;
-  }
+  std::fclose(file);
+  return result == RecordRead::End ? bytes : -1;
+}
 
-  if (size <= 0 || std::fseek(file, 0, SEEK_SET) != 0) {
-    std::fclose(file);
-    return -1;
-  }
+int64_t Store::writeSnapshot() const {
+  // Write a new file and replace the old one only when it is complete, so a
+  // reset while saving keeps the previous commands
+  FILE* file = std::fopen(kCommandsTempPath, "wb");
+  if (file == nullptr) return -1;
 
-  std::string payload;
-  payload.resize(static_cast<size_t>(size));
-  size_t bytesRead = std::fread(payload.data(), 1, payload.size(), file);
-  std::fclose(file);
-  if (bytesRead != payload.size()) return -1;
+  bool written = writeRecordHeader(file, kRecordMagic);
+  int64_t bytes = kRecordHeaderSize;
 
-  deserializeCommands(payload.c_str());
-  return static_cast<int64_t>(payload.size());
-}
+  // Each command is copied under the lock and written without it, like the
+  // json lists, so the file system does not hold up the other tasks
+  const std::vector<std::string> keys = copyKeys();
+  Command command;
+  std::string record;
+  for (const std::string& key : keys) {
+    if (!written) break;
+    if (!copyCommand(key, command)) continue;
 
-int64_t Store::saveCommands() const {
-  if (!ensureLittlefsMounted()) return -1;
+    record.clear();
+    encodeRecord(command, record);
+    if (record.size() > kRecordMaxSize) continue;
 
-  std::string payload = serializeCommands();
-  size_t size = payload.size();
-  if (size <= 2) {  // 2 = empty json array "[]"
-    return 0;
+    written = writeRecord(file, record);
+    bytes += kRecordFrameSize + record.size();
   }
 
-  FILE* file = std::fopen(kCommandsFilePath, "wb");
-  if (file == nullptr) return -1;
+  if (std::fclose(file) != 0) written = false;
+  if (!written || std::rename(kCommandsTempPath, kCommandsFilePath) != 0) {
+    std::remove(kCommandsTempPath);
+    return -1;
+  }
 
-  size_t bytesWritten = std::fwrite(payload.data(), 1, size, file);
-  std::fclose(file);
-  if (bytesWritten != size) return -1;
+  return bytes;
+}
+
+int64_t Store::compactCommands() {
+  int64_t bytes = writeSnapshot();
+  if (bytes < 0) return -1;
 
-  return static_cast<int64_t>(size);
+  // the snapshot holds every change, the journal and the former json file
+  // are no longer needed
+  if (removeFile(kJournalFilePath) < 0) return -1;
+  journalBytes = 0;
+  std::remove(kLegacyCommandsFilePath);
+  return bytes;
 }
 
-int64_t Store::wipeCommands() {
-  if (!ensureLittlefsMounted()) return -1;
+int64_t Store::replayJournal() {
+  journalBytes = 0;
 
-  struct stat fileStat {};
-  if (stat(kCommandsFilePath, &fileStat) != 0) {
+  FILE* file = std::fopen(kJournalFilePath, "rb");
+  if (file == nullptr) {
     if (errno == ENOENT) return 0;
     return -1;
   }
 
-  if (std::remove(kCommandsFilePath) != 0) {
-    if (errno == ENOENT) return 0;
-    return -1;
-  }
+  int64_t bytes = 0;
+  RecordRead result = readRecords(
+      file, kJournalMagic,
+      [this](const std::vector<uint8_t>& record) {
+        if (record.empty()) return;
+        switch (static_cast<JournalOp>(record[0])) {
+          case JournalOp::Insert: {
+            cJSON* doc = decodeRecord(record.data() + 1, record.size() - 1);
+            if (doc == nullptr) break;
+            loadCommand(doc);
+            cJSON_Delete(doc);
+            break;
+          }
+          case JournalOp::Remove: {
+            RecordReader reader(record.data() + 1, record.size() - 1);
+            std::string key = reader.string();
+            if (reader.valid()) eraseCommand(key);
+            break;
+          }
+        }
+      },
+      bytes);
+  std::fclose(file);
 
-  if (fileStat.st_size <= 0) {
-    return 0;
-  }
+  // A reset while appending leaves a torn record at the end. The records
+  // before it are applied, a new snapshot drops the rest, so later appends
+  // do not end up behind it.
+  if (result != RecordRead::End) return compactCommands() < 0 ? -1 : bytes;
 
-  return static_cast<int64_t>(fileStat.st_size);
+  journalBytes = bytes;
+  return bytes;
 }
 
-const std::string Store::getCommandsJson() const {
-  cJSON* root = cJSON_CreateArray();
+void Store::appendJournal(const std::string& record) {
+  if (record.size() > kRecordMaxSize || !ensureLittlefsMounted()) return;
 
-  std::vector<std::pair<std::string, Command>> orderedCommands(commands.begin(),
-                                                               commands.end());
+  FILE* file = std::fopen(kJournalFilePath, "ab");
+  if (file == nullptr) return;
 
-  std::sort(orderedCommands.begin(), orderedCommands.end(),
-            [](const std::pair<std::string, Command>& a,
-               const std::pair<std::string, Command>& b) {
-              // Compare based on keys
-              return a.first < b.first;
-            });
+  const bool created = journalBytes == 0;
+  bool written = !created || writeRecordHeader(file, kJournalMagic);
+  written = written && writeRecord(file, record);
+  if (std::fclose(file) != 0) written = false;
 
-  for (const auto& kv : orderedCommands) {
-    cJSON* cmd = cJSON_Parse(kv.second.toJson().c_str());
-    if (cmd != nullptr) cJSON_AddItemToArray(root, cmd);
+  // a partly written record would end the replay, start from a snapshot
+  if (!written) {
+    compactCommands();
+    return;
   }
 
-  std::string payload = printJson(root, "[]");
-  cJSON_Delete(root);
+  journalBytes +=
+      (created ? kRecordHeaderSize : 0) + kRecordFrameSize + record.size();
+  if (journalBytes > kJournalMaxSize) compactCommands();
+}
+
+void Store::writeCommandsJson(JsonWriter& json) const {
+  // Only the keys are copied, each command is fetched when it is written
+  const std::vector<std::string> keys = copyKeys();
+
+  json.beginArray();
+  Command command;
+  for (const std::string& key : keys) {
+    if (copyCommand(key, command)) command.writeJson(json);
+  }
+  json.endArray();
+}
+
+const std::string Store::getCommandsJson() const {
+  std::string payload;
+  JsonWriter json(payload);
+  writeCommandsJson(json);
   return payload;
 }
 
 const std::vector<Command*> Store::getCommands() {
   std::vector<Command*> result;
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  result.reserve(commands.size());
   for (auto& kv : commands) result.push_back(&(kv.second));
+  xSemaphoreGive(commandsMutex);
   return result;
 }
 
 size_t Store::getActiveCommands() const {
   size_t count = 0;
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
   for (const auto& kv : commands) {
     if (kv.second.getActive()) count++;
   }
+  xSemaphoreGive(commandsMutex);
   return count;
 }
 
 size_t Store::getPassiveCommands() const {
   size_t count = 0;
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
   for (const auto& kv : commands) {
     if (!kv.second.getActive()) count++;
   }
+  xSemaphoreGive(commandsMutex);
   return count;
 }
 
-bool Store::active() const {
+size_t Store::getCommandsHeap() const {
+  static const size_t inlineCapacity = std::string().capacity();
+
+  // map nodes hold the key and command pair, a link and the cached hash
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  size_t bytes = commands.bucket_count() * sizeof(void*);
   for (const auto& kv : commands) {
-    if (kv.second.getActive()) return true;
+    bytes += sizeof(kv) + 2 * sizeof(void*) + kv.second.heapUsage();
+    if (kv.first.capacity() > inlineCapacity) bytes += kv.first.capacity() + 1;
   }
-  return false;
+
+  bytes += dueCommands.capacity() * sizeof(DueCommand);
+  bytes += passiveIndex.heapUsage();
+  xSemaphoreGive(commandsMutex);
+  return bytes;
 }
 
-Command* Store::nextActiveCommand() {
+bool Store::active() const {
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  bool scheduled = !dueCommands.empty();
+  xSemaphoreGive(commandsMutex);
+  return scheduled;
+}
+
+Command* Store::nextActiveCommand(uint32_t horizon, const Command* skip) {
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
   Command* next = nullptr;
-  bool init = false;
-  for (auto& kv : commands) {
-    Command* cmd = &kv.second;
-    // Only consider active commands
-    if (!cmd->getActive()) continue;
-    if (cmd->getLast() == 0) {
-      next = cmd;
-      init = true;
-      break;
+  if (!dueCommands.empty()) {
+    // An overdue command that keeps failing must not drift out of the range
+    // of the wraparound comparison, pull it up to now
+    uint32_t now = nowMillis();
+    if (dueCommands.front().command != skip &&
+        dueBefore(dueCommands.front().due, now)) {
+      dueCommands.front().due = now;
+      siftDown(0);
     }
-    if (next == nullptr || (cmd->getLast() + cmd->getInterval() * 1000 <
-                            next->getLast() + next->getInterval() * 1000))
-      next = cmd;
-  }
 
-  if (!init && next &&
-      (uint32_t)(esp_timer_get_time() / 1000ULL) <
-          next->getLast() + next->getInterval() * 1000)
-    next = nullptr;
+    // The second earliest command is one of the children of the first
+    size_t index = 0;
+    if (dueCommands.front().command == skip) {
+      index = 1;
+      if (dueCommands.size() > 2 &&
+          dueBefore(dueCommands[2].due, dueCommands[1].due))
+        index = 2;
+    }
 
+    if (index < dueCommands.size() &&
+        !dueBefore(now + horizon, dueCommands[index].due))
+      next = dueCommands[index].command;
+  }
+  xSemaphoreGive(commandsMutex);
   return next;
 }
 
-std::vector<Command*> Store::findPassiveCommands(
-    const std::vector<uint8_t>& master) {
-  std::vector<Command*> result;
+uint32_t Store::nextActiveDelay() const {
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  uint32_t delay = UINT32_MAX;
+  if (!dueCommands.empty()) {
+    uint32_t now = nowMillis();
+    uint32_t due = dueCommands.front().due;
+    delay = dueBefore(now, due) ? due - now : 0;
+  }
+  xSemaphoreGive(commandsMutex);
+  return delay;
+}
+
+void Store::refreshCommand(Command* command) {
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  command->setLast(0);
+  if (command->getActive()) rescheduleCommand(command, nowMillis());
+  xSemaphoreGive(commandsMutex);
+}
+
+void Store::rebuildDueCommands() {
+  // the schedule task takes commands from the heap while it is rebuilt by
+  // the task that loads the commands
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  uint32_t now = nowMillis();
+  dueCommands.clear();
   for (auto& kv : commands) {
     Command* cmd = &kv.second;
-    // Skip active commands
-    if (cmd->getActive()) continue;
-    if (ebus::contains(master, cmd->getReadCmd())) {
-      result.push_back(cmd);
+    if (cmd->getActive()) {
+      cmd->setDueIndex(dueCommands.size());
+      dueCommands.push_back({dueTime(cmd, now), cmd});
+    } else {
+      cmd->setDueIndex(SIZE_MAX);
     }
   }
-  return result;
+  for (size_t i = dueCommands.size() / 2; i-- > 0;) siftDown(i);
+  xSemaphoreGive(commandsMutex);
 }
 
-std::vector<Command*> Store::updateData(Command* command,
-                                        const std::vector<uint8_t>& master,
-                                        const std::vector<uint8_t>& slave) {
-  auto update = [this](Command* cmd, const std::vector<uint8_t>& master,
-                       const std::vector<uint8_t>& slave) {
-    cmd->setLast((uint32_t)(esp_timer_get_time() / 1000ULL));
-    if (cmd->getMaster())
-      cmd->setData(
-          ebus::range(master, 4 + cmd->getPosition(), cmd->getLength()));
-    else
-      cmd->setData(ebus::range(slave, cmd->getPosition(), cmd->getLength()));
+void Store::scheduleCommand(Command* command, uint32_t due) {
+  command->setDueIndex(dueCommands.size());
+  dueCommands.push_back({due, command});
+  siftUp(dueCommands.size() - 1);
+}
+
+void Store::unscheduleCommand(Command* command) {
+  size_t index = command->getDueIndex();
+  if (index >= dueCommands.size() || dueCommands[index].command != command)
+    return;
+  command->setDueIndex(SIZE_MAX);
+
+  // the last entry takes the free place and moves to where it belongs
+  uint32_t previous = dueCommands[index].due;
+  dueCommands[index] = dueCommands.back();
+  dueCommands.pop_back();
+  if (index == dueCommands.size()) return;
 
-    std::string valueJson = cmd->getValueJson();
-    if (dataUpdatedCallback) dataUpdatedCallback(cmd->getName(), valueJson);
+  dueCommands[index].command->setDueIndex(index);
+  if (dueBefore(dueCommands[index].due, previous))
+    siftUp(index);
+  else
+    siftDown(index);
+}
 
-    cJSON* valueDoc = cJSON_Parse(valueJson.c_str());
-    cJSON* valueNode = valueDoc
-                           ? cJSON_GetObjectItemCaseSensitive(valueDoc, "value")
-                           : nullptr;
+void Store::rescheduleCommand(Command* command, uint32_t due) {
+  size_t index = command->getDueIndex();
+  if (index >= dueCommands.size() || dueCommands[index].command != command)
+    return;
 
-    std::string payload = " '" + ebus::to_string(cmd->getReadCmd()) + "' [" +
-                          cmd->getName() + "] " +
-                          ebus::to_string(cmd->getData()) + " -> " +
-                          jsonValueToString(valueNode) + " " + cmd->getUnit();
+  uint32_t previous = dueCommands[index].due;
+  dueCommands[index].due = due;
+  if (dueBefore(due, previous))
+    siftUp(index);
+  else
+    siftDown(index);
+}
+
+void Store::siftUp(size_t index) {
+  while (index > 0) {
+    size_t parent = (index - 1) / 2;
+    if (!dueBefore(dueCommands[index].due, dueCommands[parent].due)) break;
+    swapDueCommands(index, parent);
+    index = parent;
+  }
+}
+
+void Store::siftDown(size_t index) {
+  size_t size = dueCommands.size();
+  for (;;) {
+    size_t smallest = index;
+    size_t left = 2 * index + 1;
+    size_t right = left + 1;
+    if (left < size &&
+        dueBefore(dueCommands[left].due, dueCommands[smallest].due))
+      smallest = left;
+    if (right < size &&
+        dueBefore(dueCommands[right].due, dueCommands[smallest].due))
+      smallest = right;
+    if (smallest == index) break;
+    swapDueCommands(index, smallest);
+    index = smallest;
+  }
+}
 
-    if (valueDoc) cJSON_Delete(valueDoc);
+void Store::swapDueCommands(size_t a, size_t b) {
+  std::swap(dueCommands[a], dueCommands[b]);
+  dueCommands[a].command->setDueIndex(a);
+  dueCommands[b].command->setDueIndex(b);
+}
+
+void Store::indexCommand(Command* command) {
+  // Active commands are not matched against passive telegrams
+  if (command->getActive()) return;
+
+  passiveIndex.insert(command, command->getReadCmd());
+}
+
+void Store::unindexCommand(Command* command) {
+  if (command->getActive()) return;
+  passiveIndex.erase(command, command->getReadCmd());
+}
+
+size_t Store::findPassiveCommands(const std::vector<uint8_t>& master,
+                                  Command** matches, size_t capacity,
+                                  std::vector<Command*>& more) {
+  size_t count = 0;
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  passiveIndex.find(master, [&](Command* cmd) {
+    if (!ebus::contains(master, cmd->getReadCmd())) return;
+    if (count < capacity)
+      matches[count] = cmd;
+    else
+      more.push_back(cmd);
+    count++;
+  });
+  xSemaphoreGive(commandsMutex);
+  return count;
+}
+
+size_t Store::updateData(Command* command, const std::vector<uint8_t>& master,
+                         const std::vector<uint8_t>& slave) {
+  auto update = [this](Command* cmd, const std::vector<uint8_t>& master,
+                       const std::vector<uint8_t>& slave) {
+    std::vector<uint8_t> data =
+        cmd->getMaster()
+            ? ebus::range(master, 4 + cmd->getPosition(), cmd->getLength())
+            : ebus::range(slave, cmd->getPosition(), cmd->getLength());
 
-    if (dataUpdatedLogCallback) dataUpdatedLogCallback(payload);
+    // The first value of an active command gives no change rate yet
+    xSemaphoreTake(commandsMutex, portMAX_DELAY);
+    cmd->setLast((uint32_t)(esp_timer_get_time() / 1000ULL));
+    bool first = cmd->getData().empty();
+    bool changed = data != cmd->getData();
+    cmd->setData(data);
+    if (cmd->getActive() && !first) cmd->adaptInterval(changed);
+    xSemaphoreGive(commandsMutex);
+
+    valuesUpdated++;
+    if (dataUpdatedCallback &&
+        cmd->publishDue(cmd->getLast(), publishOnChange, publishInterval) &&
+        dataUpdatedCallback(cmd)) {
+      cmd->setPublished(cmd->getLast());
+      valuesPublished++;
+    }
+
+    if (dataUpdatedLogCallback) {
+      std::string payload = " '" + ebus::to_string(cmd->getReadCmd()) +
+                            "' [" + cmd->getName() + "] " +
+                            ebus::to_string(cmd->getData()) + " -> " +
+                            valueToString(cmd) + " " + cmd->getUnit();
+      dataUpdatedLogCallback(payload);
+    }
   };
 
   if (command) {
     update(command, master, slave);
-    // Return a vector with just this command, but avoid heap allocation
-    return {command};
+    if (command->getActive()) {
+      xSemaphoreTake(commandsMutex, portMAX_DELAY);
+      rescheduleCommand(command, dueTime(command, command->getLast()));
+      xSemaphoreGive(commandsMutex);
+    }
+    return 1;
   }
 
-  // Passive: potentially multiple matches
-  std::vector<Command*> passiveCommands = findPassiveCommands(master);
-  for (Command* cmd : passiveCommands) update(cmd, master, slave);
+  // Passive: potentially multiple matches, the vector only allocates for
+  // telegrams that match more commands than the array holds
+  Command* matches[maxPassiveMatches];
+  std::vector<Command*> more;
+  size_t count = findPassiveCommands(master, matches, maxPassiveMatches, more);
+  for (size_t i = 0; i < count && i < maxPassiveMatches; ++i)
+    update(matches[i], master, slave);
+  for (Command* cmd : more) update(cmd, master, slave);
 
-  return passiveCommands;
+  return count;
 }
 
-const std::string Store::getValueFullJson(const Command* command) {
-  cJSON* doc = cJSON_CreateObject();
+void Store::setPublishOnChange(const bool enable) { publishOnChange = enable; }
 
-  cJSON_AddStringToObject(doc, "key", command->getKey().c_str());
-  cJSON_AddStringToObject(doc, "name", command->getName().c_str());
+void Store::setPublishInterval(const uint32_t seconds) {
+  publishInterval = seconds * 1000;
+}
 
-  cJSON* valueDoc = cJSON_Parse(command->getValueJson().c_str());
-  cJSON* valueNode =
-      valueDoc ? cJSON_GetObjectItemCaseSensitive(valueDoc, "value") : nullptr;
-  if (valueNode) {
-    cJSON_AddItemToObject(doc, "value", cJSON_Duplicate(valueNode, 1));
-  } else {
-    cJSON_AddNullToObject(doc, "value");
-  }
-  if (valueDoc) cJSON_Delete(valueDoc);
+uint32_t Store::getValuesUpdated() const { return valuesUpdated; }
 
-  cJSON_AddStringToObject(doc, "unit", command->getUnit().c_str());
-  cJSON_AddNumberToObject(
-      doc, "age",
-      static_cast<uint32_t>(
-          ((uint32_t)(esp_timer_get_time() / 1000ULL) - command->getLast()) /
-          1000));
-  cJSON_AddBoolToObject(doc, "write", !command->getWriteCmd().empty());
-  cJSON_AddBoolToObject(doc, "active", command->getActive());
+uint32_t Store::getValuesPublished() const { return valuesPublished; }
 
-  std::string payload = printJson(doc, "{}");
-  cJSON_Delete(doc);
-  return payload;
+void Store::resetValueCounter() {
+  valuesUpdated = 0;
+  valuesPublished = 0;
 }
 
-const std::string Store::getValuesJson() const {
-  cJSON* root = cJSON_CreateArray();
+void Store::writeValueFull(JsonWriter& json, const Command* command) {
+  json.beginObject();
+  json.key("key");
+  json.value(command->getKey());
+  json.key("name");
+  json.value(command->getName());
+  json.key("value");
+  command->writeValue(json);
+  json.key("unit");
+  json.value(command->getUnit());
+  json.key("age");
+  json.value(static_cast<uint32_t>(
+      ((uint32_t)(esp_timer_get_time() / 1000ULL) - command->getLast()) /
+      1000));
+  json.key("write");
+  json.value(!command->getWriteCmd().empty());
+  json.key("active");
+  json.value(command->getActive());
+  if (command->getActive()) {
+    json.key("interval");
+    json.value(command->getCurrentInterval());
+  }
+  json.endObject();
+}
 
-  std::vector<std::pair<std::string, Command>> orderedCommands(commands.begin(),
-                                                               commands.end());
+const std::string Store::getValueFullJson(const Command* command) {
+  std::string payload;
+  JsonWriter json(payload);
+  writeValueFull(json, command);
+  return payload;
+}
 
-  std::sort(orderedCommands.begin(), orderedCommands.end(),
-            [](const std::pair<std::string, Command>& a,
-               const std::pair<std::string, Command>& b) {
-              return a.first < b.first;
-            });
+void Store::writeValuesJson(JsonWriter& json) const {
+  const std::vector<std::string> keys = copyKeys();
 
-  for (const auto& kv : orderedCommands) {
-    cJSON* value = cJSON_Parse(getValueFullJson(&kv.second).c_str());
-    if (value != nullptr) cJSON_AddItemToArray(root, value);
+  json.beginArray();
+  Command command;
+  for (const std::string& key : keys) {
+    if (copyCommand(key, command)) writeValueFull(json, &command);
   }
+  json.endArray();
+}
+
+std::vector<std::string> Store::copyKeys() const {
+  std::vector<std::string> keys;
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  keys.reserve(orderedCommands.size());
+  for (const Command* command : orderedCommands)
+    keys.push_back(command->getKey());
+  xSemaphoreGive(commandsMutex);
+  return keys;
+}
+
+bool Store::copyCommand(const std::string& key, Command& command) const {
+  xSemaphoreTake(commandsMutex, portMAX_DELAY);
+  auto it = commands.find(key);
+  const bool found = it != commands.end();
+  if (found) command = it->second;
+  xSemaphoreGive(commandsMutex);
+  return found;
+}
 
-  std::string payload = printJson(root, "[]");
-  cJSON_Delete(root);
+const std::string Store::getValuesJson() const {
+  std::string payload;
+  JsonWriter json(payload);
+  writeValuesJson(json);
   return payload;
 }
 
-const std::string Store::serializeCommands() const {
-  cJSON* doc = cJSON_CreateArray();
-
-  // Define field names (order matters)
-  std::vector<std::string> fields = {
-      // Command Fields
-      "key", "name", "read_cmd", "write_cmd", "active", "interval",
-      // Data Fields
-      "master", "position", "datatype", "divider", "min", "max", "digits",
-      "unit",
-      // Home Assistant
-      "ha", "ha_component", "ha_device_class", "ha_entity_category", "ha_mode",
-      "ha_key_value_map", "ha_default_key", "ha_payload_on", "ha_payload_off",
-      "ha_state_class", "ha_step"};
-
-  // Add header as first entry
-  cJSON* header = cJSON_CreateArray();
-  for (const auto& field : fields)
-    cJSON_AddItemToArray(header, cJSON_CreateString(field.c_str()));
-  cJSON_AddItemToArray(doc, header);
-
-  // Add each command as an array of values in the same order as header
-  for (const auto& cmd : commands) {
-    cJSON* cmdDoc = cJSON_Parse(cmd.second.toJson().c_str());
-    if (!cJSON_IsObject(cmdDoc)) {
-      if (cmdDoc) cJSON_Delete(cmdDoc);
-      continue;
-    }
+int64_t Store::loadLegacyCommands() {
+  FILE* file = std::fopen(kLegacyCommandsFilePath, "rb");
+  if (file == nullptr) {
+    if (errno == ENOENT) return 0;
+    return -1;
+  }
 
-    cJSON* row = cJSON_CreateArray();
-    for (const auto& field : fields) {
-      cJSON* item = cJSON_GetObjectItemCaseSensitive(cmdDoc, field.c_str());
-      if (item)
-        cJSON_AddItemToArray(row, cJSON_Duplicate(item, 1));
-      else
-        cJSON_AddItemToArray(row, cJSON_CreateNull());
-    }
+  if (std::fseek(file, 0, SEEK_END) != 0) {
+    std::fclose(file);
+    return -1;
+  }
 
-    cJSON_AddItemToArray(doc, row);
-    cJSON_Delete(cmdDoc);
+  long size = std::ftell(file);
+  if (size <= 2) {
+    std::fclose(file);
+    return 0;
   }
 
-  std::string payload = printJson(doc, "[]");
-  cJSON_Delete(doc);
-  return payload;
+  if (size <= 0 || std::fseek(file, 0, SEEK_SET) != 0) {
+    std::fclose(file);
+    return -1;
+  }
+
+  std::string payload;
+  payload.resize(static_cast<size_t>(size));
+  size_t bytesRead = std::fread(payload.data(), 1, payload.size(), file);
+  std::fclose(file);
+  if (bytesRead != payload.size()) return -1;
+
+  deserializeCommands(payload.c_str());
+  return static_cast<int64_t>(payload.size());
 }
 
 void Store::deserializeCommands(const char* payload) {
@@ -453,13 +996,12 @@ void Store::deserializeCommands(const char* payload) {
                             cJSON_Duplicate(valueItem, 1));
     }
 
-    std::string evalError = Command::evaluate(tmpDoc);
-    if (evalError.empty()) insertCommand(Command::fromJson(tmpDoc));
-
+    loadCommand(tmpDoc);
     cJSON_Delete(tmpDoc);
   }
 
   cJSON_Delete(doc);
+  rebuildDueCommands();
 }
 
 #endif
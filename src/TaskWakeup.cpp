@@ -0,0 +1,58 @@
+#include "TaskWakeup.hpp"
+
+#include <esp_timer.h>
+
+namespace {
+uint32_t nowMicros() { return (uint32_t)(esp_timer_get_time()); }
+}  // namespace
+
+void WakeLatency::signaled() {
+  if (pending.load(std::memory_order_acquire)) return;
+  signalTime.store(nowMicros(), std::memory_order_relaxed);
+  pending.store(true, std::memory_order_release);
+}
+
+void WakeLatency::woken() {
+  if (!pending.exchange(false, std::memory_order_acquire)) return;
+  const uint32_t latency =
+      nowMicros() - signalTime.load(std::memory_order_relaxed);
+  wakeups.fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(latency, std::memory_order_relaxed);
+  if (latency > longest.load(std::memory_order_relaxed))
+    longest.store(latency, std::memory_order_relaxed);
+}
+
+uint32_t WakeLatency::count() const { return wakeups.load(); }
+
+uint32_t WakeLatency::average() const {
+  const uint32_t n = wakeups.load();
+  return n > 0 ? total.load() / n : 0;
+}
+
+uint32_t WakeLatency::maximum() const { return longest.load(); }
+
+void WakeLatency::reset() {
+  wakeups = 0;
+  total = 0;
+  longest = 0;
+}
+
+void TaskWakeup::attach() { task = xTaskGetCurrentTaskHandle(); }
+
+void TaskWakeup::notify() {
+  // the task itself is awake and sees its new work before it waits again
+  TaskHandle_t handle = task.load();
+  if (handle == nullptr || handle == xTaskGetCurrentTaskHandle()) return;
+  stats.signaled();
+  xTaskNotifyGive(handle);
+}
+
+bool TaskWakeup::wait(TickType_t timeout) {
+  const bool notified = ulTaskNotifyTake(pdTRUE, timeout) > 0;
+  stats.woken();
+  return notified;
+}
+
+const WakeLatency& TaskWakeup::latency() const { return stats; }
+
+void TaskWakeup::resetLatency() { stats.reset(); }
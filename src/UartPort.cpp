@@ -1,6 +1,8 @@
 #include "UartPort.hpp"
 
+#include <esp_attr.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
 namespace {
 constexpr const char* kTag = "UartPort";
@@ -27,6 +29,10 @@ void UartPort::begin(int baud, uart_word_length_t dataBits, int rxPin,
   config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
   config.source_clk = UART_SCLK_DEFAULT;
   uart_param_config(port_, &config);
+
+  // start bit + data bits + stop bit, rounded up
+  const uint32_t frameBits = 1 + (5 + static_cast<uint32_t>(dataBits)) + 1;
+  symbolPeriod_ = (frameBits * 1000000 + baud - 1) / baud;
   if (rxPin >= 0 || txPin >= 0) {
     uart_set_pin(port_, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
   }
@@ -39,7 +45,9 @@ void UartPort::ensureInstalled(int baud, int rxPin, int txPin) {
   (void)txPin;
   int rxBuffer = static_cast<int>(rxBufferSize_);
   int txBuffer = 0;
-  if (uart_driver_install(port_, rxBuffer, txBuffer, 0, nullptr, 0) != ESP_OK) {
+  QueueHandle_t* queue = eventQueueSize_ > 0 ? &eventQueue_ : nullptr;
+  if (uart_driver_install(port_, rxBuffer, txBuffer, eventQueueSize_, queue,
+                          0) != ESP_OK) {
     ESP_LOGE(kTag, "uart_driver_install failed for port %d", port_);
   } else {
     installed_ = true;
@@ -47,9 +55,14 @@ void UartPort::ensureInstalled(int baud, int rxPin, int txPin) {
 }
 
 void UartPort::end() {
+  if (startBitPin_ >= 0) {
+    gpio_isr_handler_remove(static_cast<gpio_num_t>(startBitPin_));
+    startBitPin_ = -1;
+  }
   if (!installed_) return;
   uart_driver_delete(port_);
   installed_ = false;
+  eventQueue_ = nullptr;
 }
 
 int UartPort::available() {
@@ -84,6 +97,91 @@ int UartPort::peek() {
   return cachedByte_;
 }
 
+size_t UartPort::readBurst(uint8_t* symbols, uint32_t* timestamps,
+                           size_t maxSymbols, uint32_t rxTime) {
+  if (symbols == nullptr || maxSymbols == 0) return 0;
+
+  // taken together, so the start bits match the buffered symbols
+  const uint32_t recorded = startBitCount_.load(std::memory_order_acquire);
+  const uint32_t now = static_cast<uint32_t>(esp_timer_get_time());
+  size_t buffered = 0;
+  uart_get_buffered_data_len(port_, &buffered);
+
+  size_t count = 0;
+  if (cachedByte_ >= 0) {
+    symbols[count++] = static_cast<uint8_t>(cachedByte_);
+    cachedByte_ = -1;
+    buffered++;
+  }
+
+  if (count < maxSymbols) {
+    int read = uart_read_bytes(port_, symbols + count, maxSymbols - count, 0);
+    if (read > 0) count += static_cast<size_t>(read);
+  }
+
+  if (timestamps != nullptr) {
+    // symbols that stay buffered were received after the ones of this burst
+    const size_t later = buffered > count ? buffered - count : 0;
+    for (size_t i = 0; i < count; i++)
+      timestamps[i] =
+          rxTime - static_cast<uint32_t>(later + count - i) * symbolPeriod_;
+    if (startBitPin_ >= 0)
+      applyStartBits(timestamps, count, buffered, recorded, now);
+  }
+
+  return count;
+}
+
+// The newest start bits belong to the newest buffered symbols, unless the
+// newest one is of a symbol whose stop bit has not been received yet.
+void UartPort::applyStartBits(uint32_t* timestamps, size_t count,
+                              size_t buffered, uint32_t recorded,
+                              uint32_t now) {
+  if (recorded > 0 &&
+      now - startBits_[(recorded - 1) % START_BITS] < symbolPeriod_ * 19 / 20)
+    recorded--;
+  // overwritten or lost start bits, keep the reconstructed times
+  if (buffered < count || buffered > START_BITS || recorded < buffered) return;
+  const uint32_t first = recorded - static_cast<uint32_t>(buffered);
+  for (size_t i = 0; i < count; i++) {
+    const uint32_t startBit = startBits_[(first + i) % START_BITS];
+    // a symbol cannot start later than back to back before rxTime, otherwise
+    // an edge was missed and the start bits do not match
+    if (static_cast<int32_t>(timestamps[i] - startBit) < 0) return;
+  }
+  for (size_t i = 0; i < count; i++)
+    timestamps[i] = startBits_[(first + i) % START_BITS];
+}
+
+void IRAM_ATTR UartPort::rxEdge(void* arg) {
+  UartPort* self = static_cast<UartPort*>(arg);
+  const uint32_t now = static_cast<uint32_t>(esp_timer_get_time());
+  // the data bits fall within 9 bit times after the start bit, the next start
+  // bit comes after the stop bit
+  if (now - self->lastStartBit_ < self->symbolPeriod_ * 9 / 10) return;
+  self->lastStartBit_ = now;
+  const uint32_t count = self->startBitCount_.load(std::memory_order_relaxed);
+  self->startBits_[count % START_BITS] = now;
+  self->startBitCount_.store(count + 1, std::memory_order_release);
+}
+
+void UartPort::recordStartBits(int rxPin) {
+  const gpio_num_t pin = static_cast<gpio_num_t>(rxPin);
+  gpio_set_intr_type(pin, GPIO_INTR_NEGEDGE);
+  // already installed by another user is fine
+  esp_err_t result = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+  if (result != ESP_OK && result != ESP_ERR_INVALID_STATE) {
+    ESP_LOGE(kTag, "gpio_install_isr_service failed %d", result);
+    return;
+  }
+  if (gpio_isr_handler_add(pin, rxEdge, this) != ESP_OK) {
+    ESP_LOGE(kTag, "gpio_isr_handler_add failed for pin %d", rxPin);
+    return;
+  }
+  gpio_intr_enable(pin);
+  startBitPin_ = rxPin;
+}
+
 size_t UartPort::write(uint8_t byte) {
   int written = uart_write_bytes(port_, reinterpret_cast<const char*>(&byte), 1);
   return written > 0 ? static_cast<size_t>(written) : 0;
@@ -91,6 +189,15 @@ size_t UartPort::write(uint8_t byte) {
 
 void UartPort::setRxBufferSize(size_t size) { rxBufferSize_ = size; }
 
+void UartPort::setEventQueueSize(int size) { eventQueueSize_ = size; }
+
+QueueHandle_t UartPort::eventQueue() const { return eventQueue_; }
+
+void UartPort::flushInput() {
+  cachedByte_ = -1;
+  if (installed_) uart_flush_input(port_);
+}
+
 void UartPort::setRxFIFOFull(int fullThreshold) {
   uart_set_rx_full_threshold(port_, fullThreshold);
 }
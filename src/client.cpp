@@ -11,6 +11,7 @@
 #include <lwip/tcp.h>
 
 #include "BusType.hpp"
+#include "SocketWakeup.hpp"
 #include "main.hpp"
 
 #define M1 0b11000000
@@ -20,21 +21,33 @@ enum requests { CMD_INIT = 0, CMD_SEND, CMD_START, CMD_INFO };
 
 namespace {
 
-TaskHandle_t clientAcceptTaskHandle = nullptr;
 TaskHandle_t dataTaskHandle = nullptr;
+SocketWakeup dataWakeup;
 int wifiServerFd = -1;
-int wifiClients[MAX_WIFI_CLIENTS] = {-1, -1, -1, -1};
+WifiClient wifiClients[MAX_WIFI_CLIENTS];
 
 int wifiServerEnhancedFd = -1;
-int wifiClientsEnhanced[MAX_WIFI_CLIENTS] = {-1, -1, -1, -1};
+WifiClient wifiClientsEnhanced[MAX_WIFI_CLIENTS];
 
 int wifiServerReadOnlyFd = -1;
-int wifiClientsReadOnly[MAX_WIFI_CLIENTS] = {-1, -1, -1, -1};
+WifiClient wifiClientsReadOnly[MAX_WIFI_CLIENTS];
+
+size_t backlogHighWater = 0;
+uint32_t overflows = 0;
 
 constexpr uint16_t kPortDefault = 3333;
 constexpr uint16_t kPortEnhanced = 3335;
 constexpr uint16_t kPortReadOnly = 3334;
 
+// Longest wait for socket activity. When the bus data is received in its own
+// task we get woken up through dataWakeup, otherwise the bus is read on every
+// tick by the data loop itself.
+#if USE_UART_EVENTS
+constexpr uint32_t kSelectTimeoutUs = 1000 * 1000;
+#else
+constexpr uint32_t kSelectTimeoutUs = portTICK_PERIOD_MS * 1000;
+#endif
+
 bool createListenSocket(int& listenFd, uint16_t port) {
   if (listenFd >= 0) return true;
 
@@ -74,46 +87,6 @@ bool createListenSockets() {
          createListenSocket(wifiServerReadOnlyFd, kPortReadOnly);
 }
 
-void clientAcceptTask(void* arg) {
-  for (;;) {
-    handleNewClient(wifiServerFd, wifiClients);
-    handleNewClient(wifiServerEnhancedFd, wifiClientsEnhanced);
-    handleNewClient(wifiServerReadOnlyFd, wifiClientsReadOnly);
-    vTaskDelay(1);
-  }
-}
-
-void dataProcess() {
-  for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
-    handleClient(&wifiClients[i]);
-    handleClientEnhanced(&wifiClientsEnhanced[i]);
-  }
-
-  BusType::data data;
-  if (Bus.read(data)) {
-    for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
-      if (data._enhanced) {
-        if (data._clientFd == wifiClientsEnhanced[i]) {
-          pushClientEnhanced(&wifiClientsEnhanced[i], data._c, data._d, true);
-        }
-      } else {
-        pushClient(&wifiClients[i], data._d);
-        pushClient(&wifiClientsReadOnly[i], data._d);
-        if (data._clientFd != wifiClientsEnhanced[i]) {
-          pushClientEnhanced(&wifiClientsEnhanced[i], data._c, data._d,
-                             data._logToClientFd == wifiClientsEnhanced[i]);
-        }
-      }
-    }
-  }
-}
-
-void dataLoop(void* arg) {
-  for (;;) {
-    dataProcess();
-  }
-}
-
 bool isSocketConnected(int clientFd) {
   if (clientFd < 0) return false;
   char buffer = 0;
@@ -131,6 +104,32 @@ void closeSocket(int& clientFd) {
   }
 }
 
+void closeClient(WifiClient* client) {
+  if (client->fd >= 0) removeArbitrationClient(client->fd);
+  closeSocket(client->fd);
+  client->head = 0;
+  client->length = 0;
+}
+
+// Append data for the client, disconnect the client when it can't keep up
+bool bufferClient(WifiClient* client, const uint8_t* data, size_t size) {
+  if (client->fd < 0) return false;
+  if (client->length + size > CLIENT_BUFFER_SIZE) {
+    DEBUG_LOG("CLIENT OVERFLOW %i\n", client->fd);
+    overflows++;
+    closeClient(client);
+    return false;
+  }
+  for (size_t i = 0; i < size; i++) {
+    client->buffer[(client->head + client->length) % CLIENT_BUFFER_SIZE] =
+        data[i];
+    client->length++;
+  }
+  if (client->length > client->highWater) client->highWater = client->length;
+  if (client->length > backlogHighWater) backlogHighWater = client->length;
+  return true;
+}
+
 int socketAvailable(int clientFd) {
   if (clientFd < 0) return 0;
   int pending = 0;
@@ -161,45 +160,153 @@ size_t socketWriteString(int clientFd, const char* message) {
                           strlen(message));
 }
 
+void wakeDataLoop() { dataWakeup.signal(); }
+
+void watchFd(int fd, fd_set* set, int& maxFd) {
+  if (fd < 0) return;
+  FD_SET(fd, set);
+  if (fd > maxFd) maxFd = fd;
+}
+
+// Readable without pending data means the peer closed the connection
+bool checkClosed(WifiClient* client) {
+  if (socketAvailable(client->fd) > 0 || isSocketConnected(client->fd))
+    return false;
+  closeClient(client);
+  return true;
+}
+
+// Wait until a socket is ready or the bus has data. Read only clients are
+// not watched for reading, they only get data.
+void waitForSockets(fd_set* readSet, fd_set* writeSet) {
+  FD_ZERO(readSet);
+  FD_ZERO(writeSet);
+  int maxFd = -1;
+  watchFd(dataWakeup.fd(), readSet, maxFd);
+  watchFd(wifiServerFd, readSet, maxFd);
+  watchFd(wifiServerEnhancedFd, readSet, maxFd);
+  watchFd(wifiServerReadOnlyFd, readSet, maxFd);
+
+  // regular clients are left alone until the bus can take their data
+  const bool busWritable = Bus.availableForWrite() > 0;
+  for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
+    if (busWritable) watchFd(wifiClients[i].fd, readSet, maxFd);
+    watchFd(wifiClientsEnhanced[i].fd, readSet, maxFd);
+    if (wifiClients[i].length > 0)
+      watchFd(wifiClients[i].fd, writeSet, maxFd);
+    if (wifiClientsEnhanced[i].length > 0)
+      watchFd(wifiClientsEnhanced[i].fd, writeSet, maxFd);
+    if (wifiClientsReadOnly[i].length > 0)
+      watchFd(wifiClientsReadOnly[i].fd, writeSet, maxFd);
+  }
+
+  timeval timeout;
+  timeout.tv_sec = kSelectTimeoutUs / 1000000;
+  timeout.tv_usec = kSelectTimeoutUs % 1000000;
+  if (select(maxFd + 1, readSet, writeSet, nullptr, &timeout) < 0) {
+    // don't spin when select fails, e.g. while the network is down
+    FD_ZERO(readSet);
+    FD_ZERO(writeSet);
+    vTaskDelay(1);
+  }
+}
+
+void handleReadySockets(fd_set* readSet) {
+  if (dataWakeup.fd() >= 0 && FD_ISSET(dataWakeup.fd(), readSet))
+    dataWakeup.clear();
+
+  if (wifiServerFd >= 0 && FD_ISSET(wifiServerFd, readSet))
+    handleNewClient(wifiServerFd, wifiClients);
+  if (wifiServerEnhancedFd >= 0 && FD_ISSET(wifiServerEnhancedFd, readSet))
+    handleNewClient(wifiServerEnhancedFd, wifiClientsEnhanced);
+  if (wifiServerReadOnlyFd >= 0 && FD_ISSET(wifiServerReadOnlyFd, readSet))
+    handleNewClient(wifiServerReadOnlyFd, wifiClientsReadOnly);
+
+  for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
+    WifiClient* client = &wifiClients[i];
+    if (client->fd >= 0 && FD_ISSET(client->fd, readSet) &&
+        !checkClosed(client))
+      handleClient(client);
+
+    client = &wifiClientsEnhanced[i];
+    if (client->fd >= 0 && FD_ISSET(client->fd, readSet) &&
+        !checkClosed(client))
+      handleClientEnhanced(client);
+  }
+}
+
+bool dataProcess() {
+  // Collect everything the bus has for the clients, then send it in one go
+  bool received = false;
+  BusType::data data;
+  while (Bus.read(data)) {
+    received = true;
+    for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
+      if (data._enhanced) {
+        if (data._clientFd == wifiClientsEnhanced[i].fd) {
+          pushClientEnhanced(&wifiClientsEnhanced[i], data._c, data._d, true);
+        }
+      } else {
+        pushClient(&wifiClients[i], data._d);
+        pushClient(&wifiClientsReadOnly[i], data._d);
+        if (data._clientFd != wifiClientsEnhanced[i].fd) {
+          pushClientEnhanced(&wifiClientsEnhanced[i], data._c, data._d,
+                             data._logToClientFd == wifiClientsEnhanced[i].fd);
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
+    flushClient(&wifiClients[i]);
+    flushClient(&wifiClientsEnhanced[i]);
+    flushClient(&wifiClientsReadOnly[i]);
+  }
+  return received;
+}
+
+void dataLoop(void* arg) {
+  fd_set readSet;
+  fd_set writeSet;
+  for (;;) {
+    // Sleep until a client or the bus has something for us. Sockets that
+    // became writable are served by the flush in dataProcess.
+    waitForSockets(&readSet, &writeSet);
+    handleReadySockets(&readSet);
+    dataProcess();
+  }
+}
+
 }  // namespace
 
 bool startClientRuntime() {
   if (!createListenSockets()) return false;
+  if (!dataWakeup.open()) return false;
 
   if (dataTaskHandle == nullptr) {
+    // Accepting clients, reading and writing all happens in the data loop
     if (xTaskCreate(dataLoop, "data_loop", 10000, nullptr, 1,
                     &dataTaskHandle) != pdPASS) {
       return false;
     }
   }
 
-  if (clientAcceptTaskHandle == nullptr) {
-    if (xTaskCreate(clientAcceptTask, "client_accept", 4096, nullptr, 1,
-                    &clientAcceptTaskHandle) != pdPASS) {
-      if (dataTaskHandle != nullptr) {
-        vTaskDelete(dataTaskHandle);
-        dataTaskHandle = nullptr;
-      }
-      return false;
-    }
-  }
-
+  Bus.setDataCallback(wakeDataLoop);
   return true;
 }
 
 void stopClientRuntime() {
-  if (clientAcceptTaskHandle != nullptr) {
-    vTaskDelete(clientAcceptTaskHandle);
-    clientAcceptTaskHandle = nullptr;
-  }
+  Bus.setDataCallback(nullptr);
 
   if (dataTaskHandle != nullptr) {
     vTaskDelete(dataTaskHandle);
     dataTaskHandle = nullptr;
   }
+
+  dataWakeup.close();
 }
 
-bool handleNewClient(int serverFd, int clients[]) {
+bool handleNewClient(int serverFd, WifiClient clients[]) {
   sockaddr_in addr{};
   socklen_t addrLen = sizeof(addr);
   const int clientFd =
@@ -209,14 +316,19 @@ bool handleNewClient(int serverFd, int clients[]) {
     return false;
   }
 
+  // Data is sent from the buffers without blocking
+  int flags = fcntl(clientFd, F_GETFL, 0);
+  if (flags >= 0) fcntl(clientFd, F_SETFL, flags | O_NONBLOCK);
+
   // Find free/disconnected slot
   int i;
   for (i = 0; i < MAX_WIFI_CLIENTS; i++) {
-    if (!isSocketConnected(clients[i])) {
-      closeSocket(clients[i]);
-      clients[i] = clientFd;
+    if (!isSocketConnected(clients[i].fd)) {
+      closeClient(&clients[i]);
+      clients[i].highWater = 0;
+      clients[i].fd = clientFd;
       int noDelay = 1;
-      setsockopt(clients[i], IPPROTO_TCP, TCP_NODELAY, &noDelay,
+      setsockopt(clients[i].fd, IPPROTO_TCP, TCP_NODELAY, &noDelay,
                  sizeof(noDelay));
       break;
     }
@@ -234,23 +346,52 @@ bool handleNewClient(int serverFd, int clients[]) {
   return true;
 }
 
-void handleClient(int* clientFd) {
-  while (socketAvailable(*clientFd) && Bus.availableForWrite() > 0) {
+void handleClient(WifiClient* client) {
+  while (socketAvailable(client->fd) && Bus.availableForWrite() > 0) {
     // working char by char is not very efficient
-    const int value = socketReadByte(*clientFd);
+    const int value = socketReadByte(client->fd);
     if (value < 0) break;
     Bus.write(static_cast<uint8_t>(value));
   }
 }
 
-int pushClient(int* clientFd, uint8_t byte) {
-  if (isSocketConnected(*clientFd)) {
-    socketWriteBytes(*clientFd, &byte, 1);
-    return 1;
+int pushClient(WifiClient* client, uint8_t byte) {
+  return bufferClient(client, &byte, 1) ? 1 : 0;
+}
+
+bool flushClient(WifiClient* client) {
+  if (client->fd < 0) return false;
+  if (client->length == 0) return true;
+
+  // The waiting data wraps around the end of the buffer at most once
+  const size_t first = CLIENT_BUFFER_SIZE - client->head;
+  iovec iov[2];
+  int count = 1;
+  iov[0].iov_base = &client->buffer[client->head];
+  iov[0].iov_len = client->length;
+  if (first < client->length) {
+    iov[0].iov_len = first;
+    iov[1].iov_base = &client->buffer[0];
+    iov[1].iov_len = client->length - first;
+    count = 2;
   }
-  return 0;
+
+  const int result = lwip_writev(client->fd, iov, count);
+  if (result < 0) {
+    if (errno == EWOULDBLOCK || errno == EAGAIN) return true;
+    closeClient(client);
+    return false;
+  }
+
+  client->head = (client->head + result) % CLIENT_BUFFER_SIZE;
+  client->length -= result;
+  return true;
 }
 
+size_t clientBacklogHighWater() { return backlogHighWater; }
+
+uint32_t clientOverflows() { return overflows; }
+
 void decode(int b1, int b2, uint8_t (&data)[2]) {
   data[0] = (b1 >> 2) & 0b1111;
   data[1] = ((b1 & 0b11) << 6) | (b2 & 0b00111111);
@@ -261,36 +402,27 @@ void encode(uint8_t c, uint8_t d, uint8_t (&data)[2]) {
   data[1] = M2 | (d & 0b00111111);
 }
 
-void send_res(int* clientFd, uint8_t c, uint8_t d) {
+void send_res(WifiClient* client, uint8_t c, uint8_t d) {
   uint8_t data[2];
   encode(c, d, data);
-  socketWriteBytes(*clientFd, data, 2);
+  bufferClient(client, data, 2);
 }
 
-void process_cmd(int* clientFd, uint8_t c, uint8_t d) {
+void process_cmd(WifiClient* client, uint8_t c, uint8_t d) {
   if (c == CMD_INIT) {
-    send_res(clientFd, RESETTED, 0x0);
+    send_res(client, RESETTED, 0x0);
     return;
   }
   if (c == CMD_START) {
     if (d == SYN) {
-      clearArbitrationClient();
+      clearArbitrationClient(client->fd);
       DEBUG_LOG("CMD_START SYN\n");
       return;
     } else {
-      // start arbitration
-      int cl = *clientFd;
-      uint8_t ad = d;
-      int arbitrationClientFd = *clientFd;
-      if (!setArbitrationClient(arbitrationClientFd, d)) {
-        if (cl != arbitrationClientFd) {
-          // only one client can be in arbitration
-          DEBUG_LOG("CMD_START ONGOING 0x%02 0x%02x\n", ad, d);
-          send_res(clientFd, ERROR_HOST, ERR_FRAMING);
-          return;
-        } else {
-          DEBUG_LOG("CMD_START REPEAT 0x%02x\n", d);
-        }
+      // queue for arbitration, it starts when it is our turn
+      if (!setArbitrationClient(client->fd, d)) {
+        DEBUG_LOG("CMD_START QUEUE FULL 0x%02x\n", d);
+        send_res(client, ERROR_HOST, ERR_FRAMING);
       } else {
         DEBUG_LOG("CMD_START 0x%02x\n", d);
       }
@@ -308,10 +440,10 @@ void process_cmd(int* clientFd, uint8_t c, uint8_t d) {
   }
 }
 
-bool read_cmd(int* clientFd, uint8_t (&data)[2]) {
+bool read_cmd(WifiClient* client, uint8_t (&data)[2]) {
   int b, b2;
 
-  b = socketReadByte(*clientFd);
+  b = socketReadByte(client->fd);
 
   if (b < 0) {
     // available and read -1 ???
@@ -326,27 +458,27 @@ bool read_cmd(int* clientFd, uint8_t (&data)[2]) {
 
   if (b < 0b11000000) {
     DEBUG_LOG("first command signature error\n");
-    socketWriteString(*clientFd, "first command signature error");
+    socketWriteString(client->fd, "first command signature error");
     // first command signature error
-    closeSocket(*clientFd);
+    closeClient(client);
     return false;
   }
 
-  b2 = socketReadByte(*clientFd);
+  b2 = socketReadByte(client->fd);
 
   if (b2 < 0) {
     // second command missing
     DEBUG_LOG("second command missing\n");
-    socketWriteString(*clientFd, "second command missing");
-    closeSocket(*clientFd);
+    socketWriteString(client->fd, "second command missing");
+    closeClient(client);
     return false;
   }
 
   if ((b2 & 0b11000000) != 0b10000000) {
     // second command signature error
     DEBUG_LOG("second command signature error\n");
-    socketWriteString(*clientFd, "second command signature error");
-    closeSocket(*clientFd);
+    socketWriteString(client->fd, "second command signature error");
+    closeClient(client);
     return false;
   }
 
@@ -354,22 +486,20 @@ bool read_cmd(int* clientFd, uint8_t (&data)[2]) {
   return true;
 }
 
-void handleClientEnhanced(int* clientFd) {
-  while (socketAvailable(*clientFd)) {
+void handleClientEnhanced(WifiClient* client) {
+  while (socketAvailable(client->fd)) {
     uint8_t data[2];
-    if (read_cmd(clientFd, data)) {
-      process_cmd(clientFd, data[0], data[1]);
+    if (read_cmd(client, data)) {
+      process_cmd(client, data[0], data[1]);
     }
   }
 }
 
-int pushClientEnhanced(int* clientFd, uint8_t c, uint8_t d, bool log) {
+int pushClientEnhanced(WifiClient* client, uint8_t c, uint8_t d, bool log) {
   if (log) {
     DEBUG_LOG("DATA           0x%02x 0x%02x\n", c, d);
   }
-  if (isSocketConnected(*clientFd)) {
-    send_res(clientFd, c, d);
-    return 1;
-  }
-  return 0;
+  if (client->fd < 0) return 0;
+  send_res(client, c, d);
+  return 1;
 }
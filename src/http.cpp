@@ -323,9 +323,8 @@ esp_err_t handleCommandsPage(httpd_req_t* req) {
 }
 
 esp_err_t handleCommands(httpd_req_t* req) {
-  HttpUtils::sendResponse(req, "200 OK", "application/json;charset=utf-8",
-                          store.getCommandsJson());
-  return ESP_OK;
+  return HttpUtils::sendJson(
+      req, [](JsonWriter& json) { store.writeCommandsJson(json); });
 }
 
 esp_err_t handleCommandsEvaluate(httpd_req_t* req) {
@@ -446,9 +445,8 @@ esp_err_t handleCronPage(httpd_req_t* req) {
 }
 
 esp_err_t handleCron(httpd_req_t* req) {
-  HttpUtils::sendResponse(req, "200 OK", "application/json;charset=utf-8",
-                          cron.getRulesJson());
-  return ESP_OK;
+  return HttpUtils::sendJson(
+      req, [](JsonWriter& json) { cron.writeRulesJson(json); });
 }
 
 esp_err_t handleCronEvaluate(httpd_req_t* req) {
@@ -516,9 +514,8 @@ esp_err_t handleValuesPage(httpd_req_t* req) {
 }
 
 esp_err_t handleValues(httpd_req_t* req) {
-  HttpUtils::sendResponse(req, "200 OK", "application/json;charset=utf-8",
-                          store.getValuesJson());
-  return ESP_OK;
+  return HttpUtils::sendJson(
+      req, [](JsonWriter& json) { store.writeValuesJson(json); });
 }
 
 esp_err_t handleValuesWrite(httpd_req_t* req) {
@@ -573,7 +570,7 @@ esp_err_t handleValuesRead(httpd_req_t* req) {
             : "";
     Command* command = store.findCommand(key);
     if (command != nullptr) {
-      command->setLast(0);
+      store.refreshCommand(command);
       cJSON* resp = cJSON_CreateObject();
       cJSON_AddStringToObject(resp, "id", "read");
       cJSON_AddStringToObject(resp, "status", "requested");
@@ -604,9 +601,8 @@ esp_err_t handleDevicesPage(httpd_req_t* req) {
 }
 
 esp_err_t handleDevices(httpd_req_t* req) {
-  HttpUtils::sendResponse(req, "200 OK", "application/json;charset=utf-8",
-                          deviceManager.getDevicesJson());
-  return ESP_OK;
+  return HttpUtils::sendJson(
+      req, [](JsonWriter& json) { deviceManager.writeDevicesJson(json); });
 }
 
 esp_err_t handleDevicesScan(httpd_req_t* req) {
@@ -260,6 +260,14 @@ const std::string getMqttStatusJson() {
   cJSON_Delete(doc);
   return payload;
 }
+
+void addWakeLatency(cJSON* parent, const char* name,
+                    const WakeLatency& latency) {
+  cJSON* task = cJSON_AddObjectToObject(parent, name);
+  cJSON_AddNumberToObject(task, "Count", latency.count());
+  cJSON_AddNumberToObject(task, "Average_us", latency.average());
+  cJSON_AddNumberToObject(task, "Maximum_us", latency.maximum());
+}
 #endif
 
 void saveParamsCallback() {
@@ -287,6 +295,10 @@ void saveParamsCallback() {
   schedule.setSendInquiryOfExistence(configManager.readBool("inquiryExistPrm"));
   schedule.setFirstCommandAfterStart(
       configManager.readInt("firstCmdAfterSt", 10));
+  schedule.setPipelining(configManager.readBool("pipelinePrm"));
+  if (!schedule.setBusBudget(configManager.readInt("busBudgetPrm", 0)))
+    logger.warn("Bus budget out of range, the bus time is not limited");
+  store.setAutoPersist(configManager.readBool("persistCmdsPrm"));
 
   std::string mqttServerValue = configManager.readString("mqttServer");
   std::string mqttUserValue = configManager.readString("mqttUser");
@@ -295,6 +307,11 @@ void saveParamsCallback() {
   mqtt.setEnabled(configManager.readBool("mqttEnabled"));
   mqtt.setServer(mqttServerValue.c_str(), 1883);
   mqtt.setCredentials(mqttUserValue.c_str(), mqttPassValue.c_str());
+  mqtt.setCoalesceCommands(configManager.readBool("mqttCoalesce"));
+  mqtt.setBulkWindow(configManager.readInt("mqttBulkWin", 0));
+  mqtt.setMaxRequestSize(configManager.readInt("mqttMaxRequest", 32));
+  store.setPublishOnChange(configManager.readBool("mqttOnChange"));
+  store.setPublishInterval(configManager.readInt("mqttMinIntvl", 0));
   if (!rootTopicValue.empty()) {
     mqtt.setRootTopic(rootTopicValue);
   }
@@ -337,6 +354,63 @@ const std::string getStatusJson() {
   cJSON_AddNumberToObject(arbitration, "Late", static_cast<int>(Bus._nbrLate));
   cJSON_AddNumberToObject(arbitration, "Errors",
                           static_cast<int>(Bus._nbrErrors));
+
+  // Queue
+  cJSON* queue = cJSON_AddObjectToObject(doc, "Queue");
+  cJSON_AddNumberToObject(queue, "Size", QUEUE_SIZE);
+  cJSON_AddNumberToObject(queue, "High_Water", Bus.queueHighWater());
+  cJSON_AddNumberToObject(queue, "Overflows", Bus.queueOverflows());
+
+  // Arbitration latency from SYN start bit to writing our address
+  cJSON* latency = cJSON_AddObjectToObject(doc, "Arbitration_Latency");
+  const uint32_t* histogram = Bus.latencyHistogram();
+  for (int i = 0; i < Arbitration::LATENCY_BUCKETS; i++) {
+    char label[16];
+    uint32_t from = Arbitration::LATENCY_FIRST_US +
+                    (i - 1) * Arbitration::LATENCY_BUCKET_US;
+    if (i == 0)
+      snprintf(label, sizeof(label), "<%" PRIu32, Arbitration::LATENCY_FIRST_US);
+    else if (i == Arbitration::LATENCY_BUCKETS - 1)
+      snprintf(label, sizeof(label), ">=%" PRIu32, from);
+    else
+      snprintf(label, sizeof(label), "%" PRIu32, from);
+    cJSON_AddNumberToObject(latency, label, histogram[i]);
+  }
+
+  // Clients
+  cJSON* clients = cJSON_AddObjectToObject(doc, "Clients");
+  cJSON_AddNumberToObject(clients, "Buffer_Size", CLIENT_BUFFER_SIZE);
+  cJSON_AddNumberToObject(clients, "Backlog_High_Water",
+                          clientBacklogHighWater());
+  cJSON_AddNumberToObject(clients, "Overflows", clientOverflows());
+
+  // Arbitration per client
+  cJSON* arbitrationClients =
+      cJSON_AddObjectToObject(doc, "Arbitration_Clients");
+  ArbitrationStatistics statistics[ARBITRATION_QUEUE_SIZE];
+  const size_t count =
+      getArbitrationStatistics(statistics, ARBITRATION_QUEUE_SIZE);
+  for (size_t i = 0; i < count; i++) {
+    const ArbitrationStatistics& entry = statistics[i];
+    const uint32_t done = entry.won + entry.lost + entry.errors;
+    char name[16];
+    snprintf(name, sizeof(name), "Client_%d", entry.clientFd);
+    cJSON* client = cJSON_AddObjectToObject(arbitrationClients, name);
+    cJSON_AddNumberToObject(client, "Requests", entry.requests);
+    cJSON_AddNumberToObject(client, "Won", entry.won);
+    cJSON_AddNumberToObject(client, "Lost", entry.lost);
+    cJSON_AddNumberToObject(client, "Errors", entry.errors);
+    const double average = done > 0 ? (double)(entry.waitTotal / done) : 0;
+    cJSON_AddNumberToObject(client, "Wait_Average_us", average);
+    cJSON_AddNumberToObject(client, "Wait_Maximum_us", entry.waitMax);
+  }
+#else
+  // Time from signaling a task with new work until it runs
+  cJSON* wakeup = cJSON_AddObjectToObject(doc, "Task_Wakeup");
+  addWakeLatency(wakeup, "Client_Manager", clientManager.getWakeLatency());
+  addWakeLatency(wakeup, "Schedule", schedule.getWakeLatency());
+  addWakeLatency(wakeup, "Mqtt", mqtt.getWakeLatency());
+  addWakeLatency(wakeup, "Cron", cron.getWakeLatency());
 #endif
 
   // Firmware
@@ -347,6 +421,11 @@ const std::string getStatusJson() {
   cJSON_AddBoolToObject(firmware, "Async", USE_ASYNCHRONOUS ? true : false);
   cJSON_AddBoolToObject(firmware, "Software_Serial",
                         USE_SOFTWARE_SERIAL ? true : false);
+  cJSON_AddBoolToObject(firmware, "Burst_Read", USE_BURST_READ ? true : false);
+  cJSON_AddBoolToObject(firmware, "Uart_Events",
+                        USE_UART_EVENTS ? true : false);
+  cJSON_AddBoolToObject(firmware, "Arbitration_Priority",
+                        USE_ARBITRATION_PRIORITY ? true : false);
 #endif
   cJSON_AddStringToObject(firmware, "Unique_ID", unique_id);
   cJSON_AddStringToObject(firmware, "Adapter_HW_Version",
@@ -457,10 +536,30 @@ const std::string getStatusJson() {
                         configManager.readBool("scanOnStartPrm"));
   cJSON_AddNumberToObject(scheduleObj, "First_Command_After_Start",
                           configManager.readInt("firstCmdAfterSt", 10));
+  cJSON_AddBoolToObject(scheduleObj, "Pipelining",
+                        configManager.readBool("pipelinePrm"));
+  cJSON_AddNumberToObject(scheduleObj, "Bus_Budget", schedule.getBusBudget());
   cJSON_AddNumberToObject(scheduleObj, "Active_Commands",
                           store.getActiveCommands());
   cJSON_AddNumberToObject(scheduleObj, "Passive_Commands",
                           store.getPassiveCommands());
+  cJSON_AddNumberToObject(scheduleObj, "Commands_Heap",
+                          store.getCommandsHeap());
+  cJSON_AddBoolToObject(scheduleObj, "Persist_Commands",
+                        configManager.readBool("persistCmdsPrm"));
+  cJSON_AddNumberToObject(scheduleObj, "Journal_Bytes",
+                          store.getJournalBytes());
+  cJSON_AddNumberToObject(scheduleObj, "Queued_Commands",
+                          schedule.getQueuedCommands());
+  cJSON_AddNumberToObject(scheduleObj, "Queue_Lock_Maximum_us",
+                          schedule.getQueueLockMaximum());
+  cJSON_AddNumberToObject(scheduleObj, "Pipelined_Commands",
+                          schedule.getPipelinedCommands());
+  cJSON_AddNumberToObject(scheduleObj, "Telegram_Duration_ms",
+                          schedule.getTelegramDuration());
+  cJSON_AddNumberToObject(scheduleObj, "Telegrams_Per_Minute",
+                          schedule.getTelegramsPerMinute());
+  cJSON_AddNumberToObject(scheduleObj, "Bus_Load", schedule.getBusLoad());
 
   // MQTT
   cJSON* mqttObj = cJSON_AddObjectToObject(doc, "MQTT");
@@ -473,6 +572,30 @@ const std::string getStatusJson() {
   cJSON_AddBoolToObject(mqttObj, "Publish_Counter",
                         schedule.getPublishCounter());
   cJSON_AddBoolToObject(mqttObj, "Publish_Timing", schedule.getPublishTiming());
+  cJSON_AddBoolToObject(mqttObj, "Coalesce_Commands",
+                        configManager.readBool("mqttCoalesce"));
+  cJSON_AddBoolToObject(mqttObj, "Publish_On_Change",
+                        configManager.readBool("mqttOnChange"));
+  cJSON_AddNumberToObject(mqttObj, "Minimum_Republish_Interval",
+                          configManager.readInt("mqttMinIntvl", 0));
+  cJSON_AddNumberToObject(mqttObj, "Bulk_Window",
+                          configManager.readInt("mqttBulkWin", 0));
+  cJSON_AddNumberToObject(mqttObj, "Outgoing_Queued",
+                          mqtt.getOutgoingQueued());
+  cJSON_AddNumberToObject(mqttObj, "Outgoing_Dropped",
+                          mqtt.getOutgoingDropped());
+  cJSON_AddNumberToObject(mqttObj, "Outgoing_Stalls",
+                          mqtt.getOutgoingStalls());
+  cJSON_AddNumberToObject(mqttObj, "Outbox_High_Water",
+                          mqtt.getOutboxHighWater());
+  cJSON_AddNumberToObject(mqttObj, "Maximum_Request_Size",
+                          configManager.readInt("mqttMaxRequest", 32));
+  cJSON_AddNumberToObject(mqttObj, "Requests_Handled",
+                          mqtt.getRequestsHandled());
+  cJSON_AddNumberToObject(mqttObj, "Requests_Dropped",
+                          mqtt.getRequestsDropped());
+  cJSON_AddNumberToObject(mqttObj, "Request_Time_Maximum_us",
+                          mqtt.getRequestTimeMaximum());
 
   // HomeAssistant
   cJSON* homeAssistant = cJSON_AddObjectToObject(doc, "Home_Assistant");
@@ -545,6 +668,11 @@ extern "C" void app_main(void) {
   mqtt.setup(unique_id);
   mqtt.setServer(mqttServerValue.c_str(), 1883);
   mqtt.setCredentials(mqttUserValue.c_str(), mqttPassValue.c_str());
+  mqtt.setCoalesceCommands(configManager.readBool("mqttCoalesce"));
+  mqtt.setBulkWindow(configManager.readInt("mqttBulkWin", 0));
+  mqtt.setMaxRequestSize(configManager.readInt("mqttMaxRequest", 32));
+  store.setPublishOnChange(configManager.readBool("mqttOnChange"));
+  store.setPublishInterval(configManager.readInt("mqttMinIntvl", 0));
   if (!rootTopicValue.empty()) {
     mqtt.setRootTopic(rootTopicValue);
   }
@@ -597,6 +725,10 @@ extern "C" void app_main(void) {
   schedule.setSendInquiryOfExistence(configManager.readBool("inquiryExistPrm"));
   schedule.setFirstCommandAfterStart(
       configManager.readInt("firstCmdAfterSt", 10));
+  schedule.setPipelining(configManager.readBool("pipelinePrm"));
+  if (!schedule.setBusBudget(configManager.readInt("busBudgetPrm", 0)))
+    logger.warn("Bus budget out of range, the bus time is not limited");
+  store.setAutoPersist(configManager.readBool("persistCmdsPrm"));
   schedule.setPublishCounter(configManager.readBool("mqttPublishCnt"));
   schedule.setPublishTiming(configManager.readBool("mqttPublishTmg"));
   schedule.start(ebusController.getBus(), ebusController.getRequest(),
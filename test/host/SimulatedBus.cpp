@@ -0,0 +1,415 @@
+#include "SimulatedBus.hpp"
+
+#include <esp_rom_sys.h>
+#include <esp_timer.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <utility>
+
+namespace {
+constexpr uint8_t SYN_SYMBOL = 0xAA;
+
+uint64_t simulatedClock = 0;
+SimulatedBus* currentBus = nullptr;
+
+// stands for the event queue of the simulated bus
+int eventQueue = 0;
+
+// interrupt on the falling edges of the RX pin
+gpio_isr_t edgeHandler = nullptr;
+void* edgeArg = nullptr;
+
+// tasks created by the adapter
+std::map<std::string, std::pair<TaskFunction_t, void*>> tasks;
+}  // namespace
+
+TraceSource::TraceSource(const std::string& trace) {
+  std::istringstream stream(trace);
+  std::string token;
+  while (stream >> token) {
+    Slot slot;
+    if (token == "!") {
+      slot.overflow = true;
+      slots_.push_back(slot);
+      continue;
+    }
+    if (token[0] == '@') {
+      slot.arbitration = true;
+      token.erase(0, 1);
+    }
+    if (!token.empty())
+      slot.symbol = static_cast<int>(std::strtoul(token.c_str(), nullptr, 16));
+    slots_.push_back(slot);
+  }
+}
+
+bool TraceSource::next(Slot& slot) {
+  if (position_ >= slots_.size()) return false;
+  slot = slots_[position_++];
+  return true;
+}
+
+RandomSource::RandomSource(const std::vector<Master>& masters, uint8_t adapter,
+                           uint32_t seed)
+    : masters_(masters),
+      pending_(masters.size(), false),
+      adapter_(adapter),
+      random_(seed) {}
+
+bool RandomSource::next(Slot& slot) {
+  switch (phase_) {
+    case Phase::Syn: {
+      std::uniform_real_distribution<double> chance(0, 1);
+      for (size_t i = 0; i < masters_.size(); i++)
+        if (!pending_[i] && chance(random_) < masters_[i].probability)
+          pending_[i] = true;
+      slot = {SYN_SYMBOL, false};
+      phase_ = Phase::Arbitration;
+      break;
+    }
+    case Phase::Arbitration:
+      slot = {Slot::NOBODY, true};
+      for (size_t i = 0; i < masters_.size(); i++) {
+        if (!pending_[i]) continue;
+        if (secondRound_ >= 0 && (masters_[i].address & 0x0f) != secondRound_)
+          continue;
+        slot.symbol = slot.symbol == Slot::NOBODY
+                          ? masters_[i].address
+                          : slot.symbol & masters_[i].address;
+      }
+      // arbitrated decides how to go on
+      phase_ = Phase::Syn;
+      break;
+    case Phase::Telegram: {
+      // any symbol but SYN, which is escaped in a real telegram
+      std::uniform_int_distribution<int> symbol(0x00, 0xfe);
+      int value = symbol(random_);
+      slot = {value == SYN_SYMBOL ? 0xa9 : value, false};
+      if (--telegram_ == 0) phase_ = Phase::Syn;
+      break;
+    }
+  }
+  return true;
+}
+
+void RandomSource::arbitrated(int symbol, bool adapter) {
+  secondRound_ = -1;
+  if (symbol == Slot::NOBODY) return;
+
+  bool won = adapter && symbol == adapter_;
+  for (size_t i = 0; i < masters_.size(); i++) {
+    if (pending_[i] && masters_[i].address == symbol) {
+      pending_[i] = false;
+      won = true;
+    }
+  }
+
+  if (won) {
+    // ZZ PB SB NN, up to 8 data bytes, CRC, ACK, slave part
+    std::uniform_int_distribution<int> length(6, 20);
+    telegram_ = length(random_);
+    phase_ = Phase::Telegram;
+  } else {
+    // the AND of the addresses is none of the masters
+    secondRound_ = symbol & 0x0f;
+  }
+}
+
+SimulatedBus::SimulatedBus(const Latency& latency, uint32_t seed)
+    : latency_(latency), random_(seed) {
+  currentBus = this;
+}
+
+SimulatedBus::~SimulatedBus() {
+  if (currentBus == this) currentBus = nullptr;
+}
+
+uint64_t SimulatedBus::now() { return simulatedClock; }
+
+void SimulatedBus::delay(uint32_t us) { simulatedClock += us; }
+
+bool SimulatedBus::task(const std::string& name, TaskFunction_t& function,
+                        void*& parameters) {
+  const auto it = tasks.find(name);
+  if (it == tasks.end()) return false;
+  function = it->second.first;
+  parameters = it->second.second;
+  return true;
+}
+
+SimulatedBus* SimulatedBus::current() { return currentBus; }
+
+void SimulatedBus::receive(uint8_t symbol) {
+  received_.push_back(symbol);
+  postEvent(UART_DATA);
+}
+
+void SimulatedBus::receive(uint8_t symbol, uint64_t start) {
+  // the interrupt runs at the edge, even when the adapter task was busy then
+  const uint64_t clock = simulatedClock;
+  int level = 1;  // idle or stop bit
+  for (uint32_t bit = 0; bit < 9 && edgeHandler != nullptr; bit++) {
+    const int next = bit == 0 ? 0 : (symbol >> (bit - 1)) & 1;
+    if (level == 1 && next == 0) {
+      simulatedClock = start + bit * SYMBOL_US / 10;
+      edgeHandler(edgeArg);
+    }
+    level = next;
+  }
+  simulatedClock = clock;
+  receive(symbol);
+}
+
+void SimulatedBus::postEvent(uart_event_type_t type) {
+  if (events_.size() >= EVENT_QUEUE_SIZE) {
+    statistics_.droppedEvents++;
+    return;
+  }
+  events_.push_back(type);
+}
+
+bool SimulatedBus::nextEvent(uart_event_t& event) {
+  if (events_.empty()) return false;
+  event.type = events_.front();
+  event.size = received_.size();
+  events_.pop_front();
+  return true;
+}
+
+size_t SimulatedBus::read(uint8_t* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length && !received_.empty()) {
+    buffer[count++] = received_.front();
+    received_.pop_front();
+  }
+  return count;
+}
+
+void SimulatedBus::write(uint8_t symbol) {
+  writes_.push_back({simulatedClock, symbol});
+  statistics_.writes++;
+}
+
+void SimulatedBus::run(SlotSource& source, const Poll& poll,
+                       uint64_t duration) {
+  const uint64_t until = simulatedClock + duration;
+  uint64_t next = simulatedClock;  // earliest start of the next slot
+  uint64_t syn = simulatedClock;   // start bit of the last SYN
+  Slot slot;
+
+  while (source.next(slot)) {
+    if (slot.overflow) {
+      received_.clear();
+      postEvent(UART_BUFFER_FULL);
+      schedulePoll(next);
+      continue;
+    }
+
+    // masters send their address at the begin of the window
+    const uint64_t start = slot.arbitration ? syn + WINDOW_BEGIN_US : next;
+    const uint64_t end = start + SYMBOL_US;
+    if (end > until) break;
+
+    // the adapter processes what it received before this slot is complete
+    if (pollPending_ && pollTime_ < end) runPoll(poll);
+
+    int symbol = slot.symbol;
+    bool adapter = false;
+    for (const Write& write : writes_) {
+      if (!slot.arbitration || write.time >= end) {
+        statistics_.stray++;
+        continue;
+      }
+      if (write.time < syn + WINDOW_BEGIN_US)
+        statistics_.early++;
+      else if (write.time > syn + WINDOW_END_US)
+        statistics_.late++;
+      symbol = symbol == Slot::NOBODY ? write.symbol : symbol & write.symbol;
+      adapter = true;
+    }
+    writes_.clear();
+
+    if (slot.arbitration) source.arbitrated(symbol, adapter);
+
+    if (symbol == Slot::NOBODY) {
+      // nobody took the bus, the next SYN comes from the SYN generator
+      next = syn + idleSyn_;
+      continue;
+    }
+
+    receive(static_cast<uint8_t>(symbol), start);
+    schedulePoll(end);
+    if (symbol == SYN_SYMBOL) syn = start;
+    next = end;
+  }
+
+  if (pollPending_ && pollTime_ <= until) runPoll(poll);
+  statistics_.stray += writes_.size();
+  writes_.clear();
+  if (simulatedClock < until) simulatedClock = until;
+}
+
+void SimulatedBus::schedulePoll(uint64_t time) {
+  // a task that is already due handles the new event as well
+  if (pollPending_) return;
+  pollPending_ = true;
+  pollTime_ = time + nextLatency();
+}
+
+uint32_t SimulatedBus::nextLatency() {
+  uint32_t latency = latency_.base;
+  if (latency_.jitter > 0)
+    latency += std::uniform_int_distribution<uint32_t>(0, latency_.jitter)(
+        random_);
+  if (latency_.stallProbability > 0 &&
+      std::uniform_real_distribution<double>(0, 1)(random_) <
+          latency_.stallProbability)
+    latency += latency_.stall;
+  return latency;
+}
+
+void SimulatedBus::runPoll(const Poll& poll) {
+  pollPending_ = false;
+  if (pollTime_ > simulatedClock) simulatedClock = pollTime_;
+
+  const size_t symbols = received_.size();
+  const auto begin = std::chrono::steady_clock::now();
+  poll();
+  const auto elapsed = std::chrono::steady_clock::now() - begin;
+
+  const size_t processed = symbols - received_.size();
+  statistics_.symbols += processed;
+  statistics_.polls++;
+  if (processed > 1) statistics_.bursts++;
+  if (processed > statistics_.maxBurst) statistics_.maxBurst = processed;
+  statistics_.hostNanos +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+// ESP-IDF functions of the shim
+
+int64_t esp_timer_get_time() {
+  return static_cast<int64_t>(SimulatedBus::now());
+}
+
+void esp_rom_delay_us(uint32_t us) { SimulatedBus::delay(us); }
+
+esp_err_t uart_driver_install(uart_port_t port, int rxBufferSize,
+                              int txBufferSize, int queueSize,
+                              QueueHandle_t* queue, int intrFlags) {
+  if (queue != nullptr) *queue = &eventQueue;
+  return ESP_OK;
+}
+
+esp_err_t uart_driver_delete(uart_port_t port) { return ESP_OK; }
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t* config) {
+  return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t port, int txPin, int rxPin, int rtsPin,
+                       int ctsPin) {
+  return ESP_OK;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t* size) {
+  SimulatedBus* bus = SimulatedBus::current();
+  *size = port == UART_NUM_1 && bus != nullptr ? bus->buffered() : 0;
+  return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t port, void* buffer, uint32_t length,
+                    TickType_t ticksToWait) {
+  SimulatedBus* bus = SimulatedBus::current();
+  if (port != UART_NUM_1 || bus == nullptr) return 0;
+  return static_cast<int>(bus->read(static_cast<uint8_t*>(buffer), length));
+}
+
+int uart_write_bytes(uart_port_t port, const void* src, size_t size) {
+  if (port != UART_NUM_1)
+    return static_cast<int>(std::fwrite(src, 1, size, stdout));
+  SimulatedBus* bus = SimulatedBus::current();
+  if (bus == nullptr) return 0;
+  const uint8_t* symbols = static_cast<const uint8_t*>(src);
+  for (size_t i = 0; i < size; i++) bus->write(symbols[i]);
+  return static_cast<int>(size);
+}
+
+esp_err_t uart_flush_input(uart_port_t port) {
+  SimulatedBus* bus = SimulatedBus::current();
+  if (port == UART_NUM_1 && bus != nullptr) bus->flush();
+  return ESP_OK;
+}
+
+esp_err_t uart_set_rx_full_threshold(uart_port_t port, int threshold) {
+  return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type) {
+  return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t pin) { return ESP_OK; }
+
+esp_err_t gpio_install_isr_service(int flags) { return ESP_OK; }
+
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void* arg) {
+  edgeHandler = handler;
+  edgeArg = arg;
+  return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t pin) {
+  edgeHandler = nullptr;
+  edgeArg = nullptr;
+  return ESP_OK;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name,
+                       uint32_t stackDepth, void* parameters,
+                       UBaseType_t priority, TaskHandle_t* task) {
+  // the simulated bus runs the event task, a test the others
+  tasks[name] = {function, parameters};
+  if (task != nullptr) *task = nullptr;
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {}
+
+// a tick of 1 ms
+void vTaskDelay(TickType_t ticks) { SimulatedBus::delay(ticks * 1000); }
+
+// one task, nobody to notify
+TaskHandle_t xTaskGetCurrentTaskHandle() { return nullptr; }
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) { return pdPASS; }
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t wait) {
+  SimulatedBus::delay(wait * 1000);
+  return 0;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t wait) {
+  return pdFALSE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+  SimulatedBus* bus = SimulatedBus::current();
+  if (queue == &eventQueue && bus != nullptr) bus->resetEvents();
+  return pdPASS;
+}
+
+// a single thread, the mutex is always free
+SemaphoreHandle_t xSemaphoreCreateMutex() { return &eventQueue; }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait) {
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) { return pdTRUE; }
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <freertos/task.h>
+
+// Simulated 2400 baud eBUS for the host build.
+//
+// Symbols are put on the bus in slots of one symbol time. The slot after a
+// SYN is an arbitration slot: every master that wants the bus sends its
+// address and the bus carries the AND of them, as 0 is the dominant level.
+// The adapter under test is connected through the UART driver functions of
+// the shim. Its writes take part in the arbitration slot they fall into.
+// Each received symbol posts a UART_DATA event, like the driver does with a
+// RX FIFO full threshold of 1, and the event task of the adapter gets to them
+// after a task latency, so several symbols are waiting when the latency is
+// longer than a symbol. The interrupt on the falling edges of the RX pin runs
+// at the start bit and data bits of each symbol, whatever the task latency.
+
+// One slot of the bus. In an arbitration slot, symbol is the AND of the
+// addresses of the other masters, or NOBODY when none of them sends. An
+// overflow slot takes no time, the driver reports lost symbols instead.
+struct Slot {
+  static constexpr int NOBODY = -1;
+  int symbol = NOBODY;
+  bool arbitration = false;
+  bool overflow = false;
+};
+
+// Decides what the other participants put on the bus
+class SlotSource {
+ public:
+  virtual ~SlotSource() = default;
+
+  // Next slot, false at the end of the source
+  virtual bool next(Slot& slot) = 0;
+
+  // Result of an arbitration slot, adapter is true when the adapter sent
+  virtual void arbitrated(int symbol, bool adapter) {}
+};
+
+// Replays a recorded trace like "AA @ AA @10 B5 05". A plain hex value is a
+// symbol, "@" an arbitration slot without other masters, "@10" one where
+// master 0x10 sends and "!" an overflow of the UART buffer.
+class TraceSource : public SlotSource {
+ public:
+  explicit TraceSource(const std::string& trace);
+
+  bool next(Slot& slot) override;
+
+ private:
+  std::vector<Slot> slots_;
+  size_t position_ = 0;
+};
+
+// Masters that want the bus at random SYNs. The winner sends a telegram of
+// random length, masters of the same priority class as a colliding address
+// take part in a second round.
+class RandomSource : public SlotSource {
+ public:
+  struct Master {
+    uint8_t address;
+    double probability;  // of wanting the bus at a SYN
+  };
+
+  RandomSource(const std::vector<Master>& masters, uint8_t adapter,
+               uint32_t seed);
+
+  bool next(Slot& slot) override;
+  void arbitrated(int symbol, bool adapter) override;
+
+ private:
+  enum class Phase { Syn, Arbitration, Telegram };
+
+  std::vector<Master> masters_;
+  std::vector<bool> pending_;
+  uint8_t adapter_;
+  std::mt19937 random_;
+  Phase phase_ = Phase::Syn;
+  int secondRound_ = -1;  // priority class of the second round
+  int telegram_ = 0;      // remaining symbols of the telegram
+};
+
+class SimulatedBus {
+ public:
+  // start bit, 8 data bits and stop bit at 2400 baud
+  static constexpr uint32_t SYMBOL_US = 4167;
+  // an address has to be sent between these times after the SYN start bit
+  static constexpr uint32_t WINDOW_BEGIN_US = 4300;
+  static constexpr uint32_t WINDOW_END_US = 4456;
+  // length of the event queue, UART_EVENT_QUEUE_SIZE of BusType
+  static constexpr size_t EVENT_QUEUE_SIZE = 16;
+
+  // Time from receiving a symbol until the adapter task processes it
+  struct Latency {
+    uint32_t base = 50;
+    uint32_t jitter = 100;
+    double stallProbability = 0;  // e.g. Wi-Fi keeping the CPU busy
+    uint32_t stall = 0;
+  };
+
+  struct Statistics {
+    uint32_t symbols = 0;
+    uint32_t polls = 0;
+    uint32_t bursts = 0;  // polls that processed more than one symbol
+    uint32_t droppedEvents = 0;  // the event queue was full
+    size_t maxBurst = 0;
+    uint64_t hostNanos = 0;  // processing time of the adapter on the host
+    uint32_t writes = 0;
+    uint32_t early = 0;   // before WINDOW_BEGIN_US
+    uint32_t late = 0;    // after WINDOW_END_US, still in the slot
+    uint32_t stray = 0;   // outside an arbitration slot
+  };
+
+  // Called when the event task of the adapter wakes up
+  using Poll = std::function<void()>;
+
+  SimulatedBus(const Latency& latency, uint32_t seed);
+  ~SimulatedBus();
+
+  // Put the slots of the source on the bus until it ends or until the
+  // simulated clock passes duration
+  void run(SlotSource& source, const Poll& poll, uint64_t duration);
+
+  // Time between the start bits of two SYN on an idle bus
+  void setIdleSyn(uint32_t us) { idleSyn_ = us; }
+
+  const Statistics& statistics() const { return statistics_; }
+
+  // Simulated clock in microseconds
+  static uint64_t now();
+  static void delay(uint32_t us);
+
+  // Function and parameters of a task the adapter created by name, nothing
+  // runs them unless a test does
+  static bool task(const std::string& name, TaskFunction_t& function,
+                   void*& parameters);
+
+  // UART driver side of the adapter
+  static SimulatedBus* current();
+  void receive(uint8_t symbol);
+  // with the falling edges of a symbol whose start bit was at start
+  void receive(uint8_t symbol, uint64_t start);
+  bool nextEvent(uart_event_t& event);
+  void resetEvents() { events_.clear(); }
+  size_t buffered() const { return received_.size(); }
+  size_t read(uint8_t* buffer, size_t length);
+  void write(uint8_t symbol);
+  void flush() { received_.clear(); }
+
+ private:
+  struct Write {
+    uint64_t time;
+    uint8_t symbol;
+  };
+
+  void postEvent(uart_event_type_t type);
+  void schedulePoll(uint64_t time);
+  uint32_t nextLatency();
+  void runPoll(const Poll& poll);
+
+  Latency latency_;
+  std::mt19937 random_;
+  uint32_t idleSyn_ = 40000;
+  std::deque<uint8_t> received_;
+  std::deque<uart_event_type_t> events_;
+  std::vector<Write> writes_;
+  bool pollPending_ = false;
+  uint64_t pollTime_ = 0;
+  Statistics statistics_;
+};
@@ -0,0 +1,357 @@
+// Host simulation of the bus side of the adapter. Replays arbitration traces
+// with a known outcome through the UART event handling of BusType, BusState
+// and Arbitration, checks the reception of bursts, measures the gain of
+// pipelining, then runs the adapter on a bus with competing masters and
+// reports the processing cost per symbol and the arbitration results.
+//
+// usage: bus_simulator [simulated seconds per benchmark]
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BusType.hpp"
+#include "SimulatedBus.hpp"
+
+namespace {
+constexpr uint8_t ADAPTER = 0x33;
+
+// Arbitration client as ebusd would be, it asks for the bus again after each
+// result until requests runs out
+struct Client {
+  int fd;
+  int requests;
+  bool waiting;
+
+  void request() { waiting = setArbitrationClient(fd, ADAPTER); }
+};
+
+// The event task of the adapter woke up, then the client task reads
+size_t wake(BusType& bus, SimulatedBus& simulated, Client& client) {
+  uart_event_t event;
+  while (simulated.nextEvent(event)) bus.uartEvent(event, bus.micros());
+
+  size_t received = 0;
+  BusType::data d;
+  while (bus.read(d)) {
+    if (!d._enhanced) received++;
+    if (!d._enhanced || d._clientFd != client.fd) continue;
+    client.waiting = false;
+    if (client.requests > 0) {
+      client.requests--;
+      client.request();
+    }
+  }
+  return received;
+}
+
+ArbitrationStatistics clientStatistics(int fd) {
+  ArbitrationStatistics statistics[ARBITRATION_QUEUE_SIZE];
+  size_t count = getArbitrationStatistics(statistics, ARBITRATION_QUEUE_SIZE);
+  for (size_t i = 0; i < count; i++)
+    if (statistics[i].clientFd == fd) return statistics[i];
+  return ArbitrationStatistics();
+}
+
+struct TraceCase {
+  const char* name;
+  const char* trace;
+  uint32_t latency;
+  uint32_t won;
+  uint32_t lost;
+  uint32_t errors;
+  int late;
+  int restarts;
+};
+
+// Each trace starts the bus state with two SYN, the adapter asks for the bus
+// once at the start
+const TraceCase traces[] = {
+    {"won alone", "AA @ AA @ FE 07 04 00 9A", 100, 1, 0, 0, 0, 0},
+    {"lost to a higher priority", "AA @ AA @10 B5 05 04 27 00", 100, 0, 1, 0,
+     0, 0},
+    {"same priority class lost", "AA @ AA @13 B5 05 04 27 00", 100, 0, 1, 0, 0,
+     0},
+    {"second round won", "AA @ AA @17 AA @ FE 07 04 00 9A", 100, 1, 0, 0, 0,
+     0},
+    {"second round lost", "AA @ AA @17 AA @03 B5 05 04 27 00", 100, 0, 1, 0, 0,
+     0},
+    {"address lost, restarted", "AA @ AA AA @ FE 07 04 00 9A", 100, 1, 0, 0, 0,
+     1},
+    {"address lost four times, failed", "AA @ AA AA AA AA AA", 100, 0, 0, 1,
+     0, 3},
+    {"late after a long task latency", "AA @ AA @10 B5 05 04 27 00", 6000, 0,
+     0, 0, 1, 0},
+    {"overflow resets the bus state", "AA ! AA @10 B5 05 04 27 00", 100, 0, 0,
+     0, 0, 0},
+};
+
+bool replay(const TraceCase& trace, int fd) {
+  BusType bus;
+  bus.begin();
+  SimulatedBus::Latency latency;
+  latency.base = trace.latency;
+  latency.jitter = 0;
+  SimulatedBus simulated(latency, 1);
+  Client client{fd, 0, false};
+
+  client.request();
+  TraceSource source(trace.trace);
+  simulated.run(
+      source, [&] { wake(bus, simulated, client); }, 10 * 1000 * 1000);
+
+  const ArbitrationStatistics statistics = clientStatistics(fd);
+  removeArbitrationClient(fd);
+  const int restarts = bus._nbrRestarts1 + bus._nbrRestarts2;
+  const bool ok = statistics.won == trace.won &&
+                  statistics.lost == trace.lost &&
+                  statistics.errors == trace.errors &&
+                  bus._nbrLate == trace.late && restarts == trace.restarts;
+  std::printf("%-4s %-32s won %" PRIu32 " lost %" PRIu32 " errors %" PRIu32
+              " late %d restarts %d\n",
+              ok ? "ok" : "FAIL", trace.name, statistics.won, statistics.lost,
+              statistics.errors, bus._nbrLate.load(), restarts);
+  return ok;
+}
+
+// Symbols that piled up while the event task was stalled are all handled by
+// its first event, even with more than BURST_SIZE of them and with events
+// dropped by the full event queue
+bool longBurst() {
+  BusType bus;
+  bus.begin();
+  SimulatedBus::Latency latency;
+  latency.base = 1000 * 1000;
+  latency.jitter = 0;
+  SimulatedBus simulated(latency, 1);
+
+  // three symbols and an empty arbitration slot before the telegram
+  constexpr size_t count = 40;
+  std::string trace = "AA @ AA @10";
+  for (size_t i = 3; i < count; i++) trace += " 5" + std::to_string(i % 10);
+  TraceSource source(trace);
+  size_t first = 0;
+  simulated.run(
+      source,
+      [&] {
+        uart_event_t event;
+        if (simulated.nextEvent(event)) bus.uartEvent(event, bus.micros());
+        BusType::data d;
+        while (bus.read(d)) first++;
+      },
+      10 * 1000 * 1000);
+
+  const bool ok = first == count && simulated.statistics().droppedEvents > 0;
+  std::printf("%-4s %-32s %zu of %zu symbols, %" PRIu32 " events dropped\n",
+              ok ? "ok" : "FAIL", "long burst in one event", first, count,
+              simulated.statistics().droppedEvents);
+  return ok;
+}
+
+// The start bit times of a burst come from the edge interrupt, however long
+// the symbols waited in the buffer. A burst longer than the recorded start bits
+// falls back to times reconstructed from the time the last symbol was
+// complete, including symbols left for the next read, which matches for
+// symbols received back to back.
+bool burstTimestamps(const char* name, size_t count, uint32_t gap) {
+  BusType bus;
+  bus.begin();
+  SimulatedBus simulated(SimulatedBus::Latency(), 1);
+  std::vector<uint64_t> starts;
+  for (size_t i = 0; i < count; i++) {
+    starts.push_back(SimulatedBus::now() +
+                     (i + 1) * gap + i * SimulatedBus::SYMBOL_US);
+    simulated.receive(i, starts.back());
+  }
+  SimulatedBus::delay(count * (gap + SimulatedBus::SYMBOL_US));
+
+  const uint32_t rxTime = bus.micros();
+  uint8_t symbols[BURST_SIZE];
+  uint32_t times[BURST_SIZE];
+  size_t index = 0;
+  bool ok = true;
+  size_t read;
+  while ((read = BusSer.readBurst(symbols, times, BURST_SIZE, rxTime)) > 0) {
+    for (size_t i = 0; i < read; i++, index++)
+      if (symbols[i] != index || times[i] != starts[index]) ok = false;
+  }
+  ok &= index == count;
+
+  std::printf("%-4s %-32s %zu symbols\n", ok ? "ok" : "FAIL", name, index);
+  return ok;
+}
+
+// Without pipelining the schedule learns that its telegram is complete from
+// the SYN that ends it, too late for the arbitration after that SYN. With
+// pipelining the next telegram already waits for that SYN. Returns the won
+// arbitrations, the telegrams of the adapter, per simulated minute.
+double telegramsPerMinute(const std::vector<RandomSource::Master>& masters,
+                          bool pipelined, int fd, uint64_t duration) {
+  BusType bus;
+  bus.begin();
+  SimulatedBus simulated(SimulatedBus::Latency(), 42);
+  RandomSource source(masters, ADAPTER, 7);
+  uint32_t telegrams = 0;
+  bool sending = false;  // the telegram of the adapter is on the bus
+
+  setArbitrationClient(fd, ADAPTER);
+  simulated.run(
+      source,
+      [&] {
+        uart_event_t event;
+        while (simulated.nextEvent(event)) bus.uartEvent(event, bus.micros());
+
+        BusType::data d;
+        while (bus.read(d)) {
+          if (!d._enhanced) {
+            if (sending && d._d == 0xAA) {
+              sending = false;
+              if (!pipelined) setArbitrationClient(fd, ADAPTER);
+            }
+            continue;
+          }
+          if (d._clientFd != fd) continue;
+          if (d._c == STARTED) {
+            telegrams++;
+            sending = true;
+            if (!pipelined) continue;
+          }
+          // lost or failed, try again at the next SYN
+          setArbitrationClient(fd, ADAPTER);
+        }
+      },
+      duration);
+  removeArbitrationClient(fd);
+
+  return telegrams * 60.0 * 1000 * 1000 / duration;
+}
+
+bool pipelining(int& fd, uint64_t duration) {
+  const struct {
+    const char* name;
+    std::vector<RandomSource::Master> masters;
+  } buses[] = {
+      {"pipelining on a quiet bus", {{0x10, 0.05}}},
+      {"pipelining on a busy bus", {{0x10, 0.3}, {0x03, 0.2}, {0x71, 0.1}}},
+  };
+
+  bool ok = true;
+  for (const auto& run : buses) {
+    const double before = telegramsPerMinute(run.masters, false, fd++, duration);
+    const double after = telegramsPerMinute(run.masters, true, fd++, duration);
+    const bool faster = after > before;
+    std::printf("%-4s %-32s %.0f telegrams/min, %.0f without\n",
+                faster ? "ok" : "FAIL", run.name, after, before);
+    ok &= faster;
+  }
+  return ok;
+}
+
+struct BenchmarkCase {
+  const char* name;
+  SimulatedBus::Latency latency;
+  std::vector<RandomSource::Master> masters;
+  double request;  // probability that an idle client asks for the bus
+};
+
+void benchmark(const BenchmarkCase& benchmark, int fd, uint64_t duration) {
+  BusType bus;
+  bus.begin();
+  SimulatedBus simulated(benchmark.latency, 42);
+  RandomSource source(benchmark.masters, ADAPTER, 7);
+  Client client{fd, 0, false};
+  std::mt19937 random(3);
+  std::bernoulli_distribution request(benchmark.request);
+
+  simulated.run(
+      source,
+      [&] {
+        if (!client.waiting && request(random)) client.request();
+        wake(bus, simulated, client);
+      },
+      duration);
+
+  const ArbitrationStatistics statistics = clientStatistics(fd);
+  removeArbitrationClient(fd);
+  const SimulatedBus::Statistics& simulation = simulated.statistics();
+  const uint32_t arbitrations = bus._nbrArbitrations;
+  const uint32_t results = bus._nbrWon1 + bus._nbrWon2 + bus._nbrLost1 +
+                           bus._nbrLost2 + bus._nbrErrors + bus._nbrLate;
+  auto rate = [&](uint32_t count) {
+    return results > 0 ? 100.0 * count / results : 0.0;
+  };
+
+  std::printf("\n%s\n", benchmark.name);
+  std::printf("  symbols %" PRIu32 ", %.1f ns per symbol, %" PRIu32
+              " bursts, largest %zu, %" PRIu32 " events dropped\n",
+              simulation.symbols,
+              simulation.symbols > 0
+                  ? double(simulation.hostNanos) / simulation.symbols
+                  : 0.0,
+              simulation.bursts, simulation.maxBurst,
+              simulation.droppedEvents);
+  std::printf("  arbitrations %" PRIu32 ": won %.1f%% lost %.1f%% error %.1f%%"
+              " late %.1f%%, restarts %d\n",
+              arbitrations, rate(bus._nbrWon1 + bus._nbrWon2),
+              rate(bus._nbrLost1 + bus._nbrLost2), rate(bus._nbrErrors),
+              rate(bus._nbrLate), bus._nbrRestarts1 + bus._nbrRestarts2);
+  std::printf("  client requests %" PRIu32 ", mean wait %.1f ms\n",
+              statistics.requests,
+              statistics.won + statistics.lost + statistics.errors > 0
+                  ? statistics.waitTotal / 1000.0 /
+                        (statistics.won + statistics.lost + statistics.errors)
+                  : 0.0);
+  std::printf("  address writes %" PRIu32 ": early %" PRIu32 " late %" PRIu32
+              " outside the slot %" PRIu32 "\n",
+              simulation.writes, simulation.early, simulation.late,
+              simulation.stray);
+
+  std::printf("  SYN to address");
+  const uint32_t* histogram = bus.latencyHistogram();
+  for (int i = 0; i < Arbitration::LATENCY_BUCKETS; i++) {
+    if (histogram[i] == 0) continue;
+    const uint32_t from =
+        i == 0 ? 0
+               : Arbitration::LATENCY_FIRST_US +
+                     (i - 1) * Arbitration::LATENCY_BUCKET_US;
+    std::printf(" %" PRIu32 "us:%" PRIu32, from, histogram[i]);
+  }
+  std::printf("\n");
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const uint64_t seconds = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 60;
+
+  bool ok = true;
+  int fd = 100;
+  for (const TraceCase& trace : traces) ok &= replay(trace, fd++);
+  ok &= longBurst();
+  ok &= burstTimestamps("burst start bits", 24, 1000);
+  ok &= burstTimestamps("long burst start bits", 40, 0);
+  ok &= pipelining(fd, seconds * 1000 * 1000);
+
+  SimulatedBus::Latency fast;
+  SimulatedBus::Latency stalls;
+  stalls.stallProbability = 0.02;
+  stalls.stall = 5000;
+
+  const BenchmarkCase benchmarks[] = {
+      {"quiet bus", fast, {{0x10, 0.05}}, 0.2},
+      {"busy bus", fast, {{0x10, 0.3}, {0x03, 0.2}, {0x17, 0.2}, {0x71, 0.1}},
+       0.5},
+      {"busy bus with task stalls", stalls,
+       {{0x10, 0.3}, {0x03, 0.2}, {0x17, 0.2}, {0x71, 0.1}},
+       0.5},
+  };
+  for (const BenchmarkCase& run : benchmarks)
+    benchmark(run, fd++, seconds * 1000 * 1000);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// the debug log goes nowhere on the host
+int DEBUG_LOG_IMPL(const char* format, ...) { return 0; }
@@ -0,0 +1,198 @@
+// Host test of the tcp clients of client.cpp on loopback sockets. Checks the
+// ring buffer of a client: data that wraps around its end arrives in order,
+// and a client that does not read is disconnected once 512 bytes wait. Then
+// measures bus bytes sent to a client in batches of one writev per pass of
+// the data loop against a send per byte as before the buffers.
+//
+// usage: client_test [rounds]
+
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <lwip/sockets.h>
+
+#include "client.hpp"
+
+namespace {
+// A connected pair on loopback, client is set up like handleNewClient does
+bool connectPair(int& client, int& peer) {
+  const int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(addr);
+  if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(listenFd, 1) != 0 ||
+      getsockname(listenFd, reinterpret_cast<sockaddr*>(&addr), &length) != 0)
+    return false;
+
+  peer = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(peer, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+    return false;
+  client = accept(listenFd, nullptr, nullptr);
+  close(listenFd);
+  if (client < 0) return false;
+
+  int flags = fcntl(client, F_GETFL, 0);
+  fcntl(client, F_SETFL, flags | O_NONBLOCK);
+  int noDelay = 1;
+  setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  setsockopt(peer, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  return true;
+}
+
+bool receive(int fd, std::vector<uint8_t>& data, size_t size) {
+  data.resize(size);
+  size_t received = 0;
+  while (received < size) {
+    const ssize_t result = recv(fd, &data[received], size - received, 0);
+    if (result <= 0) return false;
+    received += static_cast<size_t>(result);
+  }
+  return true;
+}
+
+bool report(bool ok, const char* name, const std::string& detail) {
+  std::printf("%-4s %-32s %s\n", ok ? "ok" : "FAIL", name, detail.c_str());
+  return ok;
+}
+
+bool wrapAround() {
+  WifiClient client;
+  int peer;
+  if (!connectPair(client.fd, peer)) return report(false, "wrap around", "");
+
+  // the second batch starts at 300 and wraps around the end of the ring
+  bool ok = true;
+  std::vector<uint8_t> data;
+  size_t sent = 0;
+  for (size_t batch : {300, 400}) {
+    for (size_t i = 0; i < batch; i++)
+      ok &= pushClient(&client, static_cast<uint8_t>(sent + i)) == 1;
+    ok &= flushClient(&client) && client.length == 0;
+    ok &= receive(peer, data, batch);
+    for (size_t i = 0; i < batch && ok; i++)
+      ok &= data[i] == static_cast<uint8_t>(sent + i);
+    sent += batch;
+  }
+
+  close(client.fd);
+  close(peer);
+  return report(ok, "wrap around", std::to_string(sent) + " bytes in order");
+}
+
+bool overflow() {
+  WifiClient client;
+  int peer;
+  if (!connectPair(client.fd, peer)) return report(false, "overflow", "");
+
+  // nothing is flushed, as if the client stopped reading
+  const uint32_t overflows = clientOverflows();
+  bool ok = true;
+  for (size_t i = 0; i < CLIENT_BUFFER_SIZE; i++)
+    ok &= pushClient(&client, static_cast<uint8_t>(i)) == 1;
+  ok &= client.fd >= 0 && client.length == CLIENT_BUFFER_SIZE;
+
+  const int fd = client.fd;
+  ok &= pushClient(&client, 0) == 0;
+  ok &= client.fd < 0 && client.length == 0 &&
+        clientOverflows() == overflows + 1 && !flushClient(&client);
+
+  // the peer sees the connection closed without any of the data
+  std::vector<uint8_t> data;
+  ok &= !receive(peer, data, 1);
+
+  close(peer);
+  return report(ok && fcntl(fd, F_GETFD) < 0, "overflow closes the client",
+                std::to_string(CLIENT_BUFFER_SIZE) + " bytes buffered");
+}
+
+using Clock = std::chrono::steady_clock;
+
+struct Throughput {
+  double bytesPerSecond = 0;
+  double meanUs = 0;  // from the first byte of a batch until all arrived
+  double maxUs = 0;
+  uint64_t calls = 0;  // socket calls of the sending side
+};
+
+// One round per pass of the data loop: the bus bytes of the pass are handed
+// to the client, then the peer reads them
+Throughput measure(size_t batch, int rounds, bool batched) {
+  WifiClient client;
+  int peer;
+  Throughput result;
+  if (!connectPair(client.fd, peer)) return result;
+
+  std::vector<uint8_t> data;
+  double totalUs = 0;
+  for (int round = 0; round < rounds; round++) {
+    const auto begin = Clock::now();
+    if (batched) {
+      for (size_t i = 0; i < batch; i++)
+        pushClient(&client, static_cast<uint8_t>(i));
+      flushClient(&client);
+      result.calls++;
+    } else {
+      // the path before the buffers checked and sent every byte on its own
+      for (size_t i = 0; i < batch; i++) {
+        char byte = 0;
+        recv(client.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        const uint8_t value = static_cast<uint8_t>(i);
+        send(client.fd, &value, 1, 0);
+        result.calls += 2;
+      }
+    }
+    if (!receive(peer, data, batch)) break;
+    const double us =
+        std::chrono::duration<double, std::micro>(Clock::now() - begin)
+            .count();
+    totalUs += us;
+    if (us > result.maxUs) result.maxUs = us;
+  }
+
+  result.meanUs = totalUs / rounds;
+  result.bytesPerSecond = batch * rounds / (totalUs / 1e6);
+  close(client.fd);
+  close(peer);
+  return result;
+}
+
+void benchmark(size_t batch, int rounds) {
+  const Throughput bytewise = measure(batch, rounds, false);
+  const Throughput batched = measure(batch, rounds, true);
+  for (const Throughput* result : {&bytewise, &batched})
+    std::printf(
+        "  %3zu bytes per pass, %-9s %9.0f bytes/s, %6.1f us mean, %7.1f us "
+        "max, %6.2f calls per pass\n",
+        batch, result == &batched ? "writev" : "per byte",
+        result->bytesPerSecond, result->meanUs, result->maxUs,
+        static_cast<double>(result->calls) / rounds);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const int rounds = argc > 1 ? std::atoi(argv[1]) : 2000;
+
+  // lwIP has no SIGPIPE, a write to a closed peer only fails
+  signal(SIGPIPE, SIG_IGN);
+
+  bool ok = true;
+  ok &= wrapAround();
+  ok &= overflow();
+
+  std::printf("\nbus bytes to a client over loopback, %d passes\n", rounds);
+  for (size_t batch : {1, 8, 32, 128}) benchmark(batch, rounds);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// the debug log goes nowhere on the host
+int DEBUG_LOG_IMPL(const char* format, ...) { return 0; }
@@ -0,0 +1,139 @@
+// Host benchmark of the passive command index of Store. Matches telegrams
+// against 1,000 synthetic definitions with PassiveIndex and with a scan of
+// all definitions, checks both find the same commands, also after removing
+// some of them, and reports the time per telegram.
+//
+// usage: passive_benchmark [definitions] [telegrams]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "PassiveIndex.hpp"
+
+namespace {
+struct Definition {
+  std::vector<uint8_t> readCmd;  // ZZ PB SB ...
+};
+
+// read_cmd follows the QQ of the master part
+bool contains(const std::vector<uint8_t>& master,
+              const std::vector<uint8_t>& readCmd) {
+  if (master.size() < readCmd.size() + 1) return false;
+  return std::equal(readCmd.begin(), readCmd.end(), master.begin() + 1);
+}
+
+std::vector<Definition> makeDefinitions(size_t count, std::mt19937& random) {
+  const uint8_t targets[] = {0x08, 0x15, 0x26, 0x52, 0x64, 0x76, 0xf6, 0xfe};
+  const uint8_t primaries[] = {0x07, 0xb5, 0xb5, 0xb5};
+  std::uniform_int_distribution<int> byte(0x00, 0xff);
+  std::uniform_int_distribution<int> extra(1, 4);
+
+  std::vector<Definition> definitions(count);
+  for (size_t i = 0; i < count; i++) {
+    std::vector<uint8_t>& readCmd = definitions[i].readCmd;
+    if (i % 100 == 0) {
+      // a few match on the target alone and are always checked
+      readCmd = {targets[i % 8]};
+      continue;
+    }
+    readCmd = {targets[byte(random) % 8], primaries[byte(random) % 4],
+               static_cast<uint8_t>(byte(random) % 32)};
+    for (int n = extra(random); n > 0; n--)
+      readCmd.push_back(static_cast<uint8_t>(byte(random)));
+  }
+  return definitions;
+}
+
+// Half of the telegrams are built from a definition, the rest are random
+std::vector<std::vector<uint8_t>> makeTelegrams(
+    const std::vector<Definition>& definitions, size_t count,
+    std::mt19937& random) {
+  std::uniform_int_distribution<int> byte(0x00, 0xff);
+  std::uniform_int_distribution<size_t> pick(0, definitions.size() - 1);
+
+  std::vector<std::vector<uint8_t>> telegrams(count);
+  for (size_t i = 0; i < count; i++) {
+    std::vector<uint8_t>& master = telegrams[i];
+    master.push_back(0x10);
+    if (i % 2 == 0) {
+      const std::vector<uint8_t>& readCmd = definitions[pick(random)].readCmd;
+      master.insert(master.end(), readCmd.begin(), readCmd.end());
+    }
+    while (master.size() < 10) master.push_back(byte(random));
+  }
+  return telegrams;
+}
+
+template <typename Find>
+double measure(const std::vector<std::vector<uint8_t>>& telegrams,
+               size_t& matches, Find find) {
+  matches = 0;
+  const auto begin = std::chrono::steady_clock::now();
+  for (const std::vector<uint8_t>& master : telegrams) matches += find(master);
+  const auto elapsed = std::chrono::steady_clock::now() - begin;
+  return std::chrono::duration<double, std::nano>(elapsed).count() /
+         telegrams.size();
+}
+
+bool compare(const std::vector<Definition>& definitions,
+             const std::vector<bool>& present,
+             const PassiveIndex<const Definition>& index,
+             const std::vector<std::vector<uint8_t>>& telegrams,
+             const char* name) {
+  size_t scanned = 0;
+  const double scan = measure(telegrams, scanned, [&](const auto& master) {
+    size_t count = 0;
+    for (size_t i = 0; i < definitions.size(); i++)
+      if (present[i] && contains(master, definitions[i].readCmd)) count++;
+    return count;
+  });
+
+  size_t indexed = 0;
+  const double lookup = measure(telegrams, indexed, [&](const auto& master) {
+    size_t count = 0;
+    index.find(master, [&](const Definition* definition) {
+      if (contains(master, definition->readCmd)) count++;
+    });
+    return count;
+  });
+
+  const bool ok = scanned == indexed;
+  std::printf("%-4s %-20s %zu commands, %zu matches, scan %.1f ns, index "
+              "%.1f ns per telegram (%.0fx)\n",
+              ok ? "ok" : "FAIL", name, index.size(), indexed, scan, lookup,
+              lookup > 0 ? scan / lookup : 0.0);
+  return ok;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+  const size_t telegramCount =
+      argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000;
+
+  std::mt19937 random(11);
+  const std::vector<Definition> definitions = makeDefinitions(count, random);
+  const std::vector<std::vector<uint8_t>> telegrams =
+      makeTelegrams(definitions, telegramCount, random);
+
+  PassiveIndex<const Definition> index;
+  std::vector<bool> present(count, true);
+  for (const Definition& definition : definitions)
+    index.insert(&definition, definition.readCmd);
+
+  bool ok = compare(definitions, present, index, telegrams, "all inserted");
+
+  // the index is kept up to date when commands are removed
+  for (size_t i = 0; i < count; i += 3) {
+    index.erase(&definitions[i], definitions[i].readCmd);
+    present[i] = false;
+  }
+  ok &= compare(definitions, present, index, telegrams, "a third removed");
+
+  std::printf("index heap %zu bytes\n", index.heapUsage());
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,465 @@
+// Host benchmark of saving and loading the commands of Store, the binary
+// record file against the JSON file it replaced. Synthetic commands are
+// written with the fields of kRecordFields in Store.cpp, as records with
+// RecordWriter and as the old rows of values behind a header of the field
+// names with JsonWriter, which formats like cJSON_PrintUnformatted. Both hold
+// deadband and adaptive_limits, which came after the JSON file. Loading
+// reads the records one at a time, the JSON file as a whole before its rows
+// are taken apart.
+//
+// The old format was built and parsed with cJSON documents, the streamed
+// JSON here is cheaper than that, so the times are a lower bound for the old
+// format. File access is a host temporary file, not LittleFS on flash.
+//
+// usage: record_benchmark [commands] [rounds]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "JsonScanner.hpp"
+#include "JsonWriter.hpp"
+#include "RecordFile.hpp"
+
+namespace {
+constexpr uint8_t kMagic[4] = {'E', 'B', 'C', 'R'};
+
+// The fields of kRecordFields
+struct StoredCommand {
+  std::string key;
+  std::string name;
+  std::vector<uint8_t> read_cmd;
+  std::vector<uint8_t> write_cmd;
+  bool active = false;
+  uint32_t interval = 60;
+  bool adaptive = false;
+  uint32_t min_interval = 10;
+  uint32_t max_interval = 600;
+  bool master = false;
+  uint32_t position = 1;
+  std::string datatype;
+  float divider = 1;
+  float min = 1;
+  float max = 100;
+  uint8_t digits = 2;
+  std::string unit;
+  bool ha = false;
+  std::string ha_component;
+  std::string ha_device_class;
+  std::string ha_entity_category;
+  std::string ha_mode;
+  std::map<int, std::string> ha_key_value_map;
+  int32_t ha_default_key = 0;
+  uint8_t ha_payload_on = 1;
+  uint8_t ha_payload_off = 0;
+  std::string ha_state_class;
+  float ha_step = 1;
+  float deadband = 0;
+  bool adaptive_limits = false;
+
+  bool operator==(const StoredCommand& other) const {
+    return key == other.key && name == other.name &&
+           read_cmd == other.read_cmd && write_cmd == other.write_cmd &&
+           active == other.active && interval == other.interval &&
+           datatype == other.datatype && divider == other.divider &&
+           unit == other.unit && ha == other.ha &&
+           ha_key_value_map == other.ha_key_value_map &&
+           ha_step == other.ha_step && deadband == other.deadband;
+  }
+};
+
+const char* const kFieldNames[] = {
+    "key", "name", "read_cmd", "write_cmd", "active", "interval", "adaptive",
+    "min_interval", "max_interval", "master", "position", "datatype",
+    "divider", "min", "max", "digits", "unit", "ha", "ha_component",
+    "ha_device_class", "ha_entity_category", "ha_mode", "ha_key_value_map",
+    "ha_default_key", "ha_payload_on", "ha_payload_off", "ha_state_class",
+    "ha_step", "deadband", "adaptive_limits"};
+constexpr size_t kFieldCount = sizeof(kFieldNames) / sizeof(kFieldNames[0]);
+
+// A mix like a heating installation: temperatures and pressures, some
+// writable, half of them with Home Assistant fields, a few with a map
+std::vector<StoredCommand> makeCommands(size_t count) {
+  const char* const datatypes[] = {"DATA2c", "DATA1c", "UINT8", "UINT16"};
+  const char* const units[] = {"°C", "bar", "%", ""};
+  const float dividers[] = {16, 2, 1, 10};
+  std::vector<StoredCommand> commands(count);
+  for (size_t i = 0; i < count; i++) {
+    StoredCommand& command = commands[i];
+    const size_t kind = i % 4;
+    command.key = "hc" + std::to_string(i % 3 + 1) + "_value_" +
+                  std::to_string(i);
+    command.name = "Heating circuit " + std::to_string(i % 3 + 1) +
+                   " value " + std::to_string(i);
+    command.read_cmd = {0x08, 0xb5, 0x09, 0x03, 0x0d,
+                        static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8)};
+    if (i % 5 == 0)
+      command.write_cmd = {0x08, 0xb5, 0x09, 0x0e, static_cast<uint8_t>(i),
+                           static_cast<uint8_t>(i >> 8)};
+    command.active = i % 2 == 0;
+    command.interval = 60 + 30 * (i % 4);
+    command.position = 1 + i % 3;
+    command.datatype = datatypes[kind];
+    command.divider = dividers[kind];
+    command.min = kind == 0 ? -20 : 0;
+    command.max = kind == 0 ? 90 : 100;
+    command.digits = kind == 0 ? 2 : 0;
+    command.unit = units[kind];
+    command.deadband = kind == 0 ? 0.5f : 0;
+    command.ha = i % 2 == 0;
+    if (command.ha) {
+      command.ha_component = kind == 2 ? "select" : "sensor";
+      command.ha_device_class = kind == 0 ? "temperature" : "";
+      command.ha_state_class = "measurement";
+      if (kind == 2)
+        command.ha_key_value_map = {{0, "off"}, {1, "auto"}, {2, "day"}};
+    }
+  }
+  return commands;
+}
+
+void encodeRecord(const StoredCommand& command, std::string& out) {
+  RecordWriter record(out);
+  record.u8(kFieldCount);
+  record.string(command.key);
+  record.string(command.name);
+  record.bytes(command.read_cmd);
+  record.bytes(command.write_cmd);
+  record.u8(command.active);
+  record.u32(command.interval);
+  record.u8(command.adaptive);
+  record.u32(command.min_interval);
+  record.u32(command.max_interval);
+  record.u8(command.master);
+  record.u32(command.position);
+  record.string(command.datatype);
+  record.f32(command.divider);
+  record.f32(command.min);
+  record.f32(command.max);
+  record.u8(command.digits);
+  record.string(command.unit);
+  record.u8(command.ha);
+  record.string(command.ha_component);
+  record.string(command.ha_device_class);
+  record.string(command.ha_entity_category);
+  record.string(command.ha_mode);
+  record.u16(static_cast<uint16_t>(command.ha_key_value_map.size()));
+  for (const auto& entry : command.ha_key_value_map) {
+    record.u32(static_cast<uint32_t>(entry.first));
+    record.string(entry.second);
+  }
+  record.u32(static_cast<uint32_t>(command.ha_default_key));
+  record.u8(command.ha_payload_on);
+  record.u8(command.ha_payload_off);
+  record.string(command.ha_state_class);
+  record.f32(command.ha_step);
+  record.f32(command.deadband);
+  record.u8(command.adaptive_limits);
+}
+
+bool decodeRecord(const std::vector<uint8_t>& data, StoredCommand& command) {
+  RecordReader record(data.data(), data.size());
+  if (record.u8() != kFieldCount) return false;
+  command.key = record.string();
+  command.name = record.string();
+  command.read_cmd = record.bytes();
+  command.write_cmd = record.bytes();
+  command.active = record.u8() != 0;
+  command.interval = record.u32();
+  command.adaptive = record.u8() != 0;
+  command.min_interval = record.u32();
+  command.max_interval = record.u32();
+  command.master = record.u8() != 0;
+  command.position = record.u32();
+  command.datatype = record.string();
+  command.divider = record.f32();
+  command.min = record.f32();
+  command.max = record.f32();
+  command.digits = record.u8();
+  command.unit = record.string();
+  command.ha = record.u8() != 0;
+  command.ha_component = record.string();
+  command.ha_device_class = record.string();
+  command.ha_entity_category = record.string();
+  command.ha_mode = record.string();
+  command.ha_key_value_map.clear();
+  const uint16_t entries = record.u16();
+  for (uint16_t i = 0; i < entries && record.valid(); i++) {
+    const int key = static_cast<int32_t>(record.u32());
+    command.ha_key_value_map[key] = record.string();
+  }
+  command.ha_default_key = static_cast<int32_t>(record.u32());
+  command.ha_payload_on = record.u8();
+  command.ha_payload_off = record.u8();
+  command.ha_state_class = record.string();
+  command.ha_step = record.f32();
+  command.deadband = record.f32();
+  command.adaptive_limits = record.u8() != 0;
+  return record.valid();
+}
+
+std::string hex(const std::vector<uint8_t>& bytes) {
+  static const char digits[] = "0123456789abcdef";
+  std::string text;
+  for (uint8_t byte : bytes) {
+    text += digits[byte >> 4];
+    text += digits[byte & 0x0f];
+  }
+  return text;
+}
+
+std::vector<uint8_t> unhex(const std::string& text) {
+  std::vector<uint8_t> bytes;
+  for (size_t i = 0; i + 1 < text.size(); i += 2)
+    bytes.push_back(static_cast<uint8_t>(
+        std::strtoul(text.substr(i, 2).c_str(), nullptr, 16)));
+  return bytes;
+}
+
+// The rows of the old commands.json, values in the order of the header
+void encodeJson(const std::vector<StoredCommand>& commands, std::string& out) {
+  JsonWriter json(out);
+  json.beginArray();
+  json.beginArray();
+  for (const char* name : kFieldNames) json.value(name);
+  json.endArray();
+  for (const StoredCommand& command : commands) {
+    json.beginArray();
+    json.value(command.key);
+    json.value(command.name);
+    json.value(hex(command.read_cmd));
+    json.value(hex(command.write_cmd));
+    json.value(command.active);
+    json.value(command.interval);
+    json.value(command.adaptive);
+    json.value(command.min_interval);
+    json.value(command.max_interval);
+    json.value(command.master);
+    json.value(command.position);
+    json.value(command.datatype);
+    json.value(static_cast<double>(command.divider));
+    json.value(static_cast<double>(command.min));
+    json.value(static_cast<double>(command.max));
+    json.value(static_cast<uint32_t>(command.digits));
+    json.value(command.unit);
+    json.value(command.ha);
+    json.value(command.ha_component);
+    json.value(command.ha_device_class);
+    json.value(command.ha_entity_category);
+    json.value(command.ha_mode);
+    json.beginObject();
+    for (const auto& entry : command.ha_key_value_map) {
+      json.key(std::to_string(entry.first).c_str());
+      json.value(entry.second);
+    }
+    json.endObject();
+    json.value(command.ha_default_key);
+    json.value(static_cast<uint32_t>(command.ha_payload_on));
+    json.value(static_cast<uint32_t>(command.ha_payload_off));
+    json.value(command.ha_state_class);
+    json.value(static_cast<double>(command.ha_step));
+    json.value(static_cast<double>(command.deadband));
+    json.value(command.adaptive_limits);
+    json.endArray();
+  }
+  json.endArray();
+}
+
+// The synthetic texts need no escapes
+std::string text(const char* value, size_t length) {
+  return length >= 2 ? std::string(value + 1, length - 2) : std::string();
+}
+
+double number(const char* value, size_t length) {
+  return std::strtod(std::string(value, length).c_str(), nullptr);
+}
+
+bool flag(const char* value, size_t length) { return length == 4; }
+
+bool decodeRow(const char* row, size_t length, StoredCommand& command) {
+  size_t field = 0;
+  const bool valid = JsonScanner::forEachElement(
+      row, length, [&](const char* value, size_t valueLength) {
+        switch (field++) {
+          case 0: command.key = text(value, valueLength); break;
+          case 1: command.name = text(value, valueLength); break;
+          case 2: command.read_cmd = unhex(text(value, valueLength)); break;
+          case 3: command.write_cmd = unhex(text(value, valueLength)); break;
+          case 4: command.active = flag(value, valueLength); break;
+          case 5: command.interval = number(value, valueLength); break;
+          case 6: command.adaptive = flag(value, valueLength); break;
+          case 7: command.min_interval = number(value, valueLength); break;
+          case 8: command.max_interval = number(value, valueLength); break;
+          case 9: command.master = flag(value, valueLength); break;
+          case 10: command.position = number(value, valueLength); break;
+          case 11: command.datatype = text(value, valueLength); break;
+          case 12: command.divider = number(value, valueLength); break;
+          case 13: command.min = number(value, valueLength); break;
+          case 14: command.max = number(value, valueLength); break;
+          case 15: command.digits = number(value, valueLength); break;
+          case 16: command.unit = text(value, valueLength); break;
+          case 17: command.ha = flag(value, valueLength); break;
+          case 18: command.ha_component = text(value, valueLength); break;
+          case 19: command.ha_device_class = text(value, valueLength); break;
+          case 20: command.ha_entity_category = text(value, valueLength); break;
+          case 21: command.ha_mode = text(value, valueLength); break;
+          case 22: {
+            // the keys of the synthetic maps are below 16
+            command.ha_key_value_map.clear();
+            JsonScanner map(value, valueLength);
+            for (int key = 0; key < 16; key++) {
+              const char* entry = nullptr;
+              size_t entryLength = 0;
+              if (map.findMember(std::to_string(key).c_str(), entry,
+                                 entryLength))
+                command.ha_key_value_map[key] = text(entry, entryLength);
+            }
+            break;
+          }
+          case 23: command.ha_default_key = number(value, valueLength); break;
+          case 24: command.ha_payload_on = number(value, valueLength); break;
+          case 25: command.ha_payload_off = number(value, valueLength); break;
+          case 26: command.ha_state_class = text(value, valueLength); break;
+          case 27: command.ha_step = number(value, valueLength); break;
+          case 28: command.deadband = number(value, valueLength); break;
+          case 29: command.adaptive_limits = flag(value, valueLength); break;
+        }
+        return true;
+      });
+  return valid && field == kFieldCount;
+}
+
+using Clock = std::chrono::steady_clock;
+
+double microseconds(Clock::duration elapsed) {
+  return std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+std::string fileContent(FILE* file) {
+  std::string content(static_cast<size_t>(std::ftell(file)), '\0');
+  std::rewind(file);
+  if (std::fread(&content[0], 1, content.size(), file) != content.size())
+    content.clear();
+  return content;
+}
+
+struct Result {
+  size_t bytes = 0;
+  size_t largestBuffer = 0;  // held at once while loading
+  double saveUs = 0;
+  double loadUs = 0;
+  bool loaded = false;
+};
+
+Result recordFile(const std::vector<StoredCommand>& commands, int rounds) {
+  Result result;
+  result.loaded = true;
+  for (int round = 0; round < rounds; round++) {
+    FILE* file = std::tmpfile();
+    auto begin = Clock::now();
+    bool written = writeRecordHeader(file, kMagic);
+    std::string record;
+    for (const StoredCommand& command : commands) {
+      record.clear();
+      encodeRecord(command, record);
+      written = written && writeRecord(file, record);
+    }
+    std::fflush(file);
+    result.saveUs += microseconds(Clock::now() - begin);
+    result.bytes = static_cast<size_t>(std::ftell(file));
+    result.loaded &= written;
+
+    std::rewind(file);
+    std::vector<StoredCommand> loaded;
+    loaded.reserve(commands.size());
+    int64_t bytes = 0;
+    begin = Clock::now();
+    RecordRead read = readRecords(
+        file, kMagic,
+        [&](const std::vector<uint8_t>& data) {
+          if (data.size() > result.largestBuffer)
+            result.largestBuffer = data.size();
+          loaded.emplace_back();
+          if (!decodeRecord(data, loaded.back())) loaded.pop_back();
+        },
+        bytes);
+    result.loadUs += microseconds(Clock::now() - begin);
+    std::fclose(file);
+    result.loaded &= read == RecordRead::End && loaded == commands;
+  }
+  result.saveUs /= rounds;
+  result.loadUs /= rounds;
+  return result;
+}
+
+Result jsonFile(const std::vector<StoredCommand>& commands, int rounds) {
+  Result result;
+  result.loaded = true;
+  for (int round = 0; round < rounds; round++) {
+    FILE* file = std::tmpfile();
+    auto begin = Clock::now();
+    std::string payload;
+    encodeJson(commands, payload);
+    const bool written =
+        std::fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+    std::fflush(file);
+    result.saveUs += microseconds(Clock::now() - begin);
+    result.bytes = payload.size();
+    result.loaded &= written;
+
+    // the old load read the whole file into a string first
+    std::fseek(file, 0, SEEK_END);
+    std::vector<StoredCommand> loaded;
+    loaded.reserve(commands.size());
+    begin = Clock::now();
+    const std::string content = fileContent(file);
+    bool header = true;
+    const bool valid = JsonScanner::forEachElement(
+        content.data(), content.size(),
+        [&](const char* row, size_t length) {
+          if (header) {
+            header = false;
+            return true;
+          }
+          loaded.emplace_back();
+          return decodeRow(row, length, loaded.back());
+        });
+    result.loadUs += microseconds(Clock::now() - begin);
+    result.largestBuffer = content.size();
+    std::fclose(file);
+    result.loaded &= valid && loaded == commands;
+  }
+  result.saveUs /= rounds;
+  result.loadUs /= rounds;
+  return result;
+}
+
+void print(const char* name, const Result& result, size_t commands) {
+  std::printf(
+      "%-4s %-12s %7zu bytes, %5.1f per command, largest buffer %6zu bytes, "
+      "save %8.1f us, load %8.1f us\n",
+      result.loaded ? "ok" : "FAIL", name, result.bytes,
+      static_cast<double>(result.bytes) / commands, result.largestBuffer,
+      result.saveUs, result.loadUs);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 500;
+  const int rounds = argc > 2 ? std::atoi(argv[2]) : 20;
+
+  const std::vector<StoredCommand> commands = makeCommands(count);
+  std::printf("%zu commands, mean of %d rounds\n", count, rounds);
+  const Result records = recordFile(commands, rounds);
+  const Result json = jsonFile(commands, rounds);
+  print("records", records, count);
+  print("json", json, count);
+  std::printf("records: %.0f%% of the json size, save %.1fx, load %.1fx\n",
+              100.0 * records.bytes / json.bytes,
+              json.saveUs / records.saveUs, json.loadUs / records.loadUs);
+
+  return records.loaded && json.loaded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,173 @@
+// Host test of the record files behind the commands snapshot and journal of
+// Store. Writes a journal of insert and remove records, then replays it cut
+// off at every length and with each record damaged in turn: the records in
+// front of the damage are applied, nothing after it, and the replay reports
+// the torn tail.
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "RecordFile.hpp"
+
+namespace {
+constexpr uint8_t kMagic[4] = {'E', 'B', 'C', 'J'};
+
+enum Op : uint8_t { Insert = 1, Remove = 2 };
+
+using State = std::map<std::string, std::string>;
+
+// op, key length, key, value
+std::string makeRecord(Op op, const std::string& key,
+                       const std::string& value = "") {
+  std::string record(1, static_cast<char>(op));
+  record += static_cast<char>(key.size());
+  record += key + value;
+  return record;
+}
+
+void applyRecord(State& state, const std::vector<uint8_t>& record) {
+  const std::string text(record.begin(), record.end());
+  const std::string key = text.substr(2, static_cast<uint8_t>(text[1]));
+  if (text[0] == Insert)
+    state[key] = text.substr(2 + key.size());
+  else
+    state.erase(key);
+}
+
+FILE* fileWith(const std::string& content) {
+  FILE* file = std::tmpfile();
+  std::fwrite(content.data(), 1, content.size(), file);
+  std::rewind(file);
+  return file;
+}
+
+RecordRead replay(const std::string& content, State& state, int64_t& bytes) {
+  state.clear();
+  FILE* file = fileWith(content);
+  RecordRead result = readRecords(
+      file, kMagic,
+      [&](const std::vector<uint8_t>& record) { applyRecord(state, record); },
+      bytes);
+  std::fclose(file);
+  return result;
+}
+
+bool report(bool ok, const char* name, const std::string& detail) {
+  std::printf("%-4s %-36s %s\n", ok ? "ok" : "FAIL", name, detail.c_str());
+  return ok;
+}
+}  // namespace
+
+int main() {
+  bool ok = true;
+
+  // the check value of CRC-32, as esp_crc32_le(0, ...) returns it
+  const char* check = "123456789";
+  const uint32_t crc = recordChecksum(check, 9);
+  ok &= report(crc == 0xCBF43926, "checksum", std::to_string(crc));
+
+  // a journal with a record longer than 255 bytes for the 16 bit length
+  const std::vector<std::string> records = {
+      makeRecord(Insert, "a", "1"),
+      makeRecord(Insert, "b", "2"),
+      makeRecord(Insert, "c", std::string(300, 'x')),
+      makeRecord(Remove, "a"),
+      makeRecord(Insert, "b", "3"),
+      makeRecord(Insert, "d", ""),
+      makeRecord(Remove, "c"),
+  };
+
+  FILE* file = std::tmpfile();
+  bool written = writeRecordHeader(file, kMagic);
+  for (const std::string& record : records)
+    written = written && writeRecord(file, record);
+  std::string journal(static_cast<size_t>(std::ftell(file)), '\0');
+  std::rewind(file);
+  written = written && std::fread(&journal[0], 1, journal.size(), file) ==
+                           journal.size();
+  std::fclose(file);
+  ok &= report(written, "write", std::to_string(journal.size()) + " bytes");
+
+  // state and size of the file after each record
+  std::vector<State> states(1);
+  std::vector<int64_t> ends = {static_cast<int64_t>(kRecordHeaderSize)};
+  for (const std::string& record : records) {
+    State state = states.back();
+    applyRecord(state, std::vector<uint8_t>(record.begin(), record.end()));
+    states.push_back(state);
+    ends.push_back(ends.back() + kRecordFrameSize + record.size());
+  }
+
+  State state;
+  int64_t bytes;
+  RecordRead result = replay(journal, state, bytes);
+  ok &= report(result == RecordRead::End && state == states.back() &&
+                   bytes == ends.back(),
+               "complete journal", std::to_string(state.size()) + " keys");
+
+  // a reset while appending cuts the file anywhere
+  size_t failed = 0;
+  for (size_t length = 0; length < journal.size(); length++) {
+    result = replay(journal.substr(0, length), state, bytes);
+    size_t complete = 0;
+    while (complete + 1 < ends.size() &&
+           ends[complete + 1] <= static_cast<int64_t>(length))
+      complete++;
+    const bool boundary = length >= kRecordHeaderSize &&
+                          ends[complete] == static_cast<int64_t>(length);
+    const bool expected =
+        length < kRecordHeaderSize
+            ? result == RecordRead::Torn && state.empty() && bytes == 0
+            : result == (boundary ? RecordRead::End : RecordRead::Torn) &&
+                  state == states[complete] && bytes == ends[complete];
+    if (!expected) failed++;
+  }
+  ok &= report(failed == 0, "cut off at every length",
+               std::to_string(journal.size() - failed) + " of " +
+                   std::to_string(journal.size()) + " lengths");
+
+  // a damaged record stops the replay, later records are not trusted
+  failed = 0;
+  for (size_t i = 0; i < records.size(); i++) {
+    std::string damaged = journal;
+    damaged[ends[i] + 2] ^= 0x40;  // first data byte of record i
+    result = replay(damaged, state, bytes);
+    if (result != RecordRead::Torn || state != states[i] || bytes != ends[i])
+      failed++;
+  }
+  ok &= report(failed == 0, "damaged record",
+               std::to_string(records.size() - failed) + " of " +
+                   std::to_string(records.size()) + " records");
+
+  // appending behind a torn tail does not make the new record visible, this
+  // is why Store starts from a new snapshot after a torn replay
+  const std::string torn = journal.substr(0, journal.size() - 1);
+  file = std::tmpfile();
+  std::fwrite(torn.data(), 1, torn.size(), file);
+  writeRecord(file, makeRecord(Insert, "e", "5"));
+  std::rewind(file);
+  state.clear();
+  result = readRecords(
+      file, kMagic,
+      [&](const std::vector<uint8_t>& record) { applyRecord(state, record); },
+      bytes);
+  std::fclose(file);
+  ok &= report(result == RecordRead::Torn && state.count("e") == 0,
+               "append behind a torn tail", "");
+
+  // another magic or version is no journal
+  std::string other = journal;
+  other[0] = 'X';
+  result = replay(other, state, bytes);
+  ok &= report(result == RecordRead::Torn && state.empty(), "wrong magic", "");
+  other = journal;
+  other[kRecordHeaderSize - 1] = kRecordVersion + 1;
+  result = replay(other, state, bytes);
+  ok &= report(result == RecordRead::Torn && state.empty(), "wrong version",
+               "");
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,91 @@
+// Host test of the budget of the MQTT action queue. An insert of the maximum
+// request size with 500 commands is taken apart like Mqtt::insertCommands
+// does it, each command charged the text it was parsed from: the whole insert
+// fits, a second one fits behind it, a third one does not until the queued
+// commands are applied.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "JsonScanner.hpp"
+#include "RequestBudget.hpp"
+
+namespace {
+constexpr size_t kMaxRequestSize = 32 * 1024;  // default of Mqtt
+constexpr size_t kCommands = 500;
+
+// The smallest commands give the most actions per request byte
+std::string insertRequest(size_t commands) {
+  std::string request = "{\"id\":\"insert\",\"commands\":[";
+  char element[128];
+  for (size_t i = 0; i < commands; i++) {
+    std::snprintf(element, sizeof(element),
+                  "%s{\"key\":\"c%03zu\",\"name\":\"command %03zu\","
+                  "\"read_cmd\":\"08b509030d%04zx\"}",
+                  i > 0 ? "," : "", i, i, i);
+    request += element;
+  }
+  return request + "]}";
+}
+
+// Charges the commands of the request, returns how many fitted
+size_t queueInsert(const std::string& request, RequestBudget& budget,
+                   size_t& charged) {
+  JsonScanner scanner(request.data(), request.size());
+  const char* array = nullptr;
+  size_t length = 0;
+  if (!scanner.findMember("commands", array, length)) return 0;
+
+  size_t queued = 0;
+  JsonScanner::forEachElement(
+      array, length, [&](const char* value, size_t valueLength) {
+        if (!budget.take(valueLength)) return true;
+        charged += valueLength;
+        queued++;
+        return true;
+      });
+  return queued;
+}
+
+bool report(bool ok, const char* name, const std::string& detail) {
+  std::printf("%-4s %-36s %s\n", ok ? "ok" : "FAIL", name, detail.c_str());
+  return ok;
+}
+}  // namespace
+
+int main() {
+  bool ok = true;
+
+  const std::string request = insertRequest(kCommands);
+  ok &= report(request.size() <= kMaxRequestSize &&
+                   request.size() > kMaxRequestSize * 9 / 10,
+               "maximum size insert",
+               std::to_string(request.size()) + " bytes");
+
+  RequestBudget budget(kMaxRequestSize);
+  size_t charged = 0;
+  size_t queued = queueInsert(request, budget, charged);
+  ok &= report(queued == kCommands, "insert queued",
+               std::to_string(queued) + " of " + std::to_string(kCommands) +
+                   " commands, " + std::to_string(budget.bytes()) + " bytes");
+
+  queued = queueInsert(request, budget, charged);
+  ok &= report(queued == kCommands, "second insert queued",
+               std::to_string(queued) + " of " + std::to_string(kCommands) +
+                   " commands");
+
+  queued = queueInsert(request, budget, charged);
+  ok &= report(queued < kCommands, "third insert beyond the budget",
+               std::to_string(queued) + " of " + std::to_string(kCommands) +
+                   " commands");
+
+  // applying the queued commands gives their text back
+  budget.give(charged);
+  charged = 0;
+  queued = queueInsert(request, budget, charged);
+  ok &= report(budget.bytes() == charged && queued == kCommands,
+               "insert after applying", std::to_string(queued) + " commands");
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+// Subset of the ESP-IDF GPIO driver used by UartPort. The simulated bus calls
+// the handler at the falling edges of the symbols it puts on the bus.
+
+#include "esp_err.h"
+
+typedef int gpio_num_t;
+
+typedef enum {
+  GPIO_INTR_DISABLE = 0,
+  GPIO_INTR_POSEDGE = 1,
+  GPIO_INTR_NEGEDGE = 2,
+  GPIO_INTR_ANYEDGE = 3,
+} gpio_int_type_t;
+
+#define ESP_INTR_FLAG_IRAM (1 << 10)
+
+typedef void (*gpio_isr_t)(void* arg);
+
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type);
+esp_err_t gpio_intr_enable(gpio_num_t pin);
+esp_err_t gpio_install_isr_service(int flags);
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void* arg);
+esp_err_t gpio_isr_handler_remove(gpio_num_t pin);
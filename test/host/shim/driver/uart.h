@@ -0,0 +1,63 @@
+#pragma once
+
+// Subset of the ESP-IDF UART driver used by UartPort, implemented by the
+// simulated bus.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef int uart_port_t;
+
+#define UART_NUM_0 0
+#define UART_NUM_1 1
+#define UART_PIN_NO_CHANGE (-1)
+
+typedef enum {
+  UART_DATA_5_BITS = 0,
+  UART_DATA_6_BITS = 1,
+  UART_DATA_7_BITS = 2,
+  UART_DATA_8_BITS = 3,
+} uart_word_length_t;
+
+typedef enum { UART_PARITY_DISABLE = 0 } uart_parity_t;
+typedef enum { UART_STOP_BITS_1 = 1 } uart_stop_bits_t;
+typedef enum { UART_HW_FLOWCTRL_DISABLE = 0 } uart_hw_flowcontrol_t;
+typedef enum { UART_SCLK_DEFAULT = 0 } uart_sclk_t;
+
+typedef struct {
+  int baud_rate;
+  uart_word_length_t data_bits;
+  uart_parity_t parity;
+  uart_stop_bits_t stop_bits;
+  uart_hw_flowcontrol_t flow_ctrl;
+  uart_sclk_t source_clk;
+} uart_config_t;
+
+typedef enum {
+  UART_DATA,
+  UART_BREAK,
+  UART_BUFFER_FULL,
+  UART_FIFO_OVF,
+} uart_event_type_t;
+
+typedef struct {
+  uart_event_type_t type;
+  size_t size;
+} uart_event_t;
+
+esp_err_t uart_driver_install(uart_port_t port, int rxBufferSize,
+                              int txBufferSize, int queueSize,
+                              QueueHandle_t* queue, int intrFlags);
+esp_err_t uart_driver_delete(uart_port_t port);
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t* config);
+esp_err_t uart_set_pin(uart_port_t port, int txPin, int rxPin, int rtsPin,
+                       int ctsPin);
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t* size);
+int uart_read_bytes(uart_port_t port, void* buffer, uint32_t length,
+                    TickType_t ticksToWait);
+int uart_write_bytes(uart_port_t port, const void* src, size_t size);
+esp_err_t uart_flush_input(uart_port_t port);
+esp_err_t uart_set_rx_full_threshold(uart_port_t port, int threshold);
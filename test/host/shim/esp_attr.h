@@ -0,0 +1,4 @@
+#pragma once
+
+// code and data placement has no meaning on the host
+#define IRAM_ATTR
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdio>
+
+#define ESP_LOGE(tag, format, ...) \
+  std::fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) \
+  std::fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstdint>
+
+// Advances the clock of the simulated bus
+void esp_rom_delay_us(uint32_t us);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstdint>
+
+// Clock of the simulated bus
+int64_t esp_timer_get_time();
@@ -0,0 +1,19 @@
+#pragma once
+
+// Subset of FreeRTOS used by BusType. The host build runs without tasks: no
+// task is started, the simulated bus hands the UART events to BusType.
+
+#include <cstdint>
+
+typedef void* QueueHandle_t;
+typedef void* TaskHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef uint32_t UBaseType_t;
+
+#define configMAX_PRIORITIES 25
+#define portMAX_DELAY 0xffffffffUL
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
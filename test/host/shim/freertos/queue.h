@@ -0,0 +1,6 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t wait);
+BaseType_t xQueueReset(QueueHandle_t queue);
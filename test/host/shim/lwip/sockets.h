@@ -0,0 +1,19 @@
+#pragma once
+
+// lwIP offers BSD sockets, on the host they are the ones of the system
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+inline int lwip_writev(int fd, const struct iovec* iov, int count) {
+  return static_cast<int>(writev(fd, iov, count));
+}
+
+inline int lwip_ioctl(int fd, long request, void* arg) {
+  return ioctl(fd, request, arg);
+}
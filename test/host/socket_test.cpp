@@ -0,0 +1,186 @@
+// Host test of the data loop of client.cpp on the tcp ports of the adapter.
+// The loop runs in a thread of its own, waits in waitForSockets and serves
+// the sockets in handleReadySockets, like the data_loop task does: clients
+// are accepted up to MAX_WIFI_CLIENTS, a client that sends nothing or half a
+// command does not hold up the others and a closed client frees its slot
+// without keeping the loop busy.
+
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <lwip/sockets.h>
+
+#include "SimulatedBus.hpp"
+#include "client.hpp"
+#include "main.hpp"
+
+namespace {
+constexpr uint16_t kPortDefault = 3333;
+constexpr uint16_t kPortEnhanced = 3335;
+constexpr uint16_t kPortReadOnly = 3334;
+
+// INIT and its RESETTED answer in the enhanced protocol
+const uint8_t kInit[] = {0xc0, 0x80};
+const uint8_t kResetted[] = {0xc0, 0x80};
+
+int connectTo(uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  // a data loop that hangs fails the test instead of blocking it
+  timeval timeout{2, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  int noDelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  return fd;
+}
+
+// Reads until size bytes arrived, the peer closed or the timeout passed
+std::string receive(int fd, size_t size) {
+  std::string data;
+  char buffer[64];
+  while (data.size() < size) {
+    const ssize_t result =
+        recv(fd, buffer, std::min(sizeof(buffer), size - data.size()), 0);
+    if (result <= 0) break;
+    data.append(buffer, static_cast<size_t>(result));
+  }
+  return data;
+}
+
+bool closedByPeer(int fd) {
+  char byte;
+  return recv(fd, &byte, 1, 0) == 0;
+}
+
+// The enhanced client is served, answered within the timeout
+bool answersInit(int fd) {
+  if (send(fd, kInit, sizeof(kInit), 0) != sizeof(kInit)) return false;
+  return receive(fd, sizeof(kResetted)) ==
+         std::string(reinterpret_cast<const char*>(kResetted),
+                     sizeof(kResetted));
+}
+
+double cpuMillis(pthread_t thread) {
+  clockid_t clock;
+  timespec time{};
+  if (pthread_getcpuclockid(thread, &clock) != 0 ||
+      clock_gettime(clock, &time) != 0)
+    return -1;
+  return time.tv_sec * 1e3 + time.tv_nsec / 1e6;
+}
+
+bool report(bool ok, const char* name, const std::string& detail) {
+  std::printf("%-4s %-36s %s\n", ok ? "ok" : "FAIL", name, detail.c_str());
+  return ok;
+}
+
+bool acceptAll() {
+  const int plain = connectTo(kPortDefault);
+  const int enhanced = connectTo(kPortEnhanced);
+  const int readOnly = connectTo(kPortReadOnly);
+
+  // bus bytes of a plain client are taken off its socket and not answered
+  const uint8_t symbols[] = {0x10, 0x08, 0xb5};
+  bool ok = plain >= 0 && readOnly >= 0 &&
+            send(plain, symbols, sizeof(symbols), 0) == sizeof(symbols);
+  ok &= enhanced >= 0 && answersInit(enhanced);
+
+  for (int fd : {plain, enhanced, readOnly}) close(fd);
+  return report(ok, "accept on all ports", "enhanced client answered");
+}
+
+bool idleClients() {
+  // one client connected but silent, one with the first byte of a command
+  const int idle = connectTo(kPortEnhanced);
+  const int partial = connectTo(kPortEnhanced);
+  const int active = connectTo(kPortEnhanced);
+  bool ok = idle >= 0 && partial >= 0 && active >= 0;
+
+  ok &= send(partial, kInit, 1, 0) == 1;
+  const std::string message = receive(partial, 64);
+  ok &= message == "second command missing" && closedByPeer(partial);
+
+  ok &= answersInit(active);
+  ok &= answersInit(idle);
+
+  for (int fd : {idle, partial, active}) close(fd);
+  return report(ok, "reads without blocking",
+                "half a command: '" + message + "'");
+}
+
+bool disconnect(pthread_t loop) {
+  std::vector<int> clients;
+  bool ok = true;
+  for (int i = 0; i < MAX_WIFI_CLIENTS; i++) {
+    clients.push_back(connectTo(kPortEnhanced));
+    ok &= answersInit(clients.back());
+  }
+
+  // no slot left
+  const int rejected = connectTo(kPortEnhanced);
+  ok &= receive(rejected, 6) == "busy\r\n" && closedByPeer(rejected);
+  close(rejected);
+
+  // a closed client is noticed by the loop and leaves the set it waits on,
+  // otherwise select returns at once for it
+  close(clients[0]);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  const double before = cpuMillis(loop);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  const double busy = cpuMillis(loop) - before;
+  ok &= before >= 0 && busy < 20;
+
+  // its slot is given to the next client
+  clients[0] = connectTo(kPortEnhanced);
+  ok &= answersInit(clients[0]);
+  for (int i = 1; i < MAX_WIFI_CLIENTS; i++) ok &= answersInit(clients[i]);
+
+  for (int fd : clients) close(fd);
+  char detail[64];
+  std::snprintf(detail, sizeof(detail), "%.1f ms cpu in 200 ms after close",
+                busy);
+  return report(ok, "disconnect frees the slot", detail);
+}
+}  // namespace
+
+int main() {
+  // lwIP has no SIGPIPE, a write to a closed peer only fails
+  signal(SIGPIPE, SIG_IGN);
+
+  TaskFunction_t dataLoop = nullptr;
+  void* parameters = nullptr;
+  if (!startClientRuntime() ||
+      !SimulatedBus::task("data_loop", dataLoop, parameters)) {
+    report(false, "start client runtime", "ports 3333 to 3335 in use?");
+    return EXIT_FAILURE;
+  }
+  std::thread loop(dataLoop, parameters);
+
+  bool ok = true;
+  ok &= acceptAll();
+  ok &= idleClients();
+  ok &= disconnect(loop.native_handle());
+
+  // the data loop never returns
+  std::fflush(stdout);
+  std::_Exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+// the debug log goes nowhere on the host
+int DEBUG_LOG_IMPL(const char* format, ...) { return 0; }
@@ -0,0 +1,256 @@
+// Host benchmark of publishing the values of all commands of Store, as
+// Mqtt::publishValue does it and as it did before the value topics were kept
+// per command and the publish buffers were reused. Single values get the
+// topic and payload built for each publish, bulk values are collected in the
+// values map and published as one payload when the window ends, like
+// Mqtt::checkBulkValues. Synthetic commands stand in for Command, their
+// values are written with JsonWriter like Command::writeValueJson, and the
+// MQTT client only takes the size of what it is given.
+//
+// The heap allocations of a republish are counted through the global
+// operator new of this program.
+//
+// usage: value_benchmark [commands] [rounds]
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "JsonWriter.hpp"
+
+namespace {
+size_t allocations = 0;
+}  // namespace
+
+void* operator new(size_t size) {
+  allocations++;
+  if (void* memory = std::malloc(size)) return memory;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+
+namespace {
+constexpr std::string_view kValuesPrefix = "values/";
+
+// What publishValue takes from a command
+struct ValueCommand {
+  std::string name;
+  std::string valueTopic;  // built once, like Command::value_topic
+  bool numeric = true;
+  double value = 0;
+  std::string text;
+
+  void writeValueJson(JsonWriter& json) const {
+    json.beginObject();
+    json.key("value");
+    if (numeric)
+      json.value(value);
+    else
+      json.value(text);
+    json.endObject();
+  }
+
+  std::string getValueJson() const {
+    std::string payload;
+    JsonWriter json(payload);
+    writeValueJson(json);
+    return payload;
+  }
+};
+
+// The MQTT client, it copies the message into its outbox on the device
+size_t published = 0;
+
+void clientPublish(const char* topic, const char* payload, size_t length) {
+  published += std::char_traits<char>::length(topic) + length;
+}
+
+struct Publisher {
+  std::string rootTopic = "ebus/8406ac/";
+  bool bulk = false;
+
+  // before: everything built per publish
+  std::map<std::string, std::string> oldBulkValues;
+
+  // after: reused buffers and a map looked up by string_view
+  std::string valueTopic;
+  std::string valuePayload;
+  std::map<std::string, std::string, std::less<>> bulkValues;
+
+  void publishBefore(const ValueCommand& command) {
+    std::string subTopic = command.name;
+    std::transform(subTopic.begin(), subTopic.end(), subTopic.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+
+    if (bulk) {
+      oldBulkValues[subTopic] = command.getValueJson();
+      return;
+    }
+
+    std::string topic = "values/" + subTopic;
+    const std::string payload = command.getValueJson();
+    std::string mqttTopic = rootTopic + topic;
+    clientPublish(mqttTopic.c_str(), payload.c_str(), payload.size());
+  }
+
+  void publishAfter(const ValueCommand& command) {
+    if (bulk) {
+      std::string_view name = command.valueTopic;
+      name.remove_prefix(std::min(name.size(), kValuesPrefix.size()));
+      auto it = bulkValues.find(name);
+      if (it == bulkValues.end())
+        it = bulkValues.emplace(std::string(name), std::string()).first;
+      it->second.clear();
+      JsonWriter json(it->second);
+      command.writeValueJson(json);
+      return;
+    }
+
+    valueTopic.assign(rootTopic);
+    valueTopic.append(command.valueTopic);
+    valuePayload.clear();
+    JsonWriter json(valuePayload);
+    command.writeValueJson(json);
+    clientPublish(valueTopic.c_str(), valuePayload.c_str(),
+                  valuePayload.size());
+  }
+
+  // The end of the bulk window, the map is handed over and published
+  template <typename Map>
+  void publishBulk(Map& collected) {
+    Map values;
+    values.swap(collected);
+    if (values.empty()) return;
+
+    std::string payload;
+    JsonWriter json(payload);
+    json.beginObject();
+    for (const auto& value : values) {
+      json.key(value.first.c_str());
+      json.raw(value.second);
+    }
+    json.endObject();
+
+    std::string mqttTopic = rootTopic + "values/bulk";
+    clientPublish(mqttTopic.c_str(), payload.c_str(), payload.size());
+  }
+};
+
+std::vector<ValueCommand> makeCommands(size_t count) {
+  static const char* const kNames[] = {"Flow Temperature", "Return Temperature",
+                                       "Outside Temperature", "Pump Power",
+                                       "Operating Mode", "Water Pressure"};
+  std::vector<ValueCommand> commands(count);
+  for (size_t i = 0; i < count; i++) {
+    ValueCommand& command = commands[i];
+    char name[64];
+    std::snprintf(name, sizeof(name), "%s %03zu", kNames[i % 6], i);
+    command.name = name;
+    command.valueTopic = "values/" + command.name;
+    std::transform(command.valueTopic.begin(), command.valueTopic.end(),
+                   command.valueTopic.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    command.numeric = i % 6 != 4;
+  }
+  return commands;
+}
+
+// New values from the bus for every command
+void update(std::vector<ValueCommand>& commands, int round) {
+  static const char* const kModes[] = {"standby", "heating", "hot water"};
+  for (size_t i = 0; i < commands.size(); i++) {
+    ValueCommand& command = commands[i];
+    if (command.numeric)
+      command.value = 20.0 + ((i * 7 + round) % 400) / 10.0;
+    else
+      command.text = kModes[(i + round) % 3];
+  }
+}
+
+struct Result {
+  double meanUs = 0;
+  double allocations = 0;  // per republish, once the buffers have grown
+};
+
+Result measure(std::vector<ValueCommand>& commands, int rounds, bool bulk,
+               bool after) {
+  Publisher publisher;
+  publisher.bulk = bulk;
+
+  Result result;
+  double totalUs = 0;
+  size_t totalAllocations = 0;
+  // the first round grows the buffers and is not counted
+  for (int round = 0; round <= rounds; round++) {
+    update(commands, round);
+    const size_t before = allocations;
+    const auto begin = std::chrono::steady_clock::now();
+    for (const ValueCommand& command : commands) {
+      if (after)
+        publisher.publishAfter(command);
+      else
+        publisher.publishBefore(command);
+    }
+    if (bulk) {
+      if (after)
+        publisher.publishBulk(publisher.bulkValues);
+      else
+        publisher.publishBulk(publisher.oldBulkValues);
+    }
+    const double us = std::chrono::duration<double, std::micro>(
+                          std::chrono::steady_clock::now() - begin)
+                          .count();
+    if (round == 0) continue;
+    totalUs += us;
+    totalAllocations += allocations - before;
+  }
+
+  result.meanUs = totalUs / rounds;
+  result.allocations = static_cast<double>(totalAllocations) / rounds;
+  return result;
+}
+
+void report(const char* name, const Result& before, const Result& after,
+            size_t commands) {
+  std::printf("%-14s %9.1f us %8.1f allocs   %9.1f us %8.1f allocs   %5.2fx\n",
+              name, before.meanUs, before.allocations, after.meanUs,
+              after.allocations, before.meanUs / after.meanUs);
+  std::printf("%-14s %9.2f us %8.2f allocs   %9.2f us %8.2f allocs\n",
+              "  per value", before.meanUs / commands,
+              before.allocations / commands, after.meanUs / commands,
+              after.allocations / commands);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 300;
+  const int rounds = argc > 2 ? std::atoi(argv[2]) : 200;
+  if (count == 0 || rounds <= 0) {
+    std::fprintf(stderr, "usage: value_benchmark [commands] [rounds]\n");
+    return EXIT_FAILURE;
+  }
+
+  std::vector<ValueCommand> commands = makeCommands(count);
+
+  std::printf("republish of %zu values, mean of %d rounds\n", count, rounds);
+  std::printf("%-14s %26s   %26s\n", "", "before", "reused buffers");
+  for (bool bulk : {false, true}) {
+    const Result before = measure(commands, rounds, bulk, false);
+    const Result after = measure(commands, rounds, bulk, true);
+    report(bulk ? "bulk topic" : "single topics", before, after, count);
+  }
+
+  // keeps the publishes from being optimized away
+  return published > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}